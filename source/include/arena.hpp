@@ -0,0 +1,133 @@
+#ifndef OFS_ARENA_HPP
+#define OFS_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+// Bump allocator for memory that lives exactly as long as one request. The
+// server worker draws a request's scratch from it (decoded fields, the
+// session copy, listings, file contents) and drops all of it with reset()
+// once the response is sent.
+//
+// alloc() is a pointer bump within the current block. A request that
+// outgrows the block chains more blocks; reset() then replaces them with one
+// block sized for that request (up to MAX_RETAINED), so repeated requests of
+// a given size stop touching the global heap after the first one.
+// Objects are never destroyed, hence the trivially-destructible requirement.
+// Not thread-safe: one arena per worker thread.
+class BumpArena {
+public:
+    static const size_t DEFAULT_BLOCK = 64 << 10;
+    static const size_t MAX_RETAINED = 4 << 20;
+
+    explicit BumpArena(size_t block_size = DEFAULT_BLOCK) { head_ = cur_ = new_block(block_size); }
+    ~BumpArena() { free_chain(head_); }
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    void* alloc(size_t n, size_t align = alignof(std::max_align_t)) {
+        size_t at = (used_ + align - 1) & ~(align - 1);
+        if (at + n > cur_->size) {
+            Block* b = new_block(std::max(n + align, cur_->size * 2));
+            cur_->next = b;
+            cur_ = b;
+            used_ = 0;
+            at = 0;
+        }
+        last_ = cur_->data() + at;
+        used_ = at + n;
+        requested_ += n;
+        return last_;
+    }
+
+    template <typename T>
+    T* alloc_array(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T*>(alloc(n * sizeof(T), alignof(T)));
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (alloc(sizeof(T), alignof(T))) T(static_cast<Args&&>(args)...);
+    }
+
+    // Resizes the most recent allocation in place when it still fits in its
+    // block; otherwise copies it to a new allocation. Used to build arrays of
+    // unknown length.
+    template <typename T>
+    T* grow(T* p, size_t old_n, size_t new_n) {
+        if (p && reinterpret_cast<char*>(p) == last_ && (size_t)(last_ - cur_->data()) + new_n * sizeof(T) <= cur_->size) {
+            used_ = (size_t)(last_ - cur_->data()) + new_n * sizeof(T);
+            if (new_n > old_n) requested_ += (new_n - old_n) * sizeof(T);
+            return p;
+        }
+        T* q = alloc_array<T>(new_n);
+        if (p && old_n) std::memcpy(q, p, old_n * sizeof(T));
+        return q;
+    }
+
+    // NUL-terminated copy, for handing request fields to the C API.
+    const char* strdup(std::string_view s) {
+        char* p = static_cast<char*>(alloc(s.size() + 1, 1));
+        if (!s.empty()) std::memcpy(p, s.data(), s.size());
+        p[s.size()] = '\0';
+        return p;
+    }
+
+    // Releases everything allocated since the last reset.
+    void reset() {
+        if (head_->next) {
+            size_t want = std::min(std::max(requested_ + requested_ / 4, head_->size), MAX_RETAINED);
+            free_chain(head_);
+            head_ = new_block(want);
+        }
+        cur_ = head_;
+        used_ = 0;
+        requested_ = 0;
+        last_ = nullptr;
+    }
+
+    // Heap blocks taken so far, for tests and stats.
+    uint64_t blocks_allocated() const { return blocks_allocated_; }
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+    static_assert(sizeof(Block) % alignof(std::max_align_t) == 0, "block payload must stay aligned");
+
+    Block* new_block(size_t size) {
+        Block* b = static_cast<Block*>(std::malloc(sizeof(Block) + size));
+        if (!b) throw std::bad_alloc();
+        b->next = nullptr;
+        b->size = size;
+        ++blocks_allocated_;
+        return b;
+    }
+
+    static void free_chain(Block* b) {
+        while (b) {
+            Block* next = b->next;
+            std::free(b);
+            b = next;
+        }
+    }
+
+    Block* head_ = nullptr;
+    Block* cur_ = nullptr;
+    size_t used_ = 0;       // bytes taken in cur_
+    size_t requested_ = 0;  // bytes asked for since reset, to size the retained block
+    char* last_ = nullptr;  // most recent allocation, for grow()
+    uint64_t blocks_allocated_ = 0;
+};
+
+#endif // OFS_ARENA_HPP
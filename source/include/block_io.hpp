@@ -0,0 +1,323 @@
+#ifndef BLOCK_IO_HPP
+#define BLOCK_IO_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Positional I/O on the container, many requests per call.
+//
+// BlockIO::read/write take a whole batch (e.g. every block of a file) and
+// keep up to `depth` of them in flight at once, instead of issuing them one
+// after another at queue depth 1. Two backends:
+//
+//   URING    io_uring, driven through the raw syscalls. Each thread gets its
+//            own ring on first use, so concurrent callers never contend on
+//            one submission queue and their I/O overlaps in the device.
+//   THREADS  pread/pwrite spread over a small shared thread pool. Used when
+//            io_uring is unavailable (old kernel, seccomp) or forced with
+//            FILEVERSE_IO=threads.
+//
+// A single request is always a plain pread/pwrite: a ring round trip only
+// pays off once there is more than one request to overlap.
+
+struct IoRequest {
+    uint64_t offset;
+    void* data;
+    size_t len;
+};
+
+namespace block_io_detail {
+
+// Loops over short transfers; false on error or unexpected EOF.
+inline bool pio(int fd, bool write, uint64_t offset, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write ? ::pwrite(fd, data, len, (off_t)offset) : ::pread(fd, data, len, (off_t)offset);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        data += r; offset += (uint64_t)r; len -= (size_t)r;
+    }
+    return true;
+}
+
+// One io_uring instance, mapped by hand (no liburing dependency).
+class Ring {
+public:
+    static const unsigned ENTRIES = 64;
+
+    Ring() { ok_ = setup(); }
+    ~Ring() {
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_) munmap(sq_ptr_, sq_size_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    bool ok() const { return ok_; }
+
+    // Runs reqs[0..n) with at most `depth` in flight. Short transfers are
+    // finished synchronously.
+    bool run(int fd, bool write, const IoRequest* reqs, size_t n, unsigned depth) {
+        if (depth == 0) depth = 1;
+        if (depth > ENTRIES) depth = ENTRIES;
+        size_t next = 0, inflight = 0;
+        bool good = true;
+        while (next < n || inflight > 0) {
+            while (next < n && inflight < depth) {
+                prep(fd, write, reqs[next], next);
+                ++next;
+                ++inflight;
+            }
+            unsigned pending = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            int r = (int)syscall(__NR_io_uring_enter, fd_, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR) {
+                // The ring is unusable; nothing more can be reaped from it.
+                ok_ = false;
+                return false;
+            }
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+                const IoRequest& q = reqs[cqe.user_data];
+                if (cqe.res < 0) good = false;
+                else if ((size_t)cqe.res < q.len)
+                    good = pio(fd, write, q.offset + cqe.res, static_cast<char*>(q.data) + cqe.res, q.len - cqe.res) && good;
+                --inflight;
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        return good;
+    }
+
+private:
+    bool setup() {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd_ = (int)syscall(__NR_io_uring_setup, ENTRIES, &p);
+        if (fd_ < 0) return false;
+        // IORING_OP_READ/WRITE arrived in the same release as this flag.
+        if (!(p.features & IORING_FEAT_RW_CUR_POS)) return false;
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) { sq_ptr_ = nullptr; return false; }
+        if (single) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) { cq_ptr_ = nullptr; return false; }
+        }
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (s == MAP_FAILED) return false;
+        sqes_ = static_cast<io_uring_sqe*>(s);
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    void prep(int fd, bool write, const IoRequest& q, size_t index) {
+        unsigned tail = *sq_tail_;
+        unsigned idx = tail & *sq_mask_;
+        io_uring_sqe& sqe = sqes_[idx];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)q.data;
+        sqe.len = (uint32_t)q.len;
+        sqe.off = q.offset;
+        sqe.user_data = index;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    bool ok_ = false;
+    int fd_ = -1;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+inline Ring* thread_ring() {
+    thread_local Ring ring;
+    return ring.ok() ? &ring : nullptr;
+}
+
+// Shared pread/pwrite workers for the THREADS backend.
+class Pool {
+public:
+    static const unsigned THREADS = 16;
+
+    static Pool& get() {
+        static Pool pool;
+        return pool;
+    }
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lg(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    // Splits reqs[0..n) into `depth` interleaved shards; the caller runs one
+    // of them itself and waits for the rest.
+    bool run(int fd, bool write, const IoRequest* reqs, size_t n, unsigned depth) {
+        size_t shards = std::min<size_t>(n, std::max(1u, std::min(depth, THREADS + 1)));
+        std::atomic<bool> good{true};
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+        size_t left = shards - 1;
+        auto shard = [&, fd, write](size_t k) {
+            for (size_t i = k; i < n; i += shards)
+                if (!pio(fd, write, reqs[i].offset, static_cast<char*>(reqs[i].data), reqs[i].len)) good = false;
+        };
+        {
+            std::lock_guard<std::mutex> lg(mutex_);
+            start();
+            for (size_t k = 1; k < shards; ++k)
+                tasks_.push_back([&, k] {
+                    shard(k);
+                    std::lock_guard<std::mutex> dl(done_mutex);
+                    if (--left == 0) done_cv.notify_one();
+                });
+        }
+        cv_.notify_all();
+        shard(0);
+        std::unique_lock<std::mutex> dl(done_mutex);
+        done_cv.wait(dl, [&] { return left == 0; });
+        return good;
+    }
+
+private:
+    // Threads start on first use, so a process on the URING backend never
+    // creates them. Caller holds mutex_.
+    void start() {
+        if (!threads_.empty()) return;
+        for (unsigned i = 0; i < THREADS; ++i) threads_.emplace_back([this] { work(); });
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lg(mutex_);
+        for (;;) {
+            cv_.wait(lg, [this] { return stop_ || !tasks_.empty(); });
+            if (stop_) return;
+            std::function<void()> task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lg.unlock();
+            task();
+            lg.lock();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+}  // namespace block_io_detail
+
+class BlockIO {
+public:
+    enum class Backend { URING, THREADS };
+    static const unsigned DEFAULT_DEPTH = 32;
+
+    ~BlockIO() { close(); }
+
+    // `direct` opens with O_DIRECT (offsets, lengths and buffers must then be
+    // aligned to the device block size); false if the file cannot be opened.
+    bool open(const std::string& path, bool direct = false) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (direct ? O_DIRECT : 0));
+        if (fd_ < 0) return false;
+        const char* env = std::getenv("FILEVERSE_IO");
+        bool want_uring = !(env && std::strcmp(env, "threads") == 0);
+        backend_ = want_uring && block_io_detail::thread_ring() ? Backend::URING : Backend::THREADS;
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+    // For sendfile()/splice() straight from the container.
+    int fd() const { return fd_; }
+    Backend backend() const { return backend_; }
+    const char* backend_name() const { return backend_ == Backend::URING ? "io_uring" : "threads"; }
+
+    // Benchmarks switch backends on an open file; URING only if available.
+    bool set_backend(Backend b) {
+        if (b == Backend::URING && !block_io_detail::thread_ring()) return false;
+        backend_ = b;
+        return true;
+    }
+
+    bool read(const IoRequest* reqs, size_t n, unsigned depth = DEFAULT_DEPTH) { return run(false, reqs, n, depth); }
+    bool write(const IoRequest* reqs, size_t n, unsigned depth = DEFAULT_DEPTH) { return run(true, reqs, n, depth); }
+
+    bool read(uint64_t offset, void* data, size_t len) {
+        return block_io_detail::pio(fd_, false, offset, static_cast<char*>(data), len);
+    }
+    bool write(uint64_t offset, const void* data, size_t len) {
+        return block_io_detail::pio(fd_, true, offset, static_cast<char*>(const_cast<void*>(data)), len);
+    }
+
+private:
+    bool run(bool write, const IoRequest* reqs, size_t n, unsigned depth) {
+        if (fd_ < 0) return false;
+        if (n == 0) return true;
+        if (n == 1 || depth <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                if (!block_io_detail::pio(fd_, write, reqs[i].offset, static_cast<char*>(reqs[i].data), reqs[i].len)) return false;
+            return true;
+        }
+        if (backend_ == Backend::URING) {
+            // Threads that cannot set up a ring of their own use the pool.
+            if (block_io_detail::Ring* ring = block_io_detail::thread_ring()) return ring->run(fd_, write, reqs, n, depth);
+        }
+        return block_io_detail::Pool::get().run(fd_, write, reqs, n, depth);
+    }
+
+    int fd_ = -1;
+    Backend backend_ = Backend::THREADS;
+};
+
+#endif // BLOCK_IO_HPP
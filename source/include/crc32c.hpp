@@ -0,0 +1,100 @@
+#ifndef OFS_CRC32C_HPP
+#define OFS_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C (Castagnoli), for the block and file slot checksums.
+//
+// On x86-64 CPUs with SSE4.2 the crc32 instruction does 8 bytes per step;
+// the check is made once at runtime, so the build needs no -msse4.2. Other
+// CPUs use slicing-by-8 tables. Both give the same result:
+// crc32c("123456789", 9) == 0xe3069283.
+
+namespace crc32c_detail {
+
+struct Tables {
+    uint32_t t[8][256];
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82f63b78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline uint32_t slicing8(uint32_t crc, const uint8_t* p, size_t len) {
+    const Tables& tb = tables();
+    while (len >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = tb.t[7][lo & 0xff] ^ tb.t[6][(lo >> 8) & 0xff] ^ tb.t[5][(lo >> 16) & 0xff] ^ tb.t[4][lo >> 24] ^
+              tb.t[3][hi & 0xff] ^ tb.t[2][(hi >> 8) & 0xff] ^ tb.t[1][(hi >> 16) & 0xff] ^ tb.t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ tb.t[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+inline bool have_sse42() {
+    static const bool yes = __builtin_cpu_supports("sse4.2");
+    return yes;
+}
+#endif
+
+}  // namespace crc32c_detail
+
+// Continues `crc` (the result of an earlier call, or 0) over `len` more bytes.
+inline uint32_t crc32c_extend(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_detail::have_sse42()) return ~crc32c_detail::sse42(crc, p, len);
+#endif
+    return ~crc32c_detail::slicing8(crc, p, len);
+}
+
+inline uint32_t crc32c(const void* data, size_t len) {
+    return crc32c_extend(0, data, len);
+}
+
+// Which implementation crc32c uses here, for tools and logs.
+inline const char* crc32c_impl() {
+#if defined(__x86_64__)
+    if (crc32c_detail::have_sse42()) return "sse4.2";
+#endif
+    return "slicing-by-8";
+}
+
+#endif // OFS_CRC32C_HPP
@@ -0,0 +1,77 @@
+#ifndef OFS_METRICS_HPP
+#define OFS_METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+inline uint64_t metrics_now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lock-free latency histogram with power-of-two nanosecond buckets: bucket i
+// counts samples in [2^i, 2^(i+1)) ns. record() is two relaxed atomic adds
+// (the sample count is the sum of the buckets), so it can stay on in
+// production; readers see a consistent-enough view without stopping writers.
+struct LatencyHistogram {
+    static const int BUCKETS = 40;  // top bucket holds everything >= ~4.6 min
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> sum_ns{0};
+
+    static int bucket_of(uint64_t ns) {
+        int b = ns ? 63 - __builtin_clzll(ns) : 0;
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+
+    void record(uint64_t ns) {
+        buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (int i = 0; i < BUCKETS; ++i) n += buckets[i].load(std::memory_order_relaxed);
+        return n;
+    }
+
+    // Upper bound of the bucket holding quantile q (0 < q <= 1); 0 if empty.
+    uint64_t quantile_ns(double q) const {
+        uint64_t total = 0;
+        uint64_t snap[BUCKETS];
+        for (int i = 0; i < BUCKETS; ++i) total += snap[i] = buckets[i].load(std::memory_order_relaxed);
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += snap[i];
+            if (seen >= rank) return 2ull << i;
+        }
+        return 2ull << (BUCKETS - 1);
+    }
+};
+
+// Records the lifetime of the scope into `h`.
+struct ScopedLatency {
+    LatencyHistogram& h;
+    uint64_t t0;
+    explicit ScopedLatency(LatencyHistogram& hist) : h(hist), t0(metrics_now_ns()) {}
+    ~ScopedLatency() { h.record(metrics_now_ns() - t0); }
+};
+
+// Recorded by omni_core.cpp; process-wide, like the .omni I/O it measures.
+struct CoreMetrics {
+    LatencyHistogram io_read;           // read_at / read_file_range
+    LatencyHistogram io_write;          // write_at
+    LatencyHistogram metadata_persist;  // free map + file table write
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> checksum_errors{0};  // bad blocks/tails found by reads and scrubs
+    std::atomic<uint64_t> scrub_bytes{0};      // read and verified by scrub passes
+    std::atomic<uint64_t> scrub_passes{0};
+};
+
+inline CoreMetrics g_core_metrics;
+
+#endif // OFS_METRICS_HPP
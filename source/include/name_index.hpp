@@ -0,0 +1,177 @@
+#ifndef OFS_NAME_INDEX_HPP
+#define OFS_NAME_INDEX_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Name search (file_search): patterns and a trigram index over entry names.
+//
+// Matching ignores ASCII case. A substring pattern matches anywhere in a
+// name; a glob must match the whole name, `*` standing for any run of bytes
+// and `?` for one byte.
+//
+// The index maps each distinct three-byte sequence of a name, case folded, to
+// the sorted list of slots whose name contains it. A pattern's literal runs
+// of three bytes or more give its trigrams; the intersection of their lists
+// holds every slot that can match, and each is then checked against its name.
+// A pattern with no such run (say "*.c") has nothing to look up and the
+// caller scans all names instead.
+
+inline char fold_ascii(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+inline uint32_t trigram_at(const char* p) {
+    return (uint32_t)(uint8_t)fold_ascii(p[0]) << 16 | (uint32_t)(uint8_t)fold_ascii(p[1]) << 8 |
+           (uint32_t)(uint8_t)fold_ascii(p[2]);
+}
+
+// The distinct trigrams of `s`, sorted, appended to `out`.
+inline void trigrams_of(std::string_view s, std::vector<uint32_t>& out) {
+    size_t first = out.size();
+    for (size_t i = 0; i + 3 <= s.size(); ++i) out.push_back(trigram_at(s.data() + i));
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
+
+class NamePattern {
+public:
+    NamePattern(std::string_view pattern, bool glob) : glob_(glob) {
+        for (char c : pattern) text_ += fold_ascii(c);
+        size_t run = 0;
+        for (size_t i = 0; i <= text_.size(); ++i) {
+            if (i < text_.size() && !(glob_ && (text_[i] == '*' || text_[i] == '?'))) continue;
+            trigrams_of(std::string_view(text_).substr(run, i - run), trigrams_);
+            run = i + 1;
+        }
+        std::sort(trigrams_.begin(), trigrams_.end());
+        trigrams_.erase(std::unique(trigrams_.begin(), trigrams_.end()), trigrams_.end());
+    }
+
+    bool empty() const { return text_.empty(); }
+    const std::vector<uint32_t>& trigrams() const { return trigrams_; }
+
+    bool matches(std::string_view name) const {
+        return glob_ ? glob_match(name) : substring_match(name);
+    }
+
+private:
+    bool substring_match(std::string_view name) const {
+        if (text_.size() > name.size()) return false;
+        for (size_t i = 0; i + text_.size() <= name.size(); ++i) {
+            size_t k = 0;
+            while (k < text_.size() && fold_ascii(name[i + k]) == text_[k]) ++k;
+            if (k == text_.size()) return true;
+        }
+        return false;
+    }
+
+    // Backtracks to the last `*` only, so a match costs O(name x pattern) at worst.
+    bool glob_match(std::string_view name) const {
+        size_t p = 0, n = 0, star = std::string::npos, mark = 0;
+        while (n < name.size()) {
+            if (p < text_.size() && (text_[p] == '?' || (text_[p] != '*' && text_[p] == fold_ascii(name[n])))) {
+                ++p;
+                ++n;
+            } else if (p < text_.size() && text_[p] == '*') {
+                star = p++;
+                mark = n;
+            } else if (star != std::string::npos) {
+                p = star + 1;
+                n = ++mark;
+            } else {
+                return false;
+            }
+        }
+        while (p < text_.size() && text_[p] == '*') ++p;
+        return p == text_.size();
+    }
+
+    std::string text_;
+    bool glob_;
+    std::vector<uint32_t> trigrams_;
+};
+
+// Trigram -> sorted slots. Not synchronized: OFSInstance::search_mutex.
+class NameIndex {
+public:
+    void add(uint32_t slot, std::string_view name) {
+        scratch_.clear();
+        trigrams_of(name, scratch_);
+        for (uint32_t g : scratch_) {
+            std::vector<uint32_t>& list = postings_[g];
+            // New slots mostly come from the top of the free list, past the end.
+            if (list.empty() || list.back() < slot) {
+                list.push_back(slot);
+                continue;
+            }
+            auto it = std::lower_bound(list.begin(), list.end(), slot);
+            if (*it != slot) list.insert(it, slot);
+        }
+    }
+
+    void remove(uint32_t slot, std::string_view name) {
+        scratch_.clear();
+        trigrams_of(name, scratch_);
+        for (uint32_t g : scratch_) {
+            auto found = postings_.find(g);
+            if (found == postings_.end()) continue;
+            std::vector<uint32_t>& list = found->second;
+            auto it = std::lower_bound(list.begin(), list.end(), slot);
+            if (it != list.end() && *it == slot) list.erase(it);
+            if (list.empty()) postings_.erase(found);
+        }
+    }
+
+    // Slots whose names contain every trigram in `grams`, ascending. False
+    // when `grams` is empty: the index cannot narrow the search.
+    bool candidates(const std::vector<uint32_t>& grams, std::vector<uint32_t>& out) const {
+        out.clear();
+        if (grams.empty()) return false;
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (uint32_t g : grams) {
+            auto it = postings_.find(g);
+            if (it == postings_.end()) return true;
+            lists.push_back(&it->second);
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+        out = *lists[0];
+        // Once few candidates are left, checking their names is cheaper than
+        // walking more lists.
+        for (size_t i = 1; i < lists.size() && out.size() > 32; ++i) intersect(out, *lists[i]);
+        return true;
+    }
+
+private:
+    // Keeps the slots of `a` that are also in `b`. Against a much longer list,
+    // each slot is found by binary search from where the previous one was.
+    static void intersect(std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+        size_t keep = 0;
+        if (b.size() > a.size() * 16) {
+            auto from = b.begin();
+            for (uint32_t s : a) {
+                from = std::lower_bound(from, b.end(), s);
+                if (from == b.end()) break;
+                if (*from == s) a[keep++] = s;
+            }
+        } else {
+            size_t j = 0;
+            for (size_t i = 0; i < a.size() && j < b.size(); ++i) {
+                while (j < b.size() && b[j] < a[i]) ++j;
+                if (j < b.size() && b[j] == a[i]) a[keep++] = a[i];
+            }
+        }
+        a.resize(keep);
+    }
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings_;
+    std::vector<uint32_t> scratch_;
+};
+
+#endif // OFS_NAME_INDEX_HPP
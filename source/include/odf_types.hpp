@@ -91,8 +91,24 @@ struct OMNIHeader {
     // Reserved for Phase 2: Delta Vault 
     uint32_t file_state_storage_offset;  // Offset to file_state_storage area (4 bytes)
     uint32_t change_log_offset;       // Offset to change log (4 bytes)
-    
-    uint8_t reserved[328];      // Reserved for future use (328 bytes)
+
+    // Layout computed by fs_format from the config (52 bytes). All zero in
+    // containers formatted before the layout was recorded.
+    uint64_t free_map_offset;   // One byte per content block (8 bytes)
+    uint64_t file_table_offset; // max_files FileSlot records (8 bytes)
+    uint64_t chain_offset;      // uint32 next-block pointer per content block (8 bytes)
+    uint64_t content_offset;    // First content block, block_size aligned (8 bytes)
+    uint64_t num_blocks;        // Number of content blocks (8 bytes)
+    uint32_t max_files;         // File table slots (4 bytes)
+    uint32_t file_slot_size;    // sizeof(FileSlot) at format time (4 bytes)
+    uint32_t fragment_size;     // Tail fragment granularity in bytes (4 bytes)
+
+    // Checksum areas (16 bytes). Zero in containers formatted before
+    // checksums were added; nothing is verified in those.
+    uint64_t block_checksum_offset; // uint32 CRC32C per content block (8 bytes)
+    uint64_t slot_checksum_offset;  // SlotChecksum per file slot (8 bytes)
+
+    uint8_t reserved[260];      // Reserved for future use (260 bytes)
 
     // Default constructor
     OMNIHeader() = default;
@@ -148,7 +164,8 @@ struct FileEntry {
     uint64_t modified_time;     // Last modification timestamp (Unix epoch)
     char owner[32];             // Username of owner
     uint32_t inode;             // Internal file identifier
-    uint8_t reserved[47];       // Reserved for future use
+    uint32_t parent_inode;      // Inode of the containing directory, 0 for the root
+    uint8_t reserved[43];       // Reserved for future use
 
     // Default constructor
     FileEntry() = default;
@@ -157,7 +174,7 @@ struct FileEntry {
     FileEntry(const std::string& filename, EntryType entry_type, uint64_t file_size, 
               uint32_t perms, const std::string& file_owner, uint32_t file_inode)
         : type(static_cast<uint8_t>(entry_type)), size(file_size), permissions(perms), 
-          created_time(0), modified_time(0), inode(file_inode) {
+          created_time(0), modified_time(0), inode(file_inode), parent_inode(0) {
         std::strncpy(name, filename.c_str(), sizeof(name) - 1);
         name[sizeof(name) - 1] = '\0';
         std::strncpy(owner, file_owner.c_str(), sizeof(owner) - 1);
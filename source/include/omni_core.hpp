@@ -2,10 +2,74 @@
 #define OMNI_CORE_HPP
 
 #include "odf_types.hpp"
+#include "block_io.hpp"
+#include "arena.hpp"
+#include "name_index.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
-#include <string>
+#include <cstring>
 #include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <condition_variable>
+
+/* One piece of a file for zero-copy sends: `len` bytes at `offset` in the
+ * container (container_fd), or, for an inline tail, `len` bytes at `data`. */
+struct FileExtent {
+    uint64_t offset;
+    uint64_t len;
+    const char* data;
+};
+
+/* One file for file_create_many: `size` bytes at `data` go to `path`;
+ * `result` receives that file's error code. */
+struct ImportItem {
+    const char* path;
+    const char* data;
+    uint64_t size;
+    int result;
+};
+
+/* Scrub settings (fs_scrub, fs_scrubber_start). `threads` 0 means one per
+ * core; `bytes_per_sec` 0 means unthrottled. `report` (optional) gets one
+ * line per problem found; calls are serialized. */
+struct ScrubOptions {
+    int threads;
+    uint64_t bytes_per_sec;
+    int repair;  // fs_scrub only: fix the free map and clear damaged slots
+    void (*report)(void* ctx, const char* problem);
+    void* ctx;
+};
+
+/* What one scrub pass found. */
+struct ScrubReport {
+    uint64_t files;            // file versions whose contents were checked
+    uint64_t blocks;           // blocks and fragment tails verified
+    uint64_t bytes;            // bytes read and checksummed
+    uint64_t skipped;          // versions replaced before they were reached
+    uint64_t checksum_errors;  // blocks or tails whose contents fail their checksum
+    uint64_t read_errors;
+    uint64_t map_errors;       // bad, shared or free-marked block references
+    uint64_t leaked_blocks;    // marked used, referenced by nothing
+    uint64_t damaged_slots;    // file slots fs_init skipped (torn write)
+    uint64_t repaired;
+    int checksums;             // 0: container has no checksums, maps checked only
+    double seconds;
+};
+
+/* Totals over everything below a directory (dir_usage). */
+struct DirUsage {
+    uint64_t bytes;   // file sizes
+    uint64_t blocks;  // whole content blocks; tails share fragment blocks and are not counted
+    uint64_t files;
+    uint64_t dirs;
+};
 
 /* C-style API */
 extern "C" {
@@ -19,10 +83,76 @@ extern "C" {
     int user_list(void* instance, void* admin_session, UserInfo** users, int* count);
     int file_create(void* instance, void* session, const char* path, const char* data, size_t size);
     int file_read(void* instance, void* session, const char* path, char** buffer, size_t* size_out);
+    int file_read_range(void* instance, void* session, const char* path, uint64_t offset, char* buffer, size_t len, size_t* read_out, uint64_t* file_size_out);
     int file_delete(void* instance, void* session, const char* path);
+    /* Renames or moves a file or directory: one entry changes, whatever is
+     * below it. A file already at new_path is replaced, like rename(2) */
+    int file_rename(void* instance, void* session, const char* old_path, const char* new_path);
+
+    /* Batches: the calling thread's writes are staged until fs_batch_end, which
+     * publishes them together and persists metadata once (commit=0 discards) */
+    int fs_batch_begin(void* instance);
+    int fs_batch_end(void* instance, int commit);
+    /* Bulk import: creates `count` files with one block allocation, one
+     * submission of their contents and one publish. Returns the first
+     * per-item error; the other items are created */
+    int file_create_many(void* instance, void* session, ImportItem* items, int count);
+
+    /* Chunked transfers: bounded memory per transfer, atomic commit */
+    int file_upload_open(void* instance, void* session, const char* path, uint64_t* handle_out);
+    int file_upload_write(void* instance, void* session, uint64_t handle, uint64_t offset, const char* data, size_t size, uint64_t* size_out);
+    int file_upload_commit(void* instance, void* session, uint64_t handle);
+    int file_upload_abort(void* instance, void* session, uint64_t handle);
+    int file_download_open(void* instance, void* session, const char* path, uint64_t* handle_out, uint64_t* size_out);
+    int file_download_read(void* instance, void* session, uint64_t handle, uint64_t offset, char* buffer, size_t len, size_t* read_out);
+    int file_download_close(void* instance, void* session, uint64_t handle);
     int file_exists(void* instance, void* session, const char* path);
     int dir_create(void* instance, void* session, const char* path);
     int dir_list(void* instance, void* session, const char* path, FileEntry** entries, int* count);
+    /* Removes a directory; with recursive != 0 everything below it goes too,
+     * in one publish. Fails with nothing removed if the caller may not
+     * delete every entry */
+    int dir_delete(void* instance, void* session, const char* path, int recursive);
+    /* Totals below `path`, kept up to date by every write: no scan */
+    int dir_usage(void* instance, void* session, const char* path, DirUsage* usage);
+    /* Entries the session may see whose name contains `pattern`, ASCII case
+     * ignored; with glob != 0 the whole name must match, `*` and `?` being
+     * wildcards. Full paths, in no particular order, at most `limit` of them
+     * (0: all). Backed by a trigram index of the names */
+    int file_search(void* instance, void* session, const char* pattern, int glob, int limit, FileEntry** entries, int* count);
+
+    /* Request-scoped variants: results come from `arena` instead of new[]
+     * and are released by its reset(); the session is copied into caller
+     * storage instead of a heap copy */
+    int get_session_into(void* instance, const char* token, SessionInfo* session_out);
+    int user_list_arena(void* instance, void* admin_session, BumpArena* arena, UserInfo** users, int* count);
+    int file_read_arena(void* instance, void* session, const char* path, BumpArena* arena, char** buffer, size_t* size_out);
+    int dir_list_arena(void* instance, void* session, const char* path, BumpArena* arena, FileEntry** entries, int* count);
+    int file_search_arena(void* instance, void* session, const char* pattern, int glob, int limit, BumpArena* arena,
+                          FileEntry** entries, int* count);
+
+    /* Zero-copy reads: where [offset, offset+len) of the current version (or
+     * of an open download) lives in the container, in file order, for
+     * sendfile() from container_fd. Extents and inline bytes come from
+     * `arena`; the blocks stay allocated until file_release_map(*hold_out),
+     * even if the file is rewritten or the download closed meanwhile. With
+     * checksums the blocks are read and verified first; a mismatch returns
+     * ERROR_IO_ERROR and no extents */
+    int container_fd(void* instance);
+    int file_map_range(void* instance, void* session, const char* path, uint64_t offset, uint64_t len, BumpArena* arena,
+                       FileExtent** extents, int* count, uint64_t* file_size_out, uint64_t* hold_out);
+    int file_download_map(void* instance, void* session, uint64_t handle, uint64_t offset, uint64_t len, BumpArena* arena,
+                          FileExtent** extents, int* count, uint64_t* hold_out);
+    void file_release_map(void* instance, uint64_t hold);
+
+    /* Integrity: fs_scrub checks the free map against every block map, then
+     * reads and checksums every block of every file on `threads` threads.
+     * The background scrubber repeats that every `interval_secs`, without
+     * repair; fs_scrub_status returns its last completed pass */
+    int fs_scrub(void* instance, const ScrubOptions* options, ScrubReport* report);
+    int fs_scrubber_start(void* instance, const ScrubOptions* options, uint64_t interval_secs);
+    void fs_scrubber_stop(void* instance);
+    int fs_scrub_status(void* instance, ScrubReport* last, uint64_t* passes);
 }
 
 /* Internal instance object and simple user index */
@@ -68,25 +198,441 @@ struct SimpleUserIndex {
     }
 };
 
+/* On-disk file table record; fs_format reserves header.max_files of them.
+ * A file's blocks form a chain in the array at header.chain_offset: entry b
+ * holds the block after b, or FILE_CHAIN_END. Updating one file rewrites its
+ * slot and the chain entries of its blocks, never the whole table.
+ *
+ * Bytes past the last whole block (the tail) are not given a block of their
+ * own unless they fill more than half of one: up to FILE_INLINE_MAX bytes are
+ * stored in the slot itself, larger tails in a run of FRAGMENT_SIZE units
+ * inside a block shared with other tails.
+ *
+ * Names: entry.name is the entry's own name and entry.parent_inode its
+ * directory (0 for the root), so a rename or move rewrites one slot. Slots
+ * written before that (in_parent 0) hold the full path; fs_init converts them.
+ *
+ * Checksums (containers with header.slot_checksum_offset set): the CRC32C of
+ * each content block's bytes in use is kept at block_checksum_offset, one
+ * uint32 per block, written with the chain. Each slot has a SlotChecksum
+ * covering the slot record and, for a fragment tail, the tail's bytes. */
+static const uint32_t FILE_CHAIN_END = 0xffffffffu;
+static const uint32_t FRAGMENT_SIZE = 256;
+static const uint32_t FILE_INLINE_MAX = 620;
+static const uint8_t FREE_MAP_FRAGMENTS = 2;  // free_map value of a block holding tails
+static const uint32_t ROOT_DIR = 0xfffffffeu;  // parent of the entries directly under "/"
+static const uint32_t NO_ENTRY = 0xffffffffu;
+#pragma pack(push, 1)
+struct FileSlot {
+    FileEntry entry;
+    uint32_t first_block;   // FILE_CHAIN_END when the file has no blocks
+    uint32_t block_count;
+    uint32_t tail_block;    // fragment block holding the tail, or FILE_CHAIN_END
+    uint32_t tail_unit;     // first FRAGMENT_SIZE unit of the tail in tail_block
+    uint8_t in_use;
+    uint8_t in_parent;      // entry.name is one component under entry.parent_inode
+    uint8_t reserved[2];
+    char inline_data[FILE_INLINE_MAX];  // the tail when tail_block is FILE_CHAIN_END
+};
+#pragma pack(pop)
+static_assert(sizeof(FileSlot) == 1024, "FileSlot layout changed");
+
+struct SlotChecksum {
+    uint32_t slot;  // CRC32C of the FileSlot record
+    uint32_t tail;  // CRC32C of a fragment tail, else 0
+};
+
+/* A tail stored in a fragment block: `units` FRAGMENT_SIZE units from `unit`. */
+struct Fragment {
+    uint32_t block = FILE_CHAIN_END;
+    uint32_t unit = 0;
+    uint32_t units = 0;
+};
+
+/* Storage for entry names. Names are copied into 1 MiB chunks that never move
+ * or go away while the instance lives, so a name stays readable from any
+ * snapshot without a lock. A deleted or renamed entry's name is retired with
+ * its blocks; the bytes are then reused for a later name of the same rounded
+ * length. Writers only (write_mutex). */
+struct NameArena {
+    static const size_t CHUNK = 1 << 20;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used = CHUNK;  // bytes taken in the current chunk
+    std::unordered_map<size_t, std::vector<char*>> free_lists;  // by rounded length
+    uint64_t bytes = 0;   // reserved from the heap, for reporting
+
+    static size_t rounded(size_t len) { return (len + 7) & ~(size_t)7; }
+    std::string_view intern(const char* s, size_t len) {
+        if (len == 0) return std::string_view();
+        size_t need = rounded(len);
+        char* p = nullptr;
+        auto it = free_lists.find(need);
+        if (it != free_lists.end() && !it->second.empty()) {
+            p = it->second.back();
+            it->second.pop_back();
+        } else if (need > CHUNK / 4) {
+            // Odd long path: its own allocation, so the current chunk keeps filling.
+            chunks.emplace(chunks.begin(), new char[need]);
+            bytes += need;
+            p = chunks.front().get();
+        } else {
+            if (used + need > CHUNK) {
+                chunks.emplace_back(new char[CHUNK]);
+                bytes += CHUNK;
+                used = 0;
+            }
+            p = chunks.back().get() + used;
+            used += need;
+        }
+        std::memcpy(p, s, len);
+        return std::string_view(p, len);
+    }
+    void release(std::string_view s) {
+        if (!s.empty()) free_lists[rounded(s.size())].push_back(const_cast<char*>(s.data()));
+    }
+};
+
+/* Epoch-based reclamation for content blocks superseded by a newer file version.
+ * Readers pin the current epoch for the duration of a snapshot read; blocks
+ * retired at epoch E are only returned to the free map once every pinned
+ * reader is past E, so a reader never sees its blocks reused underneath it. */
+struct EpochReclaimer {
+    static const size_t MAX_READERS = 64;
+    std::atomic<uint64_t> global_epoch{1};
+    std::atomic<uint64_t> reader_epoch[MAX_READERS] = {};  // 0 = slot idle
+    struct Retired {
+        uint64_t epoch;
+        std::vector<uint32_t> blocks;
+        std::vector<Fragment> fragments;
+        std::vector<std::string_view> names;
+    };
+    std::vector<Retired> retired;  // guarded by OFSInstance::write_mutex
+
+    size_t pin() {
+        static std::atomic<size_t> next_hint{0};
+        thread_local size_t hint = next_hint.fetch_add(1) % MAX_READERS;
+        for (size_t n = 0;; ++n) {
+            size_t i = (hint + n) % MAX_READERS;
+            uint64_t idle = 0;
+            if (reader_epoch[i].compare_exchange_strong(idle, global_epoch.load())) {
+                hint = i;
+                return i;
+            }
+            if (n % MAX_READERS == MAX_READERS - 1) std::this_thread::yield();
+        }
+    }
+    void unpin(size_t slot) { reader_epoch[slot].store(0); }
+    uint64_t min_pinned() {
+        uint64_t m = UINT64_MAX;
+        for (size_t i = 0; i < MAX_READERS; ++i) {
+            uint64_t e = reader_epoch[i].load();
+            if (e != 0 && e < m) m = e;
+        }
+        std::lock_guard<std::mutex> lg(held_mutex);
+        if (!held.empty() && *held.begin() < m) m = *held.begin();
+        return m;
+    }
+
+    // Long-lived pins (open downloads) live here instead of occupying a
+    // reader slot. Take the hold while still pinned, then unpin.
+    std::mutex held_mutex;
+    std::multiset<uint64_t> held;
+    void hold(uint64_t epoch) {
+        std::lock_guard<std::mutex> lg(held_mutex);
+        held.insert(epoch);
+    }
+    void release_held(uint64_t epoch) {
+        std::lock_guard<std::mutex> lg(held_mutex);
+        auto it = held.find(epoch);
+        if (it != held.end()) held.erase(it);
+    }
+};
+
 struct OFSInstance {
     OMNIHeader header;
     std::string omni_path;
+    BlockIO io;  // the open container; all I/O after fs_init goes through it
     uint32_t max_users = 0;
     std::vector<UserInfo> users;
     SimpleUserIndex user_index;
     std::vector<uint8_t> free_map;
+    std::vector<uint32_t> free_map_dirty;  // entries changed since persist_metadata last wrote them
     uint64_t num_blocks = 0;
     uint64_t block_size = 0;
     std::vector<SessionInfo> sessions;
-    std::mutex mutex;
+    mutable std::mutex mutex;  // sessions, and user_index against user_create
     bool dirty = false;
     uint64_t content_offset = 0;
+    /* One version of a file or directory. FileEntry is only built from it at
+     * the API boundary (entry_of); the name lives in `names`, the path is the
+     * chain of parents and the owner is an id (owner_name). */
     struct InMemoryFile {
+        std::string_view name;     // the last path component
+        uint32_t parent = ROOT_DIR;  // slot of the containing directory
+        uint32_t owner = 0;
+        uint32_t permissions = 0;
+        uint8_t type = 0;
+        uint32_t slot = 0;  // file table slot; kept across versions
+        uint64_t size = 0;
+        uint64_t created_time = 0;
+        uint64_t modified_time = 0;
+        std::vector<uint32_t> blocks;  // whole blocks, then the tail:
+        Fragment fragment;             // in a fragment block, or
+        std::string inline_data;       // in the slot when fragment.units == 0
+        uint32_t tail_crc = 0;         // CRC32C of a fragment tail
+        EntryType getType() const { return static_cast<EntryType>(type); }
+    };
+    /* The fields lookups and listings scan, 24 bytes per entry (20 of fields
+     * plus alignment padding) and contiguous within a page; keys[s] belongs
+     * to files[s]. `name` is null for a free slot. */
+    struct FileKey {
+        const char* name = nullptr;
+        uint32_t name_len = 0;
+        uint32_t parent = NO_ENTRY;
+        uint32_t owner = 0;
+    };
+    static_assert(sizeof(FileKey) == 24, "FileKey layout changed: dir_list scans one per entry");
+    /* TABLE_PAGE_SLOTS consecutive slots of a FileTable. Tables share the
+     * pages they have in common; a writer copies a page the first time it
+     * changes it (FileTable::edit), so a write costs the page array plus the
+     * pages it touches, not the whole table. */
+    static const uint32_t TABLE_PAGE_SLOTS = 256;
+    struct TablePage {
+        FileKey keys[TABLE_PAGE_SLOTS];
+        std::shared_ptr<const InMemoryFile> files[TABLE_PAGE_SLOTS];
+        DirUsage usage[TABLE_PAGE_SLOTS] = {};
+    };
+    using TablePages = std::vector<std::shared_ptr<TablePage>>;
+    static const FileKey& key_at(const TablePages& pages, uint32_t slot) {
+        return pages[slot / TABLE_PAGE_SLOTS]->keys[slot % TABLE_PAGE_SLOTS];
+    }
+    /* Shared pointee of a table being written: copied unless this table is
+     * its only owner. Nothing else can take a new reference meanwhile, since
+     * the table is not published yet. */
+    template <typename T>
+    static T& unshare(std::shared_ptr<T>& p) {
+        if (p.use_count() != 1) p = std::make_shared<T>(*p);
+        return *p;
+    }
+    /* (parent, name) -> slot, split by hash into shards that tables share
+     * like pages. A shard is open addressing over `cells` (slot + 1, 0 when
+     * empty), at most half full; the shards double in number once they
+     * average CHILD_SHARD_ENTRIES entries. */
+    static const size_t CHILD_SHARD_ENTRIES = 512;
+    struct ChildShard {
+        std::vector<uint32_t> cells;
+        size_t count = 0;
+    };
+    struct ChildIndex {
+        std::vector<std::shared_ptr<ChildShard>> shards;
+        size_t count = 0;
+
+        static uint64_t hash(uint32_t parent, const char* name, size_t len) {
+            uint64_t h = 1469598103934665603ull ^ parent;  // FNV-1a
+            for (size_t i = 0; i < len; ++i) h = (h ^ (uint8_t)name[i]) * 1099511628211ull;
+            return h ^ (h >> 32);
+        }
+        static uint64_t hash(const FileKey& k) { return hash(k.parent, k.name, k.name_len); }
+        uint32_t find(const TablePages& pages, uint32_t parent, const char* name, size_t len) const {
+            if (shards.empty()) return NO_ENTRY;
+            uint64_t h = hash(parent, name, len);
+            const ChildShard& sh = *shards[shard_of(h)];
+            if (sh.cells.empty()) return NO_ENTRY;
+            size_t mask = sh.cells.size() - 1;
+            for (size_t i = h & mask; sh.cells[i]; i = (i + 1) & mask) {
+                const FileKey& k = key_at(pages, sh.cells[i] - 1);
+                if (k.parent == parent && k.name_len == len && std::memcmp(k.name, name, len) == 0) return sh.cells[i] - 1;
+            }
+            return NO_ENTRY;
+        }
+        // The slot's key must already hold the entry.
+        void insert(const TablePages& pages, uint32_t slot) {
+            if ((count + 1) > shards.size() * CHILD_SHARD_ENTRIES) reshard(pages);
+            ChildShard& sh = unshare(shards[shard_of(hash(key_at(pages, slot)))]);
+            if ((sh.count + 1) * 2 > sh.cells.size()) rehash(pages, sh, std::max<size_t>(16, sh.cells.size() * 2));
+            place(pages, sh, slot);
+            ++count;
+        }
+        // The slot's key must still hold the entry. Later cells of the probe
+        // run move back into the gap, so lookups never need tombstones.
+        void erase(const TablePages& pages, uint32_t slot) {
+            uint64_t h = hash(key_at(pages, slot));
+            ChildShard& sh = unshare(shards[shard_of(h)]);
+            size_t mask = sh.cells.size() - 1;
+            size_t i = h & mask;
+            while (sh.cells[i] != slot + 1) i = (i + 1) & mask;
+            for (size_t j = (i + 1) & mask; sh.cells[j]; j = (j + 1) & mask) {
+                size_t home = hash(key_at(pages, sh.cells[j] - 1)) & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                    sh.cells[i] = sh.cells[j];
+                    i = j;
+                }
+            }
+            sh.cells[i] = 0;
+            --sh.count;
+            --count;
+        }
+    private:
+        // Low hash bits pick the cell, high ones the shard.
+        size_t shard_of(uint64_t h) const { return (size_t)(h >> 40) & (shards.size() - 1); }
+        static void place(const TablePages& pages, ChildShard& sh, uint32_t slot) {
+            size_t mask = sh.cells.size() - 1;
+            size_t i = hash(key_at(pages, slot)) & mask;
+            while (sh.cells[i]) i = (i + 1) & mask;
+            sh.cells[i] = slot + 1;
+            ++sh.count;
+        }
+        static void rehash(const TablePages& pages, ChildShard& sh, size_t cells) {
+            std::vector<uint32_t> old(cells, 0);
+            old.swap(sh.cells);
+            sh.count = 0;
+            for (uint32_t c : old)
+                if (c) place(pages, sh, c - 1);
+        }
+        // Doubles the shards (one to start with) and spreads the entries
+        // over new ones.
+        void reshard(const TablePages& pages) {
+            std::vector<std::shared_ptr<ChildShard>> old(std::max<size_t>(1, shards.size() * 2));
+            old.swap(shards);
+            std::vector<size_t> counts(shards.size(), 0);
+            for (const auto& sh : old)
+                for (uint32_t c : sh->cells)
+                    if (c) ++counts[shard_of(hash(key_at(pages, c - 1)))];
+            for (size_t i = 0; i < shards.size(); ++i) {
+                size_t cells = 16;
+                while (cells < (counts[i] + 1) * 2) cells *= 2;
+                shards[i] = std::make_shared<ChildShard>();
+                shards[i]->cells.assign(cells, 0);
+            }
+            for (const auto& sh : old)
+                for (uint32_t c : sh->cells)
+                    if (c) place(pages, *shards[shard_of(hash(key_at(pages, c - 1)))], c - 1);
+        }
+    };
+    /* Immutable snapshot of the file table, indexed by slot. Writers copy it,
+     * swap in new file versions and publish the result with std::atomic_store;
+     * readers std::atomic_load it and never take write_mutex. A copy shares
+     * every page and child shard; the edit_* accessors copy the ones a write
+     * changes. `paths` changes whenever a directory is renamed or removed;
+     * full paths cached under one value stay right for every table that has
+     * it (see dir_path).
+     * usage(s) totals what lies below directory s (unused for files) and
+     * root_usage everything; table_put and table_remove keep them current
+     * up the parent chain. They also note the slot in `renamed`, which
+     * publish_table drains into the name index. */
+    struct FileTable {
+        TablePages pages;
+        uint32_t slots = 0;  // one past the highest slot ever edited
+        DirUsage root_usage = {};
+        ChildIndex children;
+        std::vector<uint32_t> renamed;  // empty once published
+        uint64_t version = 0;
+        uint64_t paths = 0;
+
+        // Slots below it that were never used have a null key and file.
+        uint32_t size() const { return slots; }
+        const FileKey& key(uint32_t s) const { return key_at(pages, s); }
+        const std::shared_ptr<const InMemoryFile>& file(uint32_t s) const {
+            return pages[s / TABLE_PAGE_SLOTS]->files[s % TABLE_PAGE_SLOTS];
+        }
+        const DirUsage& usage(uint32_t s) const { return pages[s / TABLE_PAGE_SLOTS]->usage[s % TABLE_PAGE_SLOTS]; }
+        FileKey& edit_key(uint32_t s) { return edit(s).keys[s % TABLE_PAGE_SLOTS]; }
+        std::shared_ptr<const InMemoryFile>& edit_file(uint32_t s) { return edit(s).files[s % TABLE_PAGE_SLOTS]; }
+        DirUsage& edit_usage(uint32_t s) { return edit(s).usage[s % TABLE_PAGE_SLOTS]; }
+    private:
+        // The page holding `s`, added if the table is shorter and copied if
+        // another table shares it.
+        TablePage& edit(uint32_t s) {
+            while (s >= pages.size() * TABLE_PAGE_SLOTS) pages.push_back(std::make_shared<TablePage>());
+            slots = std::max(slots, s + 1);
+            return unshare(pages[s / TABLE_PAGE_SLOTS]);
+        }
+    };
+    std::shared_ptr<const FileTable> table = std::make_shared<FileTable>();
+    NameArena names;                         // guarded by write_mutex
+    /* Trigrams of the published table's names. publish_table updates it and
+     * swaps the table under search_mutex, so a reader that loads the table
+     * while holding it shared sees the two agree. */
+    NameIndex name_index;
+    std::shared_mutex search_mutex;
+    std::vector<std::string> orphan_owners;  // owners with no user slot; filled by fs_init only
+    std::recursive_mutex write_mutex;  // serializes writers (table publish, free_map); held across a batch
+    EpochReclaimer epochs;
+
+    /* File table slots (guarded by write_mutex). Mutations queue the slots
+     * they touched in pending_slots; persist_metadata writes just those. */
+    struct PendingSlot {
+        uint32_t slot;
+        std::shared_ptr<const InMemoryFile> file;  // null: slot freed
+    };
+    std::vector<uint32_t> free_slots;  // unused slots, lowest on top
+    uint32_t next_slot = 0;            // without a file table: ids handed out so far
+    std::vector<PendingSlot> pending_slots;
+    std::vector<uint32_t> damaged_slots;  // failed their checksum at fs_init; neither loaded nor reused
+
+    /* CRC32C per content block, empty without checksums. Set when a block is
+     * written, before any table referencing it is published, and not changed
+     * while one is reachable; readers use it without a lock. */
+    std::vector<uint32_t> block_crc;
+
+    /* Blocks marked FREE_MAP_FRAGMENTS, with one byte per FRAGMENT_SIZE unit
+     * (guarded by write_mutex). Rebuilt from the file slots at startup; a
+     * block returns to the free map when its last tail is freed. */
+    struct FragmentBlock {
+        std::vector<uint8_t> used;
+        uint32_t free_units = 0;
+    };
+    std::map<uint32_t, FragmentBlock> fragment_blocks;
+
+    /* Open batch (fs_batch_begin). Writes from the owning thread modify
+     * `staged` in place; fs_batch_end publishes it and persists once, or
+     * discards it and restores the free map. */
+    struct Batch {
+        std::atomic<std::thread::id> owner{};
+        std::shared_ptr<FileTable> staged;
+        std::vector<uint8_t> free_map;  // copy taken at begin
+        std::vector<uint32_t> free_slots;  // copy taken at begin
+        std::map<uint32_t, FragmentBlock> fragment_blocks;  // copy taken at begin
+        std::vector<uint32_t> retired;  // superseded blocks, retired on commit
+        std::vector<Fragment> retired_fragments;
+        std::vector<std::string_view> retired_names;
+        std::vector<std::string_view> new_names;  // released on abort
+    };
+    Batch batch;
+
+    /* In-flight chunked transfers, keyed by handle. Lock order: transfer_mutex
+     * before write_mutex; a batch inverts it, so paths that can run beside
+     * one (reaping, the scrubber) never wait for write_mutex while holding
+     * transfer_mutex. */
+    struct Upload {
         std::string path;
-        FileEntry entry;
-        std::vector<uint32_t> blocks;
+        std::string owner;
+        std::vector<uint32_t> blocks;  // full blocks written so far
+        std::vector<char> tail;        // trailing partial block, < block_size
+        uint64_t size = 0;
+        uint64_t last_used = 0;
+    };
+    struct Download {
+        std::shared_ptr<const InMemoryFile> file;  // version pinned at open
+        uint64_t epoch = 0;                        // held in epochs.held
+        std::string owner;
+        uint64_t last_used = 0;
+    };
+    std::mutex transfer_mutex;
+    std::unordered_map<uint64_t, Upload> uploads;
+    std::unordered_map<uint64_t, Download> downloads;
+    uint64_t next_transfer_id = 1;
+
+    /* Background scrubber (fs_scrubber_start). */
+    struct Scrubber {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic<bool> stop{false};
+        ScrubReport last{};  // guarded by mutex
+        uint64_t passes = 0;
     };
-    std::vector<InMemoryFile> files;
+    Scrubber scrubber;
 };
 
 #endif
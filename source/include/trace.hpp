@@ -0,0 +1,151 @@
+#ifndef OFS_TRACE_HPP
+#define OFS_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "metrics.hpp"
+
+// Sampled request tracing. Each thread appends span events to its own
+// lock-free ring buffer (single writer, overwritten when full); a dump walks
+// all rings and renders Chrome trace-event JSON (chrome://tracing, Perfetto).
+//
+// Only sampled requests are traced: the server picks one request in
+// `trace_sample_every` and runs it inside a TraceScope. TraceSpan elsewhere
+// (core functions included) records only on a thread that is inside an
+// active scope, so an unsampled request costs one thread-local check per span.
+
+struct TraceEvent {
+    // Relaxed atomics so a concurrent dump reads stale or torn-out slots
+    // (which it discards) rather than racing.
+    std::atomic<uint64_t> ts_ns{0};
+    std::atomic<uint64_t> req{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<char> ph{0};  // 'B'/'E' span on this thread; 'b'/'e'/'n' async, keyed by request
+};
+
+struct TraceRing {
+    static const size_t SIZE = 8192;  // events per thread
+    TraceEvent events[SIZE];
+    std::atomic<uint64_t> head{0};    // events ever written
+    const char* thread_name = "thread";
+    uint32_t tid = 0;
+
+    void push(const char* name, char ph, uint64_t ts, uint64_t req) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        TraceEvent& e = events[h % SIZE];
+        e.ts_ns.store(ts, std::memory_order_relaxed);
+        e.req.store(req, std::memory_order_relaxed);
+        e.name.store(name, std::memory_order_relaxed);
+        e.ph.store(ph, std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+    }
+};
+
+struct TraceRegistry {
+    std::mutex mutex;  // registration and dumps only
+    std::vector<std::unique_ptr<TraceRing>> rings;  // never freed: outlive their threads
+    std::atomic<uint32_t> sample_every{0};  // 0 = tracing off
+    std::atomic<uint64_t> sample_counter{0};
+    std::atomic<uint64_t> next_id{1};
+};
+
+inline TraceRegistry g_trace;
+
+struct TraceThread {
+    TraceRing* ring = nullptr;
+    uint64_t req = 0;  // sampled request being processed, 0 = none
+};
+
+inline thread_local TraceThread t_trace;
+
+inline TraceRing* trace_ring() {
+    if (!t_trace.ring) {
+        std::lock_guard<std::mutex> lg(g_trace.mutex);
+        g_trace.rings.emplace_back(new TraceRing());
+        t_trace.ring = g_trace.rings.back().get();
+        t_trace.ring->tid = (uint32_t)g_trace.rings.size();
+    }
+    return t_trace.ring;
+}
+
+// Labels this thread's track in the dump; `name` must be a string literal.
+inline void trace_thread_name(const char* name) { trace_ring()->thread_name = name; }
+
+inline void trace_set_sample_every(uint32_t n) { g_trace.sample_every.store(n, std::memory_order_relaxed); }
+
+// Decides whether the next request is traced; returns its trace id, or 0.
+inline uint64_t trace_sample() {
+    uint32_t every = g_trace.sample_every.load(std::memory_order_relaxed);
+    if (every == 0) return 0;
+    if (g_trace.sample_counter.fetch_add(1, std::memory_order_relaxed) % every != 0) return 0;
+    return g_trace.next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Records an event for request `req` on this thread's ring. `name` must be a
+// string literal (only the pointer is stored).
+inline void trace_emit(const char* name, char ph, uint64_t ts_ns, uint64_t req) {
+    trace_ring()->push(name, ph, ts_ns, req);
+}
+
+// Marks this thread as working on request `req` (0 = unsampled) until the
+// scope ends.
+struct TraceScope {
+    uint64_t saved;
+    explicit TraceScope(uint64_t req) : saved(t_trace.req) { t_trace.req = req; }
+    ~TraceScope() { t_trace.req = saved; }
+};
+
+// Begin/end events around a block, for the current sampled request only.
+struct TraceSpan {
+    const char* name;
+    explicit TraceSpan(const char* n) : name(t_trace.req ? n : nullptr) {
+        if (name) trace_emit(name, 'B', metrics_now_ns(), t_trace.req);
+    }
+    ~TraceSpan() {
+        if (name) trace_emit(name, 'E', metrics_now_ns(), t_trace.req);
+    }
+};
+
+// Renders every ring as Chrome trace-event JSON. Safe while writers run:
+// slots a writer may have overwritten during the copy are dropped.
+inline void trace_dump_chrome(std::string& out) {
+    std::lock_guard<std::mutex> lg(g_trace.mutex);
+    out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    char buf[256];
+    for (auto& rp : g_trace.rings) {
+        TraceRing& r = *rp;
+        int n = snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                         first ? "" : ",", r.tid, r.thread_name);
+        out.append(buf, (size_t)n);
+        first = false;
+        uint64_t head = r.head.load(std::memory_order_acquire);
+        uint64_t begin = head > TraceRing::SIZE ? head - TraceRing::SIZE : 0;
+        for (uint64_t i = begin; i < head; ++i) {
+            const TraceEvent& e = r.events[i % TraceRing::SIZE];
+            uint64_t ts = e.ts_ns.load(std::memory_order_relaxed);
+            uint64_t req = e.req.load(std::memory_order_relaxed);
+            const char* name = e.name.load(std::memory_order_relaxed);
+            char ph = e.ph.load(std::memory_order_relaxed);
+            // Overwritten while we were reading it?
+            uint64_t now_head = r.head.load(std::memory_order_acquire);
+            if (i + TraceRing::SIZE <= now_head) continue;
+            if (!name) continue;
+            if (ph == 'b' || ph == 'e' || ph == 'n')
+                n = snprintf(buf, sizeof(buf), ",{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"%c\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                             name, ph, (unsigned long long)req, (double)ts / 1000.0, r.tid);
+            else
+                n = snprintf(buf, sizeof(buf), ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"req\":%llu}}",
+                             name, ph, (double)ts / 1000.0, r.tid, (unsigned long long)req);
+            out.append(buf, (size_t)n);
+        }
+    }
+    out.append("]}");
+}
+
+#endif // OFS_TRACE_HPP
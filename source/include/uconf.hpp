@@ -0,0 +1,110 @@
+#ifndef OFS_UCONF_HPP
+#define OFS_UCONF_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+
+// Parser for the .uconf files in compiled/:
+//
+//   [section]
+//   key = value          # comment
+//   name = "quoted # not a comment"
+//
+// Keys are looked up as (section, key). Numbers are decimal; leading zeros
+// do not mean octal ("010" is 10). load() rejects lines it cannot parse and
+// records the line in error(), so a typo fails loudly instead of silently
+// falling back to a default.
+class UConf {
+public:
+    bool load(const char* path) {
+        values_.clear();
+        error_.clear();
+        std::ifstream in(path);
+        if (!in) {
+            error_ = std::string("cannot open ") + path;
+            return false;
+        }
+        std::string line, section;
+        for (int lineno = 1; std::getline(in, line); ++lineno) {
+            std::string text = strip_comment(line);
+            trim(text);
+            if (text.empty()) continue;
+            if (text.front() == '[') {
+                if (text.back() != ']' || text.size() < 3) return fail(path, lineno, "bad section header");
+                section = text.substr(1, text.size() - 2);
+                trim(section);
+                continue;
+            }
+            size_t eq = text.find('=');
+            if (eq == std::string::npos) return fail(path, lineno, "expected key = value");
+            std::string key = text.substr(0, eq), value = text.substr(eq + 1);
+            trim(key);
+            trim(value);
+            if (key.empty()) return fail(path, lineno, "empty key");
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+            values_[section + "." + key] = value;
+        }
+        return true;
+    }
+
+    const std::string& error() const { return error_; }
+
+    bool has(const std::string& section, const std::string& key) const {
+        return values_.count(section + "." + key) != 0;
+    }
+
+    std::string get(const std::string& section, const std::string& key, const std::string& dflt = "") const {
+        auto it = values_.find(section + "." + key);
+        return it == values_.end() ? dflt : it->second;
+    }
+
+    // Missing keys give `dflt`; present but non-numeric ones return false.
+    bool get_u64(const std::string& section, const std::string& key, uint64_t dflt, uint64_t& out) const {
+        auto it = values_.find(section + "." + key);
+        if (it == values_.end()) { out = dflt; return true; }
+        const std::string& v = it->second;
+        if (v.empty() || v.size() > 19) return false;
+        uint64_t n = 0;
+        for (char c : v) {
+            if (c < '0' || c > '9') return false;
+            n = n * 10 + (uint64_t)(c - '0');
+        }
+        out = n;
+        return true;
+    }
+
+    // Convenience for settings that have a sane default either way.
+    int get_int(const std::string& section, const std::string& key, int dflt) const {
+        uint64_t v = 0;
+        if (!get_u64(section, key, (uint64_t)dflt, v) || v > 0x7fffffff) return dflt;
+        return (int)v;
+    }
+
+private:
+    static std::string strip_comment(const std::string& line) {
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '"') quoted = !quoted;
+            else if (line[i] == '#' && !quoted) return line.substr(0, i);
+        }
+        return line;
+    }
+
+    static void trim(std::string& s) {
+        size_t b = s.find_first_not_of(" \t\r");
+        size_t e = s.find_last_not_of(" \t\r");
+        s = b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+    }
+
+    bool fail(const char* path, int lineno, const char* what) {
+        error_ = std::string(path) + ":" + std::to_string(lineno) + ": " + what;
+        return false;
+    }
+
+    std::map<std::string, std::string> values_;
+    std::string error_;
+};
+
+#endif // OFS_UCONF_HPP
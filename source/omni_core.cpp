@@ -1,5 +1,9 @@
 #include "omni_core.hpp"
 #include "odf_types.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "uconf.hpp"
+#include "crc32c.hpp"
 
 #include <fstream>
 #include <iostream>
@@ -9,6 +13,7 @@
 #include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <deque>
 
 using namespace std;
 
@@ -16,9 +21,13 @@ static const uint32_t DEFAULT_MAX_USERS = 50;
 static const uint64_t DEFAULT_TOTAL_SIZE = 104857600ULL; // 100MB
 static const uint64_t DEFAULT_HEADER_SIZE = 512ULL;
 static const uint64_t DEFAULT_BLOCK_SIZE = 4096ULL; // 4KB
+static const uint32_t DEFAULT_MAX_FILES = 4096;
 constexpr size_t PWHASH_STORE = sizeof(((UserInfo*)0)->password_hash);
 
 static bool write_at(const string& path, uint64_t offset, const void* data, size_t len) {
+    TraceSpan span("write_at");
+    ScopedLatency timed(g_core_metrics.io_write);
+    g_core_metrics.bytes_written.fetch_add(len, std::memory_order_relaxed);
     std::fstream fs(path, std::ios::in | std::ios::out | std::ios::binary);
     if (!fs.is_open()) return false;
     fs.seekp(offset);
@@ -28,6 +37,9 @@ static bool write_at(const string& path, uint64_t offset, const void* data, size
 }
 
 static bool read_at(const string& path, uint64_t offset, void* data, size_t len) {
+    TraceSpan span("read_at");
+    ScopedLatency timed(g_core_metrics.io_read);
+    g_core_metrics.bytes_read.fetch_add(len, std::memory_order_relaxed);
     std::ifstream fs(path, std::ios::in | std::ios::binary);
     if (!fs.is_open()) return false;
     fs.seekg(offset);
@@ -35,87 +47,200 @@ static bool read_at(const string& path, uint64_t offset, void* data, size_t len)
     return !fs.fail();
 }
 
-int fs_format(const char* omni_path, const char* /*config_path*/) {
-    if (!omni_path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
-    string path(omni_path);
+// After fs_init, I/O goes through the instance's open BlockIO instead of
+// reopening the container per call.
+static bool write_at(OFSInstance* inst, uint64_t offset, const void* data, size_t len) {
+    TraceSpan span("write_at");
+    ScopedLatency timed(g_core_metrics.io_write);
+    g_core_metrics.bytes_written.fetch_add(len, std::memory_order_relaxed);
+    return inst->io.write(offset, data, len);
+}
+
+static bool read_at(OFSInstance* inst, uint64_t offset, void* data, size_t len) {
+    TraceSpan span("read_at");
+    ScopedLatency timed(g_core_metrics.io_read);
+    g_core_metrics.bytes_read.fetch_add(len, std::memory_order_relaxed);
+    return inst->io.read(offset, data, len);
+}
+
+// Submits a batch of writes at once; one latency sample per batch.
+static bool write_batch(OFSInstance* inst, const std::vector<IoRequest>& reqs) {
+    TraceSpan span("write_batch");
+    ScopedLatency timed(g_core_metrics.io_write);
+    size_t bytes = 0;
+    for (const IoRequest& r : reqs) bytes += r.len;
+    g_core_metrics.bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+    return inst->io.write(reqs.data(), reqs.size());
+}
 
+// Geometry for fs_format: the [filesystem] and [security] sections of the
+// config, or the compiled defaults when config_path is null.
+struct FSGeometry {
     uint64_t total_size = DEFAULT_TOTAL_SIZE;
     uint64_t header_size = DEFAULT_HEADER_SIZE;
     uint64_t block_size = DEFAULT_BLOCK_SIZE;
-    uint32_t max_users = DEFAULT_MAX_USERS;
+    uint64_t max_users = DEFAULT_MAX_USERS;
+    uint64_t max_files = DEFAULT_MAX_FILES;
+};
 
-    {
-        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
-        if (!ofs.is_open()) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-        if (total_size == 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
-        ofs.seekp((std::streamoff)total_size - 1);
-        char zero = 0;
-        ofs.write(&zero, 1);
-        ofs.close();
+static bool load_geometry(const char* config_path, FSGeometry& g) {
+    if (!config_path) return true;
+    UConf conf;
+    if (!conf.load(config_path)) {
+        std::cerr << "config: " << conf.error() << std::endl;
+        return false;
+    }
+    if (!conf.get_u64("filesystem", "total_size", g.total_size, g.total_size) ||
+        !conf.get_u64("filesystem", "header_size", g.header_size, g.header_size) ||
+        !conf.get_u64("filesystem", "block_size", g.block_size, g.block_size) ||
+        !conf.get_u64("filesystem", "max_files", g.max_files, g.max_files) ||
+        !conf.get_u64("security", "max_users", g.max_users, g.max_users)) {
+        std::cerr << "config: non-numeric size in " << config_path << std::endl;
+        return false;
     }
+    return true;
+}
+
+// Lays out the container behind the header:
+//
+//   header | user table | free map | file slots | block chain |
+//   block checksums | slot checksums | content
+//
+// The free map, chain and block checksums cost 9 bytes per content block, so
+// the block count is solved for, then the content area is aligned to
+// block_size. Fills the layout fields of `h`; false if the geometry leaves no
+// room for content.
+static bool compute_layout(OMNIHeader& h) {
+    uint64_t fixed = h.header_size + (uint64_t)h.max_users * sizeof(UserInfo) +
+                     (uint64_t)h.max_files * (sizeof(FileSlot) + sizeof(SlotChecksum));
+    if (h.total_size <= fixed + h.block_size) return false;
+    const uint64_t meta_per_block = 1 + 2 * sizeof(uint32_t);
+    uint64_t n = (h.total_size - fixed) / (h.block_size + meta_per_block);
+    if (n > FILE_CHAIN_END) n = FILE_CHAIN_END;
+    auto content_at = [&](uint64_t blocks) {
+        uint64_t meta_end = fixed + blocks * meta_per_block;
+        return (meta_end + h.block_size - 1) / h.block_size * h.block_size;
+    };
+    while (n > 0 && content_at(n) + n * h.block_size > h.total_size) --n;
+    if (n == 0) return false;
+    h.user_table_offset = static_cast<uint32_t>(h.header_size);
+    h.free_map_offset = h.header_size + (uint64_t)h.max_users * sizeof(UserInfo);
+    h.file_table_offset = h.free_map_offset + n;
+    h.chain_offset = h.file_table_offset + (uint64_t)h.max_files * sizeof(FileSlot);
+    h.block_checksum_offset = h.chain_offset + n * sizeof(uint32_t);
+    h.slot_checksum_offset = h.block_checksum_offset + n * sizeof(uint32_t);
+    h.content_offset = content_at(n);
+    h.num_blocks = n;
+    return true;
+}
+
+int fs_format(const char* omni_path, const char* config_path) {
+    if (!omni_path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    string path(omni_path);
 
+    FSGeometry g;
+    if (!load_geometry(config_path, g)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    // The header region is fixed by OMNIHeader; block sizes must be a power of two.
+    if (g.total_size == 0 || g.header_size != DEFAULT_HEADER_SIZE || g.block_size < 512 ||
+        g.block_size > (64u << 20) || (g.block_size & (g.block_size - 1)) != 0 ||
+        g.max_users == 0 || g.max_users > 65535 || g.max_files == 0 || g.max_files > 0x7fffffff)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
 
     OMNIHeader header;
     std::memset(&header, 0, sizeof(header));
     std::strncpy(header.magic, "OMNIFS01", sizeof(header.magic));
     header.format_version = 0x00010000;
-    header.total_size = total_size;
-    header.header_size = header_size;
-    header.block_size = block_size;
-    std::strncpy(header.student_id, "", sizeof(header.student_id));
-    std::strncpy(header.submission_date, "", sizeof(header.submission_date));
-
-    uint32_t user_table_offset = static_cast<uint32_t>(header_size);
-    header.user_table_offset = user_table_offset;
-    header.max_users = max_users;
+    header.total_size = g.total_size;
+    header.header_size = g.header_size;
+    header.block_size = g.block_size;
+    header.max_users = static_cast<uint32_t>(g.max_users);
+    header.max_files = static_cast<uint32_t>(g.max_files);
+    header.file_slot_size = sizeof(FileSlot);
+    header.fragment_size = FRAGMENT_SIZE;
+    if (!compute_layout(header)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
 
-
-    uint64_t user_table_size = (uint64_t)max_users * sizeof(UserInfo);
-    uint64_t free_map_offset = user_table_offset + user_table_size;
-    uint64_t remaining_for_blocks = 0;
-    if (total_size > free_map_offset) remaining_for_blocks = total_size - free_map_offset;
-    uint64_t num_blocks = remaining_for_blocks / block_size;
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        ofs.seekp((std::streamoff)header.total_size - 1);
+        char zero = 0;
+        ofs.write(&zero, 1);
+        ofs.close();
+    }
 
     if (!write_at(path, 0, &header, sizeof(header))) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-
-
-    vector<char> zeros_u(user_table_size, 0);
-    if (!write_at(path, user_table_offset, zeros_u.data(), zeros_u.size())) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-
-    vector<uint8_t> free_map((size_t)num_blocks, 0);
-    if (!write_at(path, free_map_offset, free_map.data(), free_map.size())) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-
-
-    uint64_t file_table_offset = free_map_offset + num_blocks;
-    uint32_t zero = 0;
-    if (!write_at(path, file_table_offset, &zero, sizeof(zero))) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    // The file is freshly truncated, so the user table, free map, file slots
+    // and checksums already read as zero (empty). Only the chain needs "no next".
+    vector<uint32_t> chain((size_t)header.num_blocks, FILE_CHAIN_END);
+    if (!write_at(path, header.chain_offset, chain.data(), chain.size() * sizeof(uint32_t)))
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
 
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int fs_init(void** instance, const char* omni_path, const char* /*config_path*/) {
+static bool read_file_table(OFSInstance* inst);
+
+// Geometry always comes from the header fs_format wrote. A config passed here
+// must still parse, so a broken file is caught at startup.
+int fs_init(void** instance, const char* omni_path, const char* config_path) {
     if (!instance || !omni_path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
     string path(omni_path);
+    if (config_path) {
+        UConf conf;
+        if (!conf.load(config_path)) {
+            std::cerr << "config: " << conf.error() << std::endl;
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+        }
+    }
     
     OMNIHeader header;
     if (!read_at(path, 0, &header, sizeof(header))) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
 
-    if (std::string(header.magic) != "OMNIFS01") return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    if (std::string(header.magic, strnlen(header.magic, sizeof(header.magic))) != "OMNIFS01")
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    if (header.block_size == 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+
+    uint64_t user_table_offset = header.user_table_offset;
+    uint64_t user_table_size = (uint64_t)header.max_users * sizeof(UserInfo);
+    if (header.content_offset == 0) {
+        // Formatted before the layout was recorded: free map right after the
+        // user table, content right after the free map, no file table.
+        header.free_map_offset = user_table_offset + user_table_size;
+        uint64_t remaining_for_blocks = 0;
+        if (header.total_size > header.free_map_offset) remaining_for_blocks = header.total_size - header.free_map_offset;
+        header.num_blocks = remaining_for_blocks / header.block_size;
+        header.content_offset = header.free_map_offset + header.num_blocks;
+        header.file_table_offset = 0;
+        header.max_files = 0;
+        header.file_slot_size = sizeof(FileSlot);
+        header.fragment_size = FRAGMENT_SIZE;
+        header.block_checksum_offset = 0;
+        header.slot_checksum_offset = 0;
+    } else if (header.free_map_offset < user_table_offset + user_table_size ||
+               header.content_offset + header.num_blocks * header.block_size > header.total_size ||
+               header.file_slot_size != sizeof(FileSlot) || header.fragment_size != FRAGMENT_SIZE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    } else if (header.slot_checksum_offset != 0 &&
+               (header.block_checksum_offset < header.chain_offset + header.num_blocks * sizeof(uint32_t) ||
+                header.slot_checksum_offset < header.block_checksum_offset + header.num_blocks * sizeof(uint32_t) ||
+                header.slot_checksum_offset + (uint64_t)header.max_files * sizeof(SlotChecksum) > header.content_offset)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    }
 
     OFSInstance* inst = new OFSInstance();
     inst->header = header;
     inst->omni_path = path;
     inst->max_users = header.max_users;
     inst->block_size = header.block_size;
+    if (!inst->io.open(path)) {
+        delete inst;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
 
-    uint64_t user_table_offset = header.user_table_offset;
-    uint64_t user_table_size = (uint64_t)inst->max_users * sizeof(UserInfo);
     inst->users.resize(inst->max_users);
-    {
-        std::ifstream fs(path, std::ios::in | std::ios::binary);
-        if (!fs.is_open()) { delete inst; return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR); }
-        fs.seekg(user_table_offset);
-        fs.read(reinterpret_cast<char*>(inst->users.data()), user_table_size);
+    if (!read_at(inst, user_table_offset, inst->users.data(), user_table_size)) {
+        delete inst;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
 
     size_t cap = 1;
@@ -129,55 +254,55 @@ int fs_init(void** instance, const char* omni_path, const char* /*config_path*/)
         }
     }
 
-    uint64_t free_map_offset = user_table_offset + user_table_size;
-    uint64_t remaining_for_blocks = 0;
-    if (header.total_size > free_map_offset) remaining_for_blocks = header.total_size - free_map_offset;
-    uint64_t num_blocks = remaining_for_blocks / header.block_size;
-    inst->num_blocks = num_blocks;
-    inst->free_map.resize((size_t)num_blocks);
-    if (num_blocks > 0) {
-        std::ifstream fs(path, std::ios::in | std::ios::binary);
-        if (!fs.is_open()) { delete inst; return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR); }
-        fs.seekg(free_map_offset);
-        fs.read(reinterpret_cast<char*>(inst->free_map.data()), (std::streamsize)num_blocks);
+    inst->num_blocks = header.num_blocks;
+    inst->free_map.resize((size_t)header.num_blocks);
+    if (header.num_blocks > 0 && !read_at(inst, header.free_map_offset, inst->free_map.data(), inst->free_map.size())) {
+        delete inst;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    inst->content_offset = header.content_offset;
+    if (header.slot_checksum_offset != 0) {
+        inst->block_crc.resize((size_t)header.num_blocks);
+        if (header.num_blocks > 0 &&
+            !read_at(inst, header.block_checksum_offset, inst->block_crc.data(), inst->block_crc.size() * sizeof(uint32_t))) {
+            delete inst;
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
     }
 
-    inst->content_offset = free_map_offset + inst->num_blocks;
+    if (!read_file_table(inst)) {
+        delete inst;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
 
     *instance = inst;
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+static void persist_metadata(OFSInstance* inst);
+static void free_blocks(OFSInstance* inst, const std::vector<uint32_t>& blocks);
+static void free_fragment(OFSInstance* inst, const Fragment& f);
+
 void fs_shutdown(void* instance) {
     if (!instance) return;
     OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    fs_scrubber_stop(instance);
+    // Uncommitted uploads are abandoned; their blocks go back to the free map.
+    for (auto& kv : inst->uploads) free_blocks(inst, kv.second.blocks);
+    inst->uploads.clear();
+    inst->downloads.clear();
+    // No readers can be pinned once we are shutting down; release everything retired.
+    for (auto& r : inst->epochs.retired) {
+        free_blocks(inst, r.blocks);
+        for (const Fragment& f : r.fragments) free_fragment(inst, f);
+    }
+    inst->epochs.retired.clear();
     
     if (inst->dirty) {
-        uint64_t user_table_offset = inst->header.user_table_offset;
-        uint64_t user_table_size = (uint64_t)inst->max_users * sizeof(UserInfo);
-        write_at(inst->omni_path, user_table_offset, inst->users.data(), user_table_size);
-
-        uint64_t free_map_offset = user_table_offset + user_table_size;
-        if (!inst->free_map.empty())
-            write_at(inst->omni_path, free_map_offset, inst->free_map.data(), inst->free_map.size());
-        
-        uint64_t file_table_offset = free_map_offset + inst->num_blocks;
-        uint32_t count = (uint32_t)inst->files.size();
-        write_at(inst->omni_path, file_table_offset, &count, sizeof(count));
-        uint64_t cursor = file_table_offset + sizeof(count);
-        for (const auto &f : inst->files) {
-            write_at(inst->omni_path, cursor, &f.entry, sizeof(FileEntry));
-            cursor += sizeof(FileEntry);
-            
-            uint32_t bc = (uint32_t)f.blocks.size();
-            write_at(inst->omni_path, cursor, &bc, sizeof(bc));
-            cursor += sizeof(bc);
-            
-            if (bc > 0) {
-                write_at(inst->omni_path, cursor, f.blocks.data(), sizeof(uint32_t) * bc);
-                cursor += sizeof(uint32_t) * bc;
-            }
-        }
+        // File slots are written as they change; the user table and free map
+        // pick up what is left.
+        write_at(inst, inst->header.user_table_offset, inst->users.data(), (size_t)inst->max_users * sizeof(UserInfo));
+        persist_metadata(inst);
     }
     delete inst;
 }
@@ -230,16 +355,21 @@ int user_create(void* instance_ptr, void* admin_session, const char* username, c
     nu.is_active = 1;
 
 
-    inst->users[slot] = nu;
-    inst->user_index.insert(std::string(nu.username), slot);
+    {
+        // Readers resolve owners through the index (owner_id) without write_mutex.
+        std::lock_guard<std::mutex> lg(inst->mutex);
+        inst->users[slot] = nu;
+        inst->user_index.insert(std::string(nu.username), slot);
+    }
     inst->dirty = true;
 
-    write_at(inst->omni_path, inst->header.user_table_offset, inst->users.data(), (size_t)inst->max_users * sizeof(UserInfo));
+    write_at(inst, inst->header.user_table_offset, inst->users.data(), (size_t)inst->max_users * sizeof(UserInfo));
 
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
 int user_login(void* instance_ptr, void** session, const char* username, const char* password) {
+    TraceSpan span("user_login");
     if (!instance_ptr || !session || !username || !password) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance_ptr);
 
@@ -281,24 +411,43 @@ int user_login(void* instance_ptr, void** session, const char* username, const c
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int get_session_by_token(void* instance_ptr, const char* token, void** session_out) {
-    if (!instance_ptr || !token || !session_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance_ptr);
+// Copies the session for `token` into *out and touches its last_activity.
+static bool find_session(OFSInstance* inst, const char* token, SessionInfo* out) {
     std::lock_guard<std::mutex> lg(inst->mutex);
     for (auto &s : inst->sessions) {
-        if (std::string(s.session_id) == std::string(token)) {
-            // update last_activity
+        if (std::strcmp(s.session_id, token) == 0) {
             s.last_activity = static_cast<uint64_t>(std::time(nullptr));
-            // return a copy allocated on heap (caller should not delete internal storage)
-            SessionInfo* out = new SessionInfo(std::string(s.session_id), s.user, s.login_time);
-            *session_out = out;
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
+            *out = s;
+            out->last_activity = out->login_time;
+            out->operations_count = 0;
+            return true;
         }
     }
-    return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    return false;
 }
 
-int user_list(void* instance_ptr, void* admin_session, UserInfo** users_out, int* count) {
+int get_session_by_token(void* instance_ptr, const char* token, void** session_out) {
+    TraceSpan span("get_session_by_token");
+    if (!instance_ptr || !token || !session_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance_ptr);
+    SessionInfo s;
+    if (!find_session(inst, token, &s)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    // return a copy allocated on heap (caller should not delete internal storage)
+    *session_out = new SessionInfo(s);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int get_session_into(void* instance_ptr, const char* token, SessionInfo* session_out) {
+    TraceSpan span("get_session_by_token");
+    if (!instance_ptr || !token || !session_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance_ptr);
+    if (!find_session(inst, token, session_out)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Shared by user_list and user_list_arena; `alloc(n)` provides the result array.
+template <typename Alloc>
+static int list_users(void* instance_ptr, void* admin_session, UserInfo** users_out, int* count, Alloc alloc) {
     if (!instance_ptr || !admin_session || !users_out || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance_ptr);
     SessionInfo* sess = reinterpret_cast<SessionInfo*>(admin_session);
@@ -309,7 +458,7 @@ int user_list(void* instance_ptr, void* admin_session, UserInfo** users_out, int
     *count = c;
     if (c == 0) { *users_out = nullptr; return static_cast<int>(OFSErrorCodes::SUCCESS); }
 
-    UserInfo* result = new UserInfo[c];
+    UserInfo* result = alloc((size_t)c);
     int idx = 0;
     for (const auto& u : inst->users) {
         if (!u.is_active) continue;
@@ -319,19 +468,36 @@ int user_list(void* instance_ptr, void* admin_session, UserInfo** users_out, int
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int user_list(void* instance_ptr, void* admin_session, UserInfo** users_out, int* count) {
+    return list_users(instance_ptr, admin_session, users_out, count, [](size_t n) { return new UserInfo[n]; });
+}
+
+int user_list_arena(void* instance_ptr, void* admin_session, BumpArena* arena, UserInfo** users_out, int* count) {
+    if (!arena) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    return list_users(instance_ptr, admin_session, users_out, count,
+                      [arena](size_t n) { return arena->alloc_array<UserInfo>(n); });
+}
+
+// Sets one free map entry and queues it for persist_metadata.
+static void set_free_map(OFSInstance* inst, uint32_t b, uint8_t v) {
+    inst->free_map[b] = v;
+    inst->free_map_dirty.push_back(b);
+}
+
 // Helper: allocate N free blocks (non-contiguous) and return indices in out vector
 static bool allocate_blocks(OFSInstance* inst, size_t n, std::vector<uint32_t>& out) {
+    TraceSpan span("allocate_blocks");
     out.clear();
     if (n == 0) return true;
     for (uint32_t i = 0; i < inst->free_map.size() && out.size() < n; ++i) {
         if (inst->free_map[i] == 0) {
-            inst->free_map[i] = 1;
+            set_free_map(inst, i, 1);
             out.push_back(i);
         }
     }
     if (out.size() < n) {
         // rollback
-        for (uint32_t idx : out) inst->free_map[idx] = 0;
+        for (uint32_t idx : out) set_free_map(inst, idx, 0);
         out.clear();
         return false;
     }
@@ -341,237 +507,2221 @@ static bool allocate_blocks(OFSInstance* inst, size_t n, std::vector<uint32_t>&
 
 static void free_blocks(OFSInstance* inst, const std::vector<uint32_t>& blocks) {
     for (uint32_t b : blocks) {
-        if (b < inst->free_map.size()) inst->free_map[b] = 0;
+        if (b < inst->free_map.size()) set_free_map(inst, b, 0);
     }
     inst->dirty = true;
 }
 
-// Persist the in-memory file table to disk (writes count, entries and block lists)
-static bool write_file_table(OFSInstance* inst) {
-    if (!inst) return false;
-    uint64_t file_table_offset = inst->header.file_state_storage_offset;
-    uint64_t meta_end = inst->header.change_log_offset;
-    if (meta_end <= file_table_offset) return false;
-    uint64_t meta_size = meta_end - file_table_offset;
-    // write count then iterate
-    uint32_t count = (uint32_t)inst->files.size();
-    if (!write_at(inst->omni_path, file_table_offset, &count, sizeof(count))) return false;
-    uint64_t cursor = file_table_offset + sizeof(count);
-    for (const auto &f : inst->files) {
-        if (cursor + sizeof(FileEntry) > meta_end) return false;
-        if (!write_at(inst->omni_path, cursor, &f.entry, sizeof(FileEntry))) return false;
-        cursor += sizeof(FileEntry);
-        uint32_t bc = (uint32_t)f.blocks.size();
-        if (cursor + sizeof(bc) > meta_end) return false;
-        if (!write_at(inst->omni_path, cursor, &bc, sizeof(bc))) return false;
-        cursor += sizeof(bc);
-        if (bc > 0) {
-            if (cursor + sizeof(uint32_t) * bc > meta_end) return false;
-            if (!write_at(inst->omni_path, cursor, f.blocks.data(), sizeof(uint32_t) * bc)) return false;
-            cursor += sizeof(uint32_t) * bc;
+static uint32_t units_per_block(const OFSInstance* inst) {
+    return (uint32_t)(inst->block_size / FRAGMENT_SIZE);
+}
+
+static void mark_fragment(OFSInstance::FragmentBlock& fb, const Fragment& f, uint8_t used) {
+    for (uint32_t u = f.unit; u < f.unit + f.units; ++u) fb.used[u] = used;
+    if (used) fb.free_units -= f.units;
+    else fb.free_units += f.units;
+}
+
+// Finds room for a `len`-byte tail: first fit among the fragment blocks with
+// enough free units, else a fresh block from the free map.
+static bool allocate_fragment(OFSInstance* inst, size_t len, Fragment& out) {
+    TraceSpan span("allocate_fragment");
+    uint32_t need = (uint32_t)((len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE);
+    for (auto& kv : inst->fragment_blocks) {
+        OFSInstance::FragmentBlock& fb = kv.second;
+        if (fb.free_units < need) continue;
+        uint32_t run = 0;
+        for (uint32_t u = 0; u < fb.used.size(); ++u) {
+            run = fb.used[u] ? 0 : run + 1;
+            if (run == need) {
+                out.block = kv.first;
+                out.unit = u + 1 - need;
+                out.units = need;
+                mark_fragment(fb, out, 1);
+                inst->dirty = true;
+                return true;
+            }
         }
     }
+    std::vector<uint32_t> nb;
+    if (!allocate_blocks(inst, 1, nb)) return false;
+    set_free_map(inst, nb[0], FREE_MAP_FRAGMENTS);
+    OFSInstance::FragmentBlock& fb = inst->fragment_blocks[nb[0]];
+    fb.used.assign(units_per_block(inst), 0);
+    fb.free_units = units_per_block(inst);
+    out.block = nb[0];
+    out.unit = 0;
+    out.units = need;
+    mark_fragment(fb, out, 1);
     return true;
 }
 
-// Load file table from disk into inst->files
-static bool read_file_table(OFSInstance* inst) {
-    if (!inst) return false;
-    uint64_t file_table_offset = inst->header.file_state_storage_offset;
-    uint64_t meta_end = inst->header.change_log_offset;
-    if (meta_end <= file_table_offset) return true; // nothing reserved
-    uint64_t meta_size = meta_end - file_table_offset;
-    uint32_t count = 0;
-    if (!read_at(inst->omni_path, file_table_offset, &count, sizeof(count))) return false;
-    uint64_t cursor = file_table_offset + sizeof(count);
-    inst->files.clear();
-    for (uint32_t i = 0; i < count; ++i) {
-        if (cursor + sizeof(FileEntry) > meta_end) return false;
-        FileEntry fe;
-        if (!read_at(inst->omni_path, cursor, &fe, sizeof(FileEntry))) return false;
-        cursor += sizeof(FileEntry);
-        uint32_t bc = 0;
-        if (!read_at(inst->omni_path, cursor, &bc, sizeof(bc))) return false;
-        cursor += sizeof(bc);
-        std::vector<uint32_t> blocks(bc);
-        if (bc > 0) {
-            if (!read_at(inst->omni_path, cursor, blocks.data(), sizeof(uint32_t) * bc)) return false;
-            cursor += sizeof(uint32_t) * bc;
-        }
-        OFSInstance::InMemoryFile imf;
-        imf.path = std::string(fe.name);
-        imf.entry = fe;
-        imf.blocks = std::move(blocks);
-        inst->files.push_back(std::move(imf));
+static void free_fragment(OFSInstance* inst, const Fragment& f) {
+    if (f.units == 0) return;
+    auto it = inst->fragment_blocks.find(f.block);
+    if (it == inst->fragment_blocks.end()) return;
+    mark_fragment(it->second, f, 0);
+    if (it->second.free_units == it->second.used.size()) {
+        inst->fragment_blocks.erase(it);
+        if (f.block < inst->free_map.size()) set_free_map(inst, f.block, 0);
     }
-    return true;
+    inst->dirty = true;
 }
 
-int file_create(void* instance, void* session, const char* path, const char* data, size_t size) {
-    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    // allocate blocks
-    size_t blocks_needed = (size + inst->block_size - 1) / inst->block_size;
-    std::vector<uint32_t> blocks;
-    if (!allocate_blocks(inst, blocks_needed, blocks)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+// True on the thread that has a batch open (fs_batch_begin).
+static bool in_batch(OFSInstance* inst) {
+    return inst->batch.owner.load() == std::this_thread::get_id();
+}
 
-    // write data to blocks
-    size_t remaining = size;
-    const char* ptr = data;
-    for (size_t i = 0; i < blocks.size(); ++i) {
-        uint32_t bidx = blocks[i];
-        uint64_t off = inst->content_offset + (uint64_t)bidx * inst->block_size;
-        size_t chunk = remaining > inst->block_size ? inst->block_size : remaining;
-        if (!write_at(inst->omni_path, off, ptr, chunk)) {
-            // rollback
-            free_blocks(inst, blocks);
-            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+// The table this thread should read: the published one, or inside a batch
+// the staged one, so a batch sees its own writes.
+static std::shared_ptr<const OFSInstance::FileTable> visible_table(OFSInstance* inst) {
+    if (in_batch(inst)) return inst->batch.staged;
+    return std::atomic_load(&inst->table);
+}
+
+// Pins the current epoch and loads the published file table. Everything
+// reachable from `table`, including its content blocks, stays valid until
+// the guard is destroyed; no lock is taken.
+struct SnapshotGuard {
+    OFSInstance* inst;
+    size_t slot;
+    std::shared_ptr<const OFSInstance::FileTable> table;
+    explicit SnapshotGuard(OFSInstance* i)
+        : inst(i), slot(i->epochs.pin()), table(visible_table(i)) {}
+    ~SnapshotGuard() { inst->epochs.unpin(slot); }
+    SnapshotGuard(const SnapshotGuard&) = delete;
+    SnapshotGuard& operator=(const SnapshotGuard&) = delete;
+};
+
+// Writer side (caller holds write_mutex): copy the current table so it can be
+// modified and published without disturbing readers of the old one.
+// Inside a batch the staged table is modified in place instead.
+static std::shared_ptr<OFSInstance::FileTable> clone_table(OFSInstance* inst) {
+    if (in_batch(inst)) return inst->batch.staged;
+    auto cur = std::atomic_load(&inst->table);
+    auto next = std::make_shared<OFSInstance::FileTable>(*cur);
+    next->version = cur->version + 1;
+    return next;
+}
+
+// Entries added, removed or renamed in `next` change the name index in the
+// same step as the table, under search_mutex (see file_search).
+static void publish_table(OFSInstance* inst, std::shared_ptr<OFSInstance::FileTable> next) {
+    if (in_batch(inst)) return;  // published by fs_batch_end
+    std::vector<uint32_t> renamed;
+    renamed.swap(next->renamed);
+    std::shared_ptr<const OFSInstance::FileTable> pub(std::move(next));
+    if (renamed.empty()) {
+        std::atomic_store(&inst->table, pub);
+        return;
+    }
+    std::sort(renamed.begin(), renamed.end());
+    renamed.erase(std::unique(renamed.begin(), renamed.end()), renamed.end());
+    auto prev = std::atomic_load(&inst->table);
+    std::unique_lock<std::shared_mutex> lk(inst->search_mutex);
+    for (uint32_t s : renamed) {
+        std::string_view was, now;
+        if (s < prev->size() && prev->key(s).name) was = std::string_view(prev->key(s).name, prev->key(s).name_len);
+        if (s < pub->size() && pub->key(s).name) now = std::string_view(pub->key(s).name, pub->key(s).name_len);
+        if (was == now) continue;  // moved, not renamed
+        if (!was.empty()) inst->name_index.remove(s, was);
+        if (!now.empty()) inst->name_index.add(s, now);
+    }
+    std::atomic_store(&inst->table, pub);
+}
+
+// Free retired blocks that no pinned reader can still reach.
+static void reclaim_blocks(OFSInstance* inst) {
+    auto& retired = inst->epochs.retired;
+    if (retired.empty()) return;
+    uint64_t min_pinned = inst->epochs.min_pinned();
+    size_t keep = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i].epoch < min_pinned) {
+            free_blocks(inst, retired[i].blocks);
+            for (const Fragment& f : retired[i].fragments) free_fragment(inst, f);
+            for (std::string_view n : retired[i].names) inst->names.release(n);
+        } else {
+            retired[keep++] = std::move(retired[i]);
         }
-        ptr += chunk; remaining -= chunk;
     }
+    retired.resize(keep);
+}
+
+// Must be called after the table that no longer references `blocks` and
+// `fragments` has been published: readers that pinned an epoch up to the one
+// stamped here may still be reading them.
+static void retire_blocks(OFSInstance* inst, std::vector<uint32_t> blocks, std::vector<Fragment> fragments = {},
+                          std::vector<std::string_view> names = {}) {
+    if (in_batch(inst)) {
+        // The published table still references them until the batch commits.
+        inst->batch.retired.insert(inst->batch.retired.end(), blocks.begin(), blocks.end());
+        inst->batch.retired_fragments.insert(inst->batch.retired_fragments.end(), fragments.begin(), fragments.end());
+        inst->batch.retired_names.insert(inst->batch.retired_names.end(), names.begin(), names.end());
+        return;
+    }
+    if (!blocks.empty() || !fragments.empty() || !names.empty()) {
+        uint64_t epoch = inst->epochs.global_epoch.fetch_add(1);
+        inst->epochs.retired.push_back({epoch, std::move(blocks), std::move(fragments), std::move(names)});
+    }
+    reclaim_blocks(inst);
+}
+
+// A file version's tail fragment, if it has one, for retire_blocks.
+static std::vector<Fragment> fragments_of(const OFSInstance::InMemoryFile& f) {
+    if (f.fragment.units == 0) return {};
+    return {f.fragment};
+}
+
+static OFSInstance::FileKey key_of(const OFSInstance::InMemoryFile& f) {
+    return {f.name.data(), (uint32_t)f.name.size(), f.parent, f.owner};
+}
+
+// What `f` adds to the usage of each directory above it.
+static DirUsage usage_of(const OFSInstance::FileTable& table, const OFSInstance::InMemoryFile& f) {
+    if (f.getType() == EntryType::DIRECTORY) {
+        DirUsage u = table.usage(f.slot);
+        ++u.dirs;
+        return u;
+    }
+    return {f.size, f.blocks.size(), 1, 0};
+}
+
+// Adds `u` to (or with add false takes it from) `dir` and every directory
+// above it: one step per level, whatever the directories hold.
+static void charge(OFSInstance::FileTable& table, uint32_t dir, const DirUsage& u, bool add) {
+    for (;;) {
+        DirUsage& d = dir == ROOT_DIR ? table.root_usage : table.edit_usage(dir);
+        if (add) {
+            d.bytes += u.bytes;
+            d.blocks += u.blocks;
+            d.files += u.files;
+            d.dirs += u.dirs;
+        } else {
+            d.bytes -= u.bytes;
+            d.blocks -= u.blocks;
+            d.files -= u.files;
+            d.dirs -= u.dirs;
+        }
+        if (dir == ROOT_DIR) return;
+        dir = table.file(dir)->parent;
+    }
+}
+
+// Adds `f` to `table` at its slot. Its (parent, name) must be free. A
+// directory brings along the usage its slot already holds (none when new,
+// everything below it when moved).
+static void table_put(OFSInstance::FileTable& table, std::shared_ptr<const OFSInstance::InMemoryFile> f) {
+    uint32_t slot = f->slot;
+    table.edit_key(slot) = key_of(*f);  // adds the slot's page if the table is shorter
+    charge(table, f->parent, usage_of(table, *f), true);
+    table.edit_file(slot) = std::move(f);
+    table.children.insert(table.pages, slot);
+    table.renamed.push_back(slot);
+}
+
+// Swaps in a new version of the file at `f`'s slot, same parent and name.
+static void table_replace(OFSInstance::FileTable& table, std::shared_ptr<const OFSInstance::InMemoryFile> f) {
+    uint32_t slot = f->slot;
+    charge(table, f->parent, usage_of(table, *table.file(slot)), false);
+    charge(table, f->parent, usage_of(table, *f), true);
+    table.edit_key(slot) = key_of(*f);
+    table.edit_file(slot) = std::move(f);
+}
+
+// Takes the entry at `slot` out of `table`. A directory keeps its usage, for
+// table_put when it is being moved; removed for good it must be empty.
+static void table_remove(OFSInstance::FileTable& table, uint32_t slot) {
+    charge(table, table.file(slot)->parent, usage_of(table, *table.file(slot)), false);
+    table.children.erase(table.pages, slot);
+    table.edit_key(slot) = {};
+    table.edit_file(slot).reset();
+    table.renamed.push_back(slot);
+}
+
+// A value for FileTable::paths that no table has had.
+static uint64_t new_path_generation() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1);
+}
+
+static bool is_dir(const OFSInstance::FileTable& table, uint32_t slot) {
+    return slot == ROOT_DIR ||
+           (slot < table.size() && table.file(slot) && table.file(slot)->getType() == EntryType::DIRECTORY);
+}
+
+// Walks `path` from the root one component at a time through the child
+// index: ROOT_DIR for "/", NO_ENTRY when a component is missing. Repeated and
+// trailing slashes are ignored.
+static uint32_t resolve(const OFSInstance::FileTable& table, std::string_view path) {
+    if (path.empty() || path[0] != '/') return NO_ENTRY;
+    uint32_t at = ROOT_DIR;
+    for (size_t i = 0; i < path.size();) {
+        if (path[i] == '/') { ++i; continue; }
+        size_t end = path.find('/', i);
+        if (end == std::string_view::npos) end = path.size();
+        if (!is_dir(table, at)) return NO_ENTRY;
+        at = table.children.find(table.pages, at, path.data() + i, end - i);
+        if (at == NO_ENTRY) return NO_ENTRY;
+        i = end;
+    }
+    return at;
+}
+
+static const OFSInstance::InMemoryFile* find_file(const OFSInstance::FileTable& table, const char* path, uint32_t* slot = nullptr) {
+    uint32_t s = resolve(table, path);
+    if (s >= table.size()) return nullptr;  // NO_ENTRY, or "/" which has no entry
+    if (slot) *slot = s;
+    return table.file(s).get();
+}
+
+// Where an entry at `path` would go: its directory's slot (ROOT_DIR for the
+// root) and its own name. The directory must exist.
+static int resolve_parent(const OFSInstance::FileTable& table, const char* path, uint32_t& parent, std::string_view& name) {
+    std::string_view p(path);
+    while (p.size() > 1 && p.back() == '/') p.remove_suffix(1);
+    size_t slash = p.rfind('/');
+    if (p.empty() || p[0] != '/' || p.size() == 1) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+    name = p.substr(slash + 1);
+    if (name == "." || name == ".." || name.size() >= sizeof(FileEntry::name))
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+    parent = resolve(table, p.substr(0, slash + 1));
+    if (!is_dir(table, parent)) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Full path of directory `slot` ("" for the root, so an entry's path is
+// dir_path + "/" + name). Kept per thread while the table's `paths`
+// generation stays the same: until a directory is renamed or removed, a
+// directory slot has one path in every table that has it.
+static const std::string& dir_path(const OFSInstance::FileTable& table, uint32_t slot) {
+    struct Cache {
+        uint64_t generation = 0;
+        std::unordered_map<uint32_t, std::string> paths;
+    };
+    static const std::string root;
+    thread_local Cache cache;
+    if (slot == ROOT_DIR) return root;
+    if (cache.generation != table.paths || cache.paths.size() > 4096) {
+        cache.paths.clear();
+        cache.generation = table.paths;
+    }
+    auto it = cache.paths.find(slot);
+    if (it != cache.paths.end()) return it->second;
+    const OFSInstance::InMemoryFile& d = *table.file(slot);
+    std::string path = dir_path(table, d.parent);
+    path += '/';
+    path.append(d.name.data(), d.name.size());
+    return cache.paths.emplace(slot, std::move(path)).first->second;
+}
+
+static std::string path_of(const OFSInstance::FileTable& table, const OFSInstance::InMemoryFile& f) {
+    std::string path = dir_path(table, f.parent);
+    path += '/';
+    path.append(f.name.data(), f.name.size());
+    return path;
+}
+
+// Owner ids: 0 is no owner, 1..max_users the user in that slot (+1), and
+// past that orphan_owners, names with no user slot found by fs_init.
+static uint32_t owner_id(const OFSInstance* inst, const char* username) {
+    std::lock_guard<std::mutex> lg(inst->mutex);
+    int slot = inst->user_index.find(std::string(username));
+    return slot < 0 ? 0 : (uint32_t)slot + 1;
+}
+
+static const char* owner_name(const OFSInstance* inst, uint32_t id) {
+    if (id == 0) return "";
+    if (id <= inst->max_users) return inst->users[id - 1].username;
+    return inst->orphan_owners[id - 1 - inst->max_users].c_str();
+}
 
+// The API form of a file version, `dir` being its directory's path; the
+// on-disk form when `dir` is null (own name only).
+static FileEntry entry_of(const OFSInstance* inst, const OFSInstance::InMemoryFile& f, const std::string* dir) {
     FileEntry fe;
     std::memset(&fe, 0, sizeof(fe));
-    std::strncpy(fe.name, path, sizeof(fe.name)-1);
-    fe.type = static_cast<uint8_t>(EntryType::FILE);
-    fe.size = size;
-    fe.permissions = 0644;
-    fe.created_time = static_cast<uint64_t>(std::time(nullptr));
-    fe.modified_time = fe.created_time;
-    // owner from session if provided
-    if (session) {
-        SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-        std::strncpy(fe.owner, s->user.username, sizeof(fe.owner)-1);
-    }
-    fe.inode = (uint32_t)inst->files.size() + 1;
-
-    OFSInstance::InMemoryFile imf;
-    imf.path = std::string(path);
-    imf.entry = fe;
-    imf.blocks = blocks;
-    inst->files.push_back(std::move(imf));
-    inst->dirty = true;
-    // persist file table and free_map
-    write_at(inst->omni_path, inst->header.user_table_offset + inst->max_users * sizeof(UserInfo), inst->free_map.data(), inst->free_map.size());
-    write_file_table(inst);
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    size_t at = 0;
+    if (dir) {
+        at = std::min(dir->size(), sizeof(fe.name) - 1);
+        std::memcpy(fe.name, dir->data(), at);
+        if (at < sizeof(fe.name) - 1) fe.name[at++] = '/';
+    }
+    std::memcpy(fe.name + at, f.name.data(), std::min(f.name.size(), sizeof(fe.name) - 1 - at));
+    fe.type = f.type;
+    fe.size = f.size;
+    fe.permissions = f.permissions;
+    fe.created_time = f.created_time;
+    fe.modified_time = f.modified_time;
+    const char* owner = owner_name(inst, f.owner);
+    std::memcpy(fe.owner, owner, std::min(std::strlen(owner), sizeof(fe.owner) - 1));  // fe is zeroed: terminated
+    fe.inode = f.slot + 1;
+    fe.parent_inode = f.parent == ROOT_DIR ? 0 : f.parent + 1;
+    return fe;
 }
 
-// Helper function to check if session user owns the file
-static bool check_file_permission(const FileEntry& entry, void* session) {
-    if (!session) return false; // No session = no access
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-    // Admin can access everything
-    if (s->user.role == UserRole::ADMIN) return true;
-    // Check if owner matches
-    return std::strcmp(entry.owner, s->user.username) == 0;
+// Containers formatted before the layout was recorded have no file table;
+// their files live only as long as the instance.
+static bool has_file_table(const OFSInstance* inst) {
+    return inst->header.file_table_offset != 0;
 }
 
-int file_read(void* instance, void* session, const char* path, char** buffer, size_t* size_out) {
-    if (!instance || !path || !buffer || !size_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    for (const auto &f : inst->files) {
-        if (f.path == path && f.entry.getType() == EntryType::FILE) {
-            // Check permission
-            if (!check_file_permission(f.entry, session)) {
-                return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
-            }
-            size_t total = (size_t)f.entry.size;
-            char* buf = new char[total];
-            size_t copied = 0;
-            for (size_t i = 0; i < f.blocks.size(); ++i) {
-                uint32_t bidx = f.blocks[i];
-                uint64_t off = inst->content_offset + (uint64_t)bidx * inst->block_size;
-                size_t chunk = std::min((size_t)inst->block_size, total - copied);
-                std::ifstream ifs(inst->omni_path, std::ios::in | std::ios::binary);
-                ifs.seekg(off);
-                ifs.read(buf + copied, chunk);
-                copied += chunk;
+// Containers formatted before checksums were added have none to verify.
+static bool has_checksums(const OFSInstance* inst) {
+    return inst->header.slot_checksum_offset != 0;
+}
+
+// Takes a free file table slot for a new entry. Without a file table slots
+// are only ids, handed out as needed. Caller holds write_mutex.
+static bool allocate_slot(OFSInstance* inst, uint32_t& slot) {
+    if (inst->free_slots.empty()) {
+        if (has_file_table(inst) || inst->next_slot >= ROOT_DIR) return false;
+        slot = inst->next_slot++;
+        return true;
+    }
+    slot = inst->free_slots.back();
+    inst->free_slots.pop_back();
+    return true;
+}
+
+// Queues `slot` to be written by the next persist_metadata: `file` is its new
+// contents, null to free it.
+static void stage_slot(OFSInstance* inst, uint32_t slot, std::shared_ptr<const OFSInstance::InMemoryFile> file) {
+    if (!file) inst->free_slots.push_back(slot);
+    if (has_file_table(inst)) inst->pending_slots.push_back({slot, std::move(file)});
+}
+
+// Queues `blocks` as a chain, one write per run of consecutive block numbers,
+// and their checksums alongside. `runs` owns the queued buffers until the
+// batch is submitted; the checksums go straight from block_crc.
+static void queue_chain(OFSInstance* inst, const std::vector<uint32_t>& blocks,
+                        std::deque<std::vector<uint32_t>>& runs, std::vector<IoRequest>& reqs) {
+    for (size_t i = 0; i < blocks.size();) {
+        size_t j = i;
+        while (j + 1 < blocks.size() && blocks[j + 1] == blocks[j] + 1) ++j;
+        runs.emplace_back();
+        std::vector<uint32_t>& run = runs.back();
+        for (size_t k = i; k <= j; ++k) run.push_back(k + 1 < blocks.size() ? blocks[k + 1] : FILE_CHAIN_END);
+        reqs.push_back({inst->header.chain_offset + (uint64_t)blocks[i] * sizeof(uint32_t), run.data(), run.size() * sizeof(uint32_t)});
+        if (has_checksums(inst))
+            reqs.push_back({inst->header.block_checksum_offset + (uint64_t)blocks[i] * sizeof(uint32_t),
+                            &inst->block_crc[blocks[i]], run.size() * sizeof(uint32_t)});
+        i = j + 1;
+    }
+}
+
+// Writes the queued slots and their block chains, submitted as one batch.
+// Only the last version queued for a slot is written, and slots go out in
+// order with neighbours merged into one request, so a bulk import or a
+// deleted subtree costs a few large writes rather than one per slot.
+static bool write_pending_slots(OFSInstance* inst) {
+    if (inst->pending_slots.empty()) return true;
+    auto& pending = inst->pending_slots;
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const OFSInstance::PendingSlot& a, const OFSInstance::PendingSlot& b) { return a.slot < b.slot; });
+    size_t keep = 0;
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (keep && pending[keep - 1].slot == pending[i].slot) pending[keep - 1] = std::move(pending[i]);
+        else if (keep++ != i) pending[keep - 1] = std::move(pending[i]);
+    }
+    pending.resize(keep);
+    std::vector<FileSlot> recs(pending.size());
+    std::vector<SlotChecksum> sums(has_checksums(inst) ? recs.size() : 0);
+    std::deque<std::vector<uint32_t>> runs;
+    std::vector<IoRequest> reqs;
+    for (size_t i = 0; i < pending.size(); ++i) {
+        const auto& p = pending[i];
+        FileSlot& rec = recs[i];
+        std::memset(&rec, 0, sizeof(rec));
+        rec.first_block = FILE_CHAIN_END;
+        rec.tail_block = FILE_CHAIN_END;
+        if (p.file) {
+            rec.entry = entry_of(inst, *p.file, nullptr);
+            rec.in_parent = 1;
+            rec.block_count = (uint32_t)p.file->blocks.size();
+            if (!p.file->blocks.empty()) rec.first_block = p.file->blocks[0];
+            if (p.file->fragment.units) {
+                rec.tail_block = p.file->fragment.block;
+                rec.tail_unit = p.file->fragment.unit;
             }
-            *buffer = buf;
-            *size_out = total;
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
+            std::memcpy(rec.inline_data, p.file->inline_data.data(), p.file->inline_data.size());
+            rec.in_use = 1;
+            queue_chain(inst, p.file->blocks, runs, reqs);
+        }
+        if (!sums.empty()) {
+            sums[i].slot = crc32c(&rec, sizeof(rec));
+            sums[i].tail = p.file && p.file->fragment.units ? p.file->tail_crc : 0;
         }
     }
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    for (size_t i = 0; i < pending.size();) {
+        size_t j = i + 1;
+        while (j < pending.size() && pending[j].slot == pending[j - 1].slot + 1) ++j;
+        reqs.push_back({inst->header.file_table_offset + (uint64_t)pending[i].slot * sizeof(FileSlot), &recs[i], (j - i) * sizeof(FileSlot)});
+        if (!sums.empty())
+            reqs.push_back({inst->header.slot_checksum_offset + (uint64_t)pending[i].slot * sizeof(SlotChecksum), &sums[i],
+                            (j - i) * sizeof(SlotChecksum)});
+        i = j;
+    }
+    pending.clear();
+    return write_batch(inst, reqs);
 }
 
-int file_delete(void* instance, void* session, const char* path) {
-    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    for (size_t i = 0; i < inst->files.size(); ++i) {
-        if (inst->files[i].path == path) {
-            // Check permission
-            if (!check_file_permission(inst->files[i].entry, session)) {
-                return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+// Writes the free map entries in free_map_dirty, one request per run of
+// neighbouring entries.
+static bool write_dirty_free_map(OFSInstance* inst) {
+    auto& dirty = inst->free_map_dirty;
+    if (dirty.empty()) return true;
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    std::vector<IoRequest> reqs;
+    for (size_t i = 0; i < dirty.size();) {
+        size_t j = i + 1;
+        while (j < dirty.size() && dirty[j] == dirty[j - 1] + 1) ++j;
+        reqs.push_back({inst->header.free_map_offset + dirty[i], inst->free_map.data() + dirty[i], j - i});
+        i = j;
+    }
+    dirty.clear();
+    return write_batch(inst, reqs);
+}
+
+// Writes the free map entries and file slots changed since the last call,
+// unless a batch is open: fs_batch_end persists once for the whole batch.
+static void persist_metadata(OFSInstance* inst) {
+    TraceSpan span("persist_metadata");
+    if (in_batch(inst)) return;
+    ScopedLatency timed(g_core_metrics.metadata_persist);
+    // Not atomic across a crash. Free map first, so an interrupted create
+    // leaks its new blocks rather than leaving a slot that points at blocks
+    // still marked free.
+    write_dirty_free_map(inst);
+    write_pending_slots(inst);
+}
+
+// Loads the file slots, rebuilds each file's block list from the chain and
+// the fragment map from the tails. A slot that fails its checksum (a write
+// torn by a crash) is left out and kept out of use until fs_fsck clears it.
+// Slots still holding a full path are converted to a name under a parent,
+// creating any directory the path needs. Entries cut off from the root (their
+// directory failed to load) are moved to /lost+found. Slots changed either
+// way are written back before fs_init returns.
+static bool read_file_table(OFSInstance* inst) {
+    if (!inst) return false;
+    if (!has_file_table(inst)) return true;
+    const OMNIHeader& h = inst->header;
+    std::vector<FileSlot> slots(h.max_files);
+    std::vector<uint32_t> chain((size_t)h.num_blocks);
+    std::vector<SlotChecksum> sums(has_checksums(inst) ? h.max_files : 0);
+    if (!read_at(inst, h.file_table_offset, slots.data(), slots.size() * sizeof(FileSlot))) return false;
+    if (!chain.empty() && !read_at(inst, h.chain_offset, chain.data(), chain.size() * sizeof(uint32_t))) return false;
+    if (!sums.empty() && !read_at(inst, h.slot_checksum_offset, sums.data(), sums.size() * sizeof(SlotChecksum))) return false;
+    std::vector<std::shared_ptr<OFSInstance::InMemoryFile>> loaded(h.max_files);
+    std::vector<std::string> full_paths(h.max_files);  // slots not converted yet
+    for (uint32_t i = h.max_files; i-- > 0;) {
+        const FileSlot& rec = slots[i];
+        if (!rec.in_use) {
+            inst->free_slots.push_back(i);
+            continue;
+        }
+        if (!sums.empty() && crc32c(&rec, sizeof(rec)) != sums[i].slot) {
+            std::cerr << "fs_init: file slot " << i << " fails its checksum; skipped until fs_fsck --repair" << std::endl;
+            inst->damaged_slots.push_back(i);
+            continue;
+        }
+        auto imf = std::make_shared<OFSInstance::InMemoryFile>();
+        const FileEntry& fe = rec.entry;
+        size_t name_len = strnlen(fe.name, sizeof(fe.name) - 1);
+        if (rec.in_parent) {
+            imf->name = inst->names.intern(fe.name, name_len);
+            imf->parent = fe.parent_inode == 0 ? ROOT_DIR : fe.parent_inode - 1;
+        } else {
+            full_paths[i].assign(fe.name, name_len);
+        }
+        std::string owner(fe.owner, strnlen(fe.owner, sizeof(fe.owner) - 1));
+        imf->owner = owner.empty() ? 0 : owner_id(inst, owner.c_str());
+        if (!owner.empty() && imf->owner == 0) {
+            auto known = std::find(inst->orphan_owners.begin(), inst->orphan_owners.end(), owner);
+            if (known == inst->orphan_owners.end()) known = inst->orphan_owners.insert(known, owner);
+            imf->owner = inst->max_users + 1 + (uint32_t)(known - inst->orphan_owners.begin());
+        }
+        imf->type = fe.type;
+        imf->permissions = fe.permissions;
+        imf->size = fe.size;
+        imf->created_time = fe.created_time;
+        imf->modified_time = fe.modified_time;
+        imf->slot = i;
+        imf->blocks.reserve(rec.block_count);
+        uint32_t b = rec.first_block;
+        for (uint32_t n = 0; n < rec.block_count; ++n) {
+            if (b >= chain.size()) return false;
+            imf->blocks.push_back(b);
+            b = chain[b];
+        }
+        uint64_t in_blocks = (uint64_t)rec.block_count * inst->block_size;
+        uint64_t tail = rec.entry.size > in_blocks ? rec.entry.size - in_blocks : 0;
+        if (rec.tail_block != FILE_CHAIN_END) {
+            Fragment& f = imf->fragment;
+            f.block = rec.tail_block;
+            f.unit = rec.tail_unit;
+            f.units = (uint32_t)((tail + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE);
+            if (f.block >= chain.size() || f.units == 0 || f.unit + f.units > units_per_block(inst)) return false;
+            if (!sums.empty()) imf->tail_crc = sums[i].tail;
+        } else if (tail > 0) {
+            if (tail > FILE_INLINE_MAX) return false;
+            imf->inline_data.assign(rec.inline_data, (size_t)tail);
+        }
+        loaded[i] = std::move(imf);
+    }
+
+    // Depth below the root, so that directories are placed before what they
+    // hold. An entry whose directory did not load, is not a directory or
+    // loops back to it is cut off and will sit in /lost+found (depth 2).
+    const uint32_t VISITING = UINT32_MAX;
+    std::vector<uint32_t> depth(h.max_files, 0), walk;
+    std::vector<uint8_t> cut_off(h.max_files, 0);
+    auto loaded_dir = [&](uint32_t s) {
+        return s < h.max_files && loaded[s] && loaded[s]->getType() == EntryType::DIRECTORY;
+    };
+    for (uint32_t i = 0; i < h.max_files; ++i) {
+        walk.clear();
+        for (uint32_t s = i; loaded[s] && depth[s] == 0;) {
+            depth[s] = VISITING;
+            walk.push_back(s);
+            uint32_t parent = loaded[s]->parent;
+            if (!full_paths[s].empty() || parent == ROOT_DIR || !loaded_dir(parent)) break;
+            s = parent;
+        }
+        uint32_t d = 0;
+        for (size_t k = walk.size(); k-- > 0;) {
+            uint32_t s = walk[k];
+            uint32_t parent = loaded[s]->parent;
+            if (k + 1 < walk.size()) {
+                ++d;
+            } else if (!full_paths[s].empty()) {
+                d = (uint32_t)std::max<size_t>(1, std::count(full_paths[s].begin(), full_paths[s].end(), '/'));
+            } else if (parent == ROOT_DIR) {
+                d = 1;
+            } else if (!loaded_dir(parent) || depth[parent] == VISITING) {
+                cut_off[s] = 1;
+                d = 2;
+            } else {
+                d = depth[parent] + 1;
+            }
+            depth[s] = d;
+        }
+    }
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < h.max_files; ++i)
+        if (loaded[i]) order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return depth[a] < depth[b]; });
+
+    auto table = std::make_shared<OFSInstance::FileTable>();
+    table->paths = new_path_generation();
+    uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    auto make_dir = [&](uint32_t parent, std::string_view name, uint32_t owner) {
+        uint32_t slot = 0;
+        if (!allocate_slot(inst, slot)) return NO_ENTRY;
+        auto d = std::make_shared<OFSInstance::InMemoryFile>();
+        d->name = inst->names.intern(name.data(), name.size());
+        d->parent = parent;
+        d->owner = owner;
+        d->type = static_cast<uint8_t>(EntryType::DIRECTORY);
+        d->permissions = 0755;
+        d->created_time = now;
+        d->modified_time = now;
+        d->slot = slot;
+        stage_slot(inst, slot, d);
+        table_put(*table, d);
+        return slot;
+    };
+    // Finds or creates each directory of `dir`; NO_ENTRY if a file is in the way.
+    auto make_dirs = [&](std::string_view dir, uint32_t owner) {
+        uint32_t at = ROOT_DIR;
+        for (size_t i = 0; i < dir.size() && at != NO_ENTRY;) {
+            if (dir[i] == '/') { ++i; continue; }
+            size_t end = std::min(dir.find('/', i), dir.size());
+            uint32_t next = table->children.find(table->pages, at, dir.data() + i, end - i);
+            if (next == NO_ENTRY) next = end - i < sizeof(FileEntry::name) ? make_dir(at, dir.substr(i, end - i), owner) : NO_ENTRY;
+            else if (!is_dir(*table, next)) next = NO_ENTRY;
+            at = next;
+            i = end;
+        }
+        return at;
+    };
+    auto place = [&](const std::shared_ptr<OFSInstance::InMemoryFile>& f, uint32_t parent, std::string_view name) {
+        if (!is_dir(*table, parent) || table->children.find(table->pages, parent, name.data(), name.size()) != NO_ENTRY) return false;
+        if (name.data() != f->name.data()) {
+            inst->names.release(f->name);
+            f->name = inst->names.intern(name.data(), name.size());
+        }
+        f->parent = parent;
+        table_put(*table, f);
+        if (f->fragment.units) {
+            OFSInstance::FragmentBlock& fb = inst->fragment_blocks[f->fragment.block];
+            if (fb.used.empty()) {
+                fb.used.assign(units_per_block(inst), 0);
+                fb.free_units = units_per_block(inst);
             }
-            free_blocks(inst, inst->files[i].blocks);
-            inst->files.erase(inst->files.begin() + i);
+            mark_fragment(fb, f->fragment, 1);
+        }
+        return true;
+    };
+    uint32_t lost_found = NO_ENTRY;
+    bool looked_for_lost_found = false;
+    size_t converted = 0;
+    for (uint32_t s : order) {
+        const std::shared_ptr<OFSInstance::InMemoryFile>& f = loaded[s];
+        const std::string& full = full_paths[s];
+        bool placed = false, rewrite = !full.empty();
+        if (!full.empty()) {
+            uint32_t parent = ROOT_DIR;
+            std::string_view name;
+            int rc = resolve_parent(*table, full.c_str(), parent, name);
+            if (rc == static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND)) {
+                parent = make_dirs(std::string_view(full).substr(0, full.size() - name.size()), f->owner);
+                if (parent != NO_ENTRY) rc = 0;
+            }
+            placed = rc == 0 && place(f, parent, name);
+            converted += placed;
+        } else if (!cut_off[s]) {
+            placed = place(f, f->parent, f->name);
+        }
+        if (!placed) {
+            if (!looked_for_lost_found) {
+                looked_for_lost_found = true;
+                lost_found = table->children.find(table->pages, ROOT_DIR, "lost+found", 10);
+                if (lost_found == NO_ENTRY) lost_found = make_dir(ROOT_DIR, "lost+found", 0);
+                else if (!is_dir(*table, lost_found)) lost_found = NO_ENTRY;  // a file is in the way
+            }
+            std::string_view own = full.empty() ? f->name : std::string_view(full).substr(full.rfind('/') + 1);
+            std::string name = std::to_string(s + 1) + "-" + std::string(own);
+            name.resize(std::min(name.size(), sizeof(FileEntry::name) - 1));
+            placed = lost_found != NO_ENTRY && place(f, lost_found, name);
+            if (placed) std::cerr << "fs_init: inode " << s + 1 << " is cut off from the root; moved to /lost+found/" << name << std::endl;
+            rewrite = true;
+        }
+        if (!placed) {
+            std::cerr << "fs_init: file slot " << s << " has no place in the tree; skipped until fs_fsck --repair" << std::endl;
+            inst->names.release(f->name);
+            inst->damaged_slots.push_back(s);
+            continue;
+        }
+        if (rewrite) stage_slot(inst, s, f);
+    }
+    // A crash between the free map and slot writes can leave a fragment
+    // block no tail points at.
+    for (size_t b = 0; b < inst->free_map.size(); ++b) {
+        if (inst->free_map[b] == FREE_MAP_FRAGMENTS && !inst->fragment_blocks.count((uint32_t)b)) {
+            set_free_map(inst, (uint32_t)b, 0);
             inst->dirty = true;
-            write_at(inst->omni_path, inst->header.user_table_offset + inst->max_users * sizeof(UserInfo), inst->free_map.data(), inst->free_map.size());
-            write_file_table(inst);
-            return static_cast<int>(OFSErrorCodes::SUCCESS);
         }
     }
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    publish_table(inst, std::move(table));
+    if (!inst->pending_slots.empty()) {
+        if (converted) std::cerr << "fs_init: converted " << converted << " file slots from full paths to names" << std::endl;
+        persist_metadata(inst);
+    }
+    return true;
 }
 
-int file_exists(void* instance, void* /*session*/, const char* path) {
-    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    for (const auto &f : inst->files) if (f.path == path) return static_cast<int>(OFSErrorCodes::SUCCESS);
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+// The session behind a call, resolved once per call.
+struct Caller {
+    bool valid = false;  // No session = no access
+    bool admin = false;
+    uint32_t owner = 0;
+};
+
+static Caller caller_of(const OFSInstance* inst, void* session) {
+    Caller c;
+    if (!session) return c;
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    c.valid = true;
+    c.admin = s->user.role == UserRole::ADMIN;
+    c.owner = owner_id(inst, s->user.username);
+    return c;
 }
 
-int dir_create(void* instance, void* session, const char* path) {
-    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    FileEntry fe;
-    std::memset(&fe, 0, sizeof(fe));
-    std::strncpy(fe.name, path, sizeof(fe.name)-1);
-    fe.type = static_cast<uint8_t>(EntryType::DIRECTORY);
-    fe.size = 0;
-    fe.permissions = 0755;
-    fe.created_time = static_cast<uint64_t>(std::time(nullptr));
-    fe.modified_time = fe.created_time;
-    if (session) {
-        SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-        std::strncpy(fe.owner, s->user.username, sizeof(fe.owner)-1);
-    }
-    fe.inode = (uint32_t)inst->files.size() + 1;
-    OFSInstance::InMemoryFile imf;
-    imf.path = std::string(path);
-    imf.entry = fe;
-    inst->files.push_back(std::move(imf));
-    inst->dirty = true;
-    write_file_table(inst);
+// Admins can access everything, other users what they own.
+static bool check_file_permission(uint32_t owner, const Caller& c) {
+    if (!c.valid) return false;
+    if (c.admin) return true;
+    return c.owner != 0 && owner == c.owner;
+}
+
+// Where a create at `path` lands: the directory, the new entry's name and the
+// file already there, if any.
+struct CreateTarget {
+    uint32_t parent = ROOT_DIR;
+    std::string_view name;
+    uint32_t existing = NO_ENTRY;
+};
+
+// A file may be (re)created at `path` if its directory exists, unless a
+// directory lives there or the existing file belongs to someone else.
+static int check_create_target(const OFSInstance* inst, const OFSInstance::FileTable& table, const char* path, void* session,
+                               CreateTarget* out = nullptr) {
+    CreateTarget t;
+    int rc = resolve_parent(table, path, t.parent, t.name);
+    if (rc != 0) return rc;
+    t.existing = table.children.find(table.pages, t.parent, t.name.data(), t.name.size());
+    if (out) *out = t;
+    if (t.existing == NO_ENTRY) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    const OFSInstance::InMemoryFile* existing = table.file(t.existing).get();
+    if (existing->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    if (!check_file_permission(existing->owner, caller_of(inst, session))) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int dir_list(void* instance, void* session, const char* path, FileEntry** entries, int* count) {
-    if (!instance || !path || !entries || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
-    std::vector<FileEntry> found;
-    std::string prefix(path);
-    if (prefix.back() != '/') prefix += '/';
-    for (const auto &f : inst->files) {
-        std::string p = f.path;
-        if (p == path) continue; // skip self
-        if (p.rfind(prefix, 0) == 0) {
-            // immediate child test
-            std::string rest = p.substr(prefix.size());
-            if (!rest.empty() && rest.find('/') == std::string::npos) {
-                // Only show files the user owns (or all if admin)
-                if (check_file_permission(f.entry, session)) {
-                    found.push_back(f.entry);
-                }
-            }
-        }
+// Copies a new entry's name into the arena. Inside a batch it is released
+// again if the batch is discarded.
+static std::string_view intern_name(OFSInstance* inst, std::string_view name) {
+    std::string_view v = inst->names.intern(name.data(), name.size());
+    if (in_batch(inst)) inst->batch.new_names.push_back(v);
+    return v;
+}
+
+// Where a file version's contents were written: whole blocks plus a tail
+// in a fragment or inline (see FileSlot).
+struct FileExtents {
+    std::vector<uint32_t> blocks;
+    Fragment fragment;
+    std::string inline_data;
+    uint32_t tail_crc = 0;
+};
+
+// Frees the extents of a version that was never published.
+static void release_extents(OFSInstance* inst, const FileExtents& ext) {
+    free_blocks(inst, ext.blocks);
+    free_fragment(inst, ext.fragment);
+}
+
+// Puts `ext` (already written) into `next` as the new version of the file at
+// `path`, creating the entry if needed, and adds what it supersedes to
+// `superseded`. Caller holds write_mutex and publishes `next`. On failure the
+// extents are freed.
+static int stage_file_version(OFSInstance* inst, OFSInstance::FileTable& next, void* session, const char* path,
+                              FileExtents ext, uint64_t size, std::vector<uint32_t>& superseded,
+                              std::vector<Fragment>& superseded_fragments) {
+    CreateTarget target;
+    int rc = check_create_target(inst, next, path, session, &target);
+    if (rc != 0) {
+        release_extents(inst, ext);
+        return rc;
     }
-    *count = (int)found.size();
-    if (found.empty()) { *entries = nullptr; return static_cast<int>(OFSErrorCodes::SUCCESS); }
-    FileEntry* out = new FileEntry[found.size()];
-    for (size_t i = 0; i < found.size(); ++i) out[i] = found[i];
-    *entries = out;
+    const OFSInstance::InMemoryFile* existing = target.existing == NO_ENTRY ? nullptr : next.file(target.existing).get();
+
+    uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    auto imf = std::make_shared<OFSInstance::InMemoryFile>();
+    uint32_t slot = 0;
+    if (existing) {
+        *imf = *existing;
+        slot = existing->slot;
+    } else if (!allocate_slot(inst, slot)) {
+        release_extents(inst, ext);
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    } else {
+        imf->name = intern_name(inst, target.name);
+        imf->parent = target.parent;
+        imf->type = static_cast<uint8_t>(EntryType::FILE);
+        imf->permissions = 0644;
+        imf->created_time = now;
+        // owner from session if provided
+        if (session) imf->owner = owner_id(inst, reinterpret_cast<SessionInfo*>(session)->user.username);
+    }
+    imf->size = size;
+    imf->modified_time = now;
+    imf->blocks = std::move(ext.blocks);
+    imf->fragment = ext.fragment;
+    imf->inline_data = std::move(ext.inline_data);
+    imf->tail_crc = ext.tail_crc;
+    imf->slot = slot;
+    stage_slot(inst, slot, imf);
+    if (existing) {
+        superseded.insert(superseded.end(), existing->blocks.begin(), existing->blocks.end());
+        if (existing->fragment.units) superseded_fragments.push_back(existing->fragment);
+        table_replace(next, std::move(imf));
+    } else {
+        table_put(next, std::move(imf));
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Publishes `ext` (already written) as the new version of the file at
+// `path`, creating the entry if needed. Caller holds write_mutex. On failure
+// the extents are freed.
+static int publish_file_version(OFSInstance* inst, void* session, const char* path, FileExtents ext, uint64_t size) {
+    TraceSpan span("publish_file_version");
+    auto next = clone_table(inst);
+    std::vector<uint32_t> superseded;
+    std::vector<Fragment> superseded_fragments;
+    int rc = stage_file_version(inst, *next, session, path, std::move(ext), size, superseded, superseded_fragments);
+    if (rc != 0) return rc;
+    publish_table(inst, std::move(next));
+    retire_blocks(inst, std::move(superseded), std::move(superseded_fragments));
+    inst->dirty = true;
+    persist_metadata(inst);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Records the checksum of each block's share of `len` bytes written across
+// blocks[0..nblocks). Caller holds write_mutex; the blocks are not yet
+// reachable from a published table.
+static void checksum_blocks(OFSInstance* inst, const uint32_t* blocks, size_t nblocks, const char* data, size_t len) {
+    if (!has_checksums(inst)) return;
+    for (size_t i = 0; i < nblocks && len > 0; ++i) {
+        size_t chunk = std::min((size_t)inst->block_size, len);
+        inst->block_crc[blocks[i]] = crc32c(data, chunk);
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+// Writes `len` bytes across blocks[0..nblocks), all submitted at once.
+static bool write_blocks(OFSInstance* inst, const uint32_t* blocks, size_t nblocks, const char* data, size_t len) {
+    checksum_blocks(inst, blocks, nblocks, data, len);
+    std::vector<IoRequest> reqs;
+    reqs.reserve(nblocks);
+    size_t remaining = len;
+    const char* ptr = data;
+    for (size_t i = 0; i < nblocks && remaining > 0; ++i) {
+        uint64_t off = inst->content_offset + (uint64_t)blocks[i] * inst->block_size;
+        size_t chunk = remaining > inst->block_size ? inst->block_size : remaining;
+        // Merge runs of consecutive blocks into one request.
+        if (!reqs.empty() && blocks[i] == blocks[i - 1] + 1) reqs.back().len += chunk;
+        else reqs.push_back({off, const_cast<char*>(ptr), chunk});
+        ptr += chunk; remaining -= chunk;
+    }
+    return write_batch(inst, reqs);
+}
+
+// Stores the `len` bytes past a file's whole blocks: inline up to
+// FILE_INLINE_MAX, in a fragment up to half a block, otherwise in a block of
+// their own. Caller holds write_mutex; on failure nothing new stays allocated.
+static int write_tail(OFSInstance* inst, const char* data, size_t len, FileExtents& ext) {
+    if (len == 0) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    if (len <= FILE_INLINE_MAX) {
+        ext.inline_data.assign(data, len);
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    if (len <= inst->block_size / 2) {
+        Fragment f;
+        if (!allocate_fragment(inst, len, f)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        uint64_t off = inst->content_offset + (uint64_t)f.block * inst->block_size + (uint64_t)f.unit * FRAGMENT_SIZE;
+        if (!write_at(inst, off, data, len)) {
+            free_fragment(inst, f);
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        ext.fragment = f;
+        if (has_checksums(inst)) ext.tail_crc = crc32c(data, len);
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    std::vector<uint32_t> nb;
+    if (!allocate_blocks(inst, 1, nb)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    if (!write_blocks(inst, nb.data(), 1, data, len)) {
+        free_blocks(inst, nb);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    ext.blocks.push_back(nb[0]);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Creates a file, or publishes a new version of an existing one. The new
+// contents always go to freshly allocated blocks (copy-on-write), so readers
+// holding an older snapshot keep reading the previous version untouched.
+int file_create(void* instance, void* session, const char* path, const char* data, size_t size) {
+    TraceSpan span("file_create");
+    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+
+    int rc = check_create_target(inst, *visible_table(inst), path, session);
+    if (rc != 0) return rc;
+
+    // Small files live entirely in their slot.
+    size_t whole = size <= FILE_INLINE_MAX ? 0 : size / inst->block_size;
+    FileExtents ext;
+    if (!allocate_blocks(inst, whole, ext.blocks)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+
+    // write data to blocks
+    if (!write_blocks(inst, ext.blocks.data(), ext.blocks.size(), data, whole * inst->block_size)) {
+        // rollback
+        free_blocks(inst, ext.blocks);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    rc = write_tail(inst, data + whole * inst->block_size, size - whole * inst->block_size, ext);
+    if (rc != 0) {
+        free_blocks(inst, ext.blocks);
+        return rc;
+    }
+    return publish_file_version(inst, session, path, std::move(ext), size);
+}
+
+// Bulk form of file_create for imports. The whole blocks of every item come
+// from one allocate_blocks call, in item order, so a group's contents land
+// on disk roughly as one sequential stream and go out in one submission.
+// Tails are stored as file_create stores them. The table is published and
+// metadata persisted once for the group.
+int file_create_many(void* instance, void* session, ImportItem* items, int count) {
+    TraceSpan span("file_create_many");
+    if (!instance || (count > 0 && !items)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    auto next = clone_table(inst);
+
+    size_t total = 0;
+    std::vector<size_t> whole(count);
+    for (int i = 0; i < count; ++i) {
+        items[i].result = check_create_target(inst, *next, items[i].path, session);
+        whole[i] = items[i].size <= FILE_INLINE_MAX ? 0 : (size_t)(items[i].size / inst->block_size);
+        if (items[i].result == 0) total += whole[i];
+    }
+    std::vector<uint32_t> blocks;
+    if (!allocate_blocks(inst, total, blocks)) {
+        for (int i = 0; i < count; ++i) items[i].result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+
+    // One request per run of consecutive blocks within an item.
+    std::vector<IoRequest> reqs;
+    std::vector<FileExtents> ext(count);
+    size_t at = 0;
+    for (int i = 0; i < count; ++i) {
+        if (items[i].result != 0) continue;
+        ext[i].blocks.assign(blocks.begin() + at, blocks.begin() + at + whole[i]);
+        at += whole[i];
+        checksum_blocks(inst, ext[i].blocks.data(), whole[i], items[i].data, whole[i] * inst->block_size);
+        const char* ptr = items[i].data;
+        for (size_t b = 0; b < whole[i]; ++b, ptr += inst->block_size) {
+            uint32_t blk = ext[i].blocks[b];
+            if (b > 0 && blk == ext[i].blocks[b - 1] + 1) reqs.back().len += inst->block_size;
+            else reqs.push_back({inst->content_offset + (uint64_t)blk * inst->block_size, const_cast<char*>(ptr), (size_t)inst->block_size});
+        }
+    }
+    if (!write_batch(inst, reqs)) {
+        free_blocks(inst, blocks);
+        for (int i = 0; i < count; ++i) items[i].result = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+
+    std::vector<uint32_t> superseded;
+    std::vector<Fragment> superseded_fragments;
+    int rc = static_cast<int>(OFSErrorCodes::SUCCESS);
+    for (int i = 0; i < count; ++i) {
+        ImportItem& it = items[i];
+        if (it.result == 0) {
+            size_t done = whole[i] * inst->block_size;
+            it.result = write_tail(inst, it.data + done, (size_t)it.size - done, ext[i]);
+            if (it.result != 0) free_blocks(inst, ext[i].blocks);
+        }
+        if (it.result == 0)
+            it.result = stage_file_version(inst, *next, session, it.path, std::move(ext[i]), it.size, superseded, superseded_fragments);
+        if (it.result != 0 && rc == 0) rc = it.result;
+    }
+    publish_table(inst, std::move(next));
+    retire_blocks(inst, std::move(superseded), std::move(superseded_fragments));
+    inst->dirty = true;
+    persist_metadata(inst);
+    return rc;
+}
+
+// Checks every block and fragment tail that [offset, offset+len) of `f`, just
+// read into buf, touches. Pieces buf covers whole are checked from buf; those
+// it covers only in part are read whole first, so a read never returns bytes
+// from a block that fails its checksum. Inline tails were checked with their
+// slot by fs_init.
+static bool verify_range(OFSInstance* inst, const OFSInstance::InMemoryFile& f, uint64_t offset, const char* buf, size_t len) {
+    if (!has_checksums(inst) || len == 0) return true;
+    uint64_t bs = inst->block_size, end = offset + len;
+    uint64_t in_blocks = (uint64_t)f.blocks.size() * bs;
+    auto failed = [&](const char* what, uint64_t index) {
+        g_core_metrics.checksum_errors.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "checksum mismatch: inode " << f.slot + 1 << " (" << f.name << ") " << what << " " << index << std::endl;
+        return false;
+    };
+    // Reused across calls so edge blocks do not allocate.
+    thread_local std::vector<char> whole;
+    auto piece = [&](uint64_t start, uint64_t stop, uint64_t disk_off, const char*& p) {
+        if (start >= offset && stop <= end) {
+            p = buf + (start - offset);
+            return true;
+        }
+        whole.resize((size_t)bs);
+        IoRequest r = {disk_off, whole.data(), (size_t)(stop - start)};
+        p = whole.data();
+        return inst->io.read(&r, 1);
+    };
+    const char* p = nullptr;
+    for (uint64_t bi = offset / bs; bi < f.blocks.size() && bi * bs < end; ++bi) {
+        uint64_t start = bi * bs, stop = std::min(start + bs, f.size);
+        if (!piece(start, stop, inst->content_offset + (uint64_t)f.blocks[bi] * bs, p)) return false;
+        if (crc32c(p, (size_t)(stop - start)) != inst->block_crc[f.blocks[bi]]) return failed("block", bi);
+    }
+    if (f.fragment.units && end > in_blocks) {
+        uint64_t disk_off = inst->content_offset + (uint64_t)f.fragment.block * bs + (uint64_t)f.fragment.unit * FRAGMENT_SIZE;
+        if (!piece(in_blocks, f.size, disk_off, p)) return false;
+        if (crc32c(p, (size_t)(f.size - in_blocks)) != f.tail_crc) return failed("tail in fragment block", f.fragment.block);
+    }
+    return true;
+}
+
+// Copies [offset, offset+len) of a file version into buf: one read per run
+// of consecutive blocks plus one for the tail, all submitted at once.
+static bool read_file_range(OFSInstance* inst, const OFSInstance::InMemoryFile& f, uint64_t offset, char* buf, size_t len) {
+    TraceSpan span("read_file_range");
+    if (len == 0) return true;
+    uint64_t in_blocks = (uint64_t)f.blocks.size() * inst->block_size;
+    // Reads that only touch an inline tail need no I/O at all.
+    if (f.fragment.units == 0 && offset >= in_blocks) {
+        if (offset - in_blocks + len > f.inline_data.size()) return false;
+        std::memcpy(buf, f.inline_data.data() + (offset - in_blocks), len);
+        return true;
+    }
+    // Reused across calls so small reads do not allocate.
+    thread_local std::vector<IoRequest> reqs;
+    reqs.clear();
+    size_t copied = 0;
+    while (copied < len) {
+        uint64_t pos = offset + copied;
+        uint64_t off = 0;
+        size_t chunk = len - copied;
+        if (pos >= in_blocks) {
+            uint64_t at = pos - in_blocks;
+            if (f.fragment.units == 0) {
+                if (at + chunk > f.inline_data.size()) return false;
+                std::memcpy(buf + copied, f.inline_data.data() + at, chunk);
+                break;
+            }
+            if (at + chunk > (uint64_t)f.fragment.units * FRAGMENT_SIZE) return false;
+            off = inst->content_offset + (uint64_t)f.fragment.block * inst->block_size +
+                  (uint64_t)f.fragment.unit * FRAGMENT_SIZE + at;
+        } else {
+            size_t bi = (size_t)(pos / inst->block_size);
+            size_t in_block = (size_t)(pos % inst->block_size);
+            off = inst->content_offset + (uint64_t)f.blocks[bi] * inst->block_size + in_block;
+            chunk = std::min((size_t)inst->block_size - in_block, chunk);
+        }
+        if (!reqs.empty() && reqs.back().offset + reqs.back().len == off) reqs.back().len += chunk;
+        else reqs.push_back({off, buf + copied, chunk});
+        copied += chunk;
+    }
+    {
+        ScopedLatency timed(g_core_metrics.io_read);
+        size_t bytes = 0;
+        for (const IoRequest& r : reqs) bytes += r.len;
+        g_core_metrics.bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+        if (!inst->io.read(reqs.data(), reqs.size())) return false;
+    }
+    return verify_range(inst, f, offset, buf, len);
+}
+
+// Shared by file_read and file_read_arena. `alloc(n)` provides the buffer and
+// `release(p)` takes it back when the read fails.
+template <typename Alloc, typename Release>
+static int read_whole_file(void* instance, void* session, const char* path, char** buffer, size_t* size_out,
+                           Alloc alloc, Release release) {
+    TraceSpan span("file_read");
+    if (!instance || !path || !buffer || !size_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    SnapshotGuard snap(inst);
+    const OFSInstance::InMemoryFile* f = find_file(*snap.table, path);
+    if (!f || f->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    // Check permission
+    if (!check_file_permission(f->owner, caller_of(inst, session))) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    size_t total = (size_t)f->size;
+    char* buf = alloc(total);
+    if (!read_file_range(inst, *f, 0, buf, total)) {
+        release(buf);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    *buffer = buf;
+    *size_out = total;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_read(void* instance, void* session, const char* path, char** buffer, size_t* size_out) {
+    return read_whole_file(instance, session, path, buffer, size_out,
+                           [](size_t n) { return new char[n]; }, [](char* p) { delete [] p; });
+}
+
+int file_read_arena(void* instance, void* session, const char* path, BumpArena* arena, char** buffer, size_t* size_out) {
+    if (!arena) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    return read_whole_file(instance, session, path, buffer, size_out,
+                           [arena](size_t n) { return arena->alloc_array<char>(n); }, [](char*) {});
+}
+
+// Reads up to len bytes starting at offset into a caller-provided buffer.
+// *read_out gets the bytes copied and *file_size_out (optional) the size of
+// the version that was read, so callers can size buffers with len == 0 first.
+int file_read_range(void* instance, void* session, const char* path, uint64_t offset, char* buffer, size_t len, size_t* read_out, uint64_t* file_size_out) {
+    TraceSpan span("file_read_range");
+    if (!instance || !path || !read_out || (len > 0 && !buffer)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    SnapshotGuard snap(inst);
+    const OFSInstance::InMemoryFile* f = find_file(*snap.table, path);
+    if (!f || f->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (!check_file_permission(f->owner, caller_of(inst, session))) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    uint64_t size = f->size;
+    if (file_size_out) *file_size_out = size;
+    *read_out = 0;
+    if (offset > size) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    size_t n = (size_t)std::min<uint64_t>(len, size - offset);
+    if (!read_file_range(inst, *f, offset, buffer, n)) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    *read_out = n;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Lists the container ranges behind [offset, offset+len) of a file version,
+// merging consecutive blocks; an inline tail is copied into the arena.
+static void map_file_range(OFSInstance* inst, const OFSInstance::InMemoryFile& f, uint64_t offset, uint64_t len,
+                           BumpArena* arena, FileExtent** extents, int* count) {
+    uint64_t in_blocks = (uint64_t)f.blocks.size() * inst->block_size;
+    FileExtent* out = nullptr;
+    size_t n = 0;
+    uint64_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint64_t chunk = len - done;
+        FileExtent e = {0, 0, nullptr};
+        if (pos >= in_blocks) {
+            uint64_t at = pos - in_blocks;
+            if (f.fragment.units == 0) {
+                char* copy = arena->alloc_array<char>((size_t)chunk);
+                std::memcpy(copy, f.inline_data.data() + at, (size_t)chunk);
+                e.data = copy;
+            } else {
+                e.offset = inst->content_offset + (uint64_t)f.fragment.block * inst->block_size +
+                           (uint64_t)f.fragment.unit * FRAGMENT_SIZE + at;
+            }
+        } else {
+            uint64_t in_block = pos % inst->block_size;
+            e.offset = inst->content_offset + (uint64_t)f.blocks[(size_t)(pos / inst->block_size)] * inst->block_size + in_block;
+            chunk = std::min(inst->block_size - in_block, chunk);
+        }
+        e.len = chunk;
+        if (n > 0 && !e.data && !out[n - 1].data && out[n - 1].offset + out[n - 1].len == e.offset) {
+            out[n - 1].len += chunk;
+        } else {
+            out = arena->grow(out, n, n + 1);
+            out[n++] = e;
+        }
+        if (!e.data) g_core_metrics.bytes_read.fetch_add(chunk, std::memory_order_relaxed);  // sent by the caller
+        done += chunk;
+    }
+    *extents = out;
+    *count = (int)n;
+}
+
+// Verifies the blocks behind [offset, offset+len) of `f` before their extents
+// go out for a zero-copy send, which would otherwise skip the checksums. Reads
+// whole blocks through a scratch window of a megabyte or one block.
+static bool verify_mapped_range(OFSInstance* inst, const OFSInstance::InMemoryFile& f, uint64_t offset, uint64_t len) {
+    if (!has_checksums(inst) || len == 0) return true;
+    uint64_t bs = inst->block_size;
+    uint64_t window = std::max<uint64_t>(bs, 1u << 20);
+    uint64_t pos = offset / bs * bs, end = std::min(f.size, (offset + len + bs - 1) / bs * bs);
+    thread_local std::vector<char> scratch;
+    scratch.resize((size_t)std::min(window, end - pos));
+    while (pos < end) {
+        size_t n = (size_t)std::min(window, end - pos);
+        if (!read_file_range(inst, f, pos, scratch.data(), n)) return false;
+        pos += n;
+    }
+    return true;
+}
+
+int container_fd(void* instance) {
+    return instance ? reinterpret_cast<OFSInstance*>(instance)->io.fd() : -1;
+}
+
+// Like file_read_range, but returns where the bytes are instead of copying
+// them. The snapshot pin becomes a hold so queued sends stay valid.
+int file_map_range(void* instance, void* session, const char* path, uint64_t offset, uint64_t len, BumpArena* arena,
+                   FileExtent** extents, int* count, uint64_t* file_size_out, uint64_t* hold_out) {
+    TraceSpan span("file_map_range");
+    if (!instance || !path || !arena || !extents || !count || !hold_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    SnapshotGuard snap(inst);
+    const OFSInstance::InMemoryFile* f = find_file(*snap.table, path);
+    if (!f || f->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (!check_file_permission(f->owner, caller_of(inst, session))) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    if (file_size_out) *file_size_out = f->size;
+    if (offset > f->size) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    len = std::min(len, f->size - offset);
+    if (!verify_mapped_range(inst, *f, offset, len)) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    map_file_range(inst, *f, offset, len, arena, extents, count);
+    *hold_out = inst->epochs.reader_epoch[snap.slot].load();
+    inst->epochs.hold(*hold_out);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+void file_release_map(void* instance, uint64_t hold) {
+    if (instance && hold) reinterpret_cast<OFSInstance*>(instance)->epochs.release_held(hold);
+}
+
+int file_delete(void* instance, void* session, const char* path) {
+    TraceSpan span("file_delete");
+    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    auto next = clone_table(inst);
+    uint32_t slot = 0;
+    const OFSInstance::InMemoryFile* f = find_file(*next, path, &slot);
+    if (!f) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    // Check permission
+    if (!check_file_permission(f->owner, caller_of(inst, session))) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    if (f->getType() == EntryType::DIRECTORY) {
+        const DirUsage& u = next->usage(slot);
+        if (u.files || u.dirs) return static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+        next->paths = new_path_generation();  // the slot may come back as another directory
+    }
+    std::vector<uint32_t> superseded = f->blocks;
+    std::vector<Fragment> superseded_fragments = fragments_of(*f);
+    std::string_view name = f->name;
+    stage_slot(inst, slot, nullptr);
+    table_remove(*next, slot);
+    publish_table(inst, std::move(next));
+    retire_blocks(inst, std::move(superseded), std::move(superseded_fragments), {name});
+    inst->dirty = true;
+    persist_metadata(inst);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Moves one entry: its slot gets the new parent and name, and everything
+// under a directory follows without being touched. Blocks stay where they
+// are, so this costs the same for a file as for a directory holding 100k.
+int file_rename(void* instance, void* session, const char* old_path, const char* new_path) {
+    TraceSpan span("file_rename");
+    if (!instance || !old_path || !new_path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    auto next = clone_table(inst);
+    uint32_t slot = 0;
+    const OFSInstance::InMemoryFile* f = find_file(*next, old_path, &slot);
+    if (!f) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    Caller caller = caller_of(inst, session);
+    if (!check_file_permission(f->owner, caller)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    uint32_t parent = ROOT_DIR;
+    std::string_view name;
+    int rc = resolve_parent(*next, new_path, parent, name);
+    if (rc != 0) return rc;
+    bool dir = f->getType() == EntryType::DIRECTORY;
+    if (dir) {
+        // A directory moved under itself would be cut off from the root.
+        for (uint32_t p = parent; p != ROOT_DIR; p = next->file(p)->parent)
+            if (p == slot) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    uint32_t target = next->children.find(next->pages, parent, name.data(), name.size());
+    if (target == slot) return static_cast<int>(OFSErrorCodes::SUCCESS);
+
+    std::vector<uint32_t> superseded;
+    std::vector<Fragment> superseded_fragments;
+    std::vector<std::string_view> names = {f->name};
+    if (target != NO_ENTRY) {
+        // A file in the way is replaced, as rename(2) does; anything else stays.
+        const OFSInstance::InMemoryFile* t = next->file(target).get();
+        if (dir || t->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+        if (!check_file_permission(t->owner, caller)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+        superseded = t->blocks;
+        superseded_fragments = fragments_of(*t);
+        names.push_back(t->name);
+        stage_slot(inst, target, nullptr);
+        table_remove(*next, target);
+    }
+    auto imf = std::make_shared<OFSInstance::InMemoryFile>(*f);
+    imf->name = intern_name(inst, name);
+    imf->parent = parent;
+    table_remove(*next, slot);
+    stage_slot(inst, slot, imf);
+    table_put(*next, std::move(imf));
+    if (dir) next->paths = new_path_generation();
+    publish_table(inst, std::move(next));
+    retire_blocks(inst, std::move(superseded), std::move(superseded_fragments), std::move(names));
+    inst->dirty = true;
+    persist_metadata(inst);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_exists(void* instance, void* /*session*/, const char* path) {
+    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    SnapshotGuard snap(inst);  // names of deleted files are reused once unpinned
+    if (find_file(*snap.table, path)) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+int dir_create(void* instance, void* session, const char* path) {
+    TraceSpan span("dir_create");
+    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    auto next = clone_table(inst);
+    uint32_t parent = ROOT_DIR;
+    std::string_view name;
+    int rc = resolve_parent(*next, path, parent, name);
+    if (rc != 0) return rc;
+    if (next->children.find(next->pages, parent, name.data(), name.size()) != NO_ENTRY)
+        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    uint32_t slot = 0;
+    if (!allocate_slot(inst, slot)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    auto imf = std::make_shared<OFSInstance::InMemoryFile>();
+    imf->name = intern_name(inst, name);
+    imf->parent = parent;
+    imf->type = static_cast<uint8_t>(EntryType::DIRECTORY);
+    imf->size = 0;
+    imf->permissions = 0755;
+    imf->created_time = static_cast<uint64_t>(std::time(nullptr));
+    imf->modified_time = imf->created_time;
+    if (session) imf->owner = owner_id(inst, reinterpret_cast<SessionInfo*>(session)->user.username);
+    imf->slot = slot;
+    stage_slot(inst, slot, imf);
+    table_put(*next, std::move(imf));
+    publish_table(inst, std::move(next));
+    inst->dirty = true;
+    persist_metadata(inst);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Removes a directory and, with `recursive`, its whole subtree in one pass:
+// the subtree is found with one sweep over the keys, its totals come off the
+// directories above it in one step, and its blocks and names are retired
+// together.
+int dir_delete(void* instance, void* session, const char* path, int recursive) {
+    TraceSpan span("dir_delete");
+    if (!instance || !path) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    auto next = clone_table(inst);
+    uint32_t slot = 0;
+    const OFSInstance::InMemoryFile* d = find_file(*next, path, &slot);
+    if (!d) {
+        if (resolve(*next, path) == ROOT_DIR) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    if (d->getType() != EntryType::DIRECTORY) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    Caller caller = caller_of(inst, session);
+    if (!check_file_permission(d->owner, caller)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    DirUsage u = usage_of(*next, *d);  // counts `d` itself as one dir
+    if ((u.files || u.dirs > 1) && !recursive) return static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+
+    // below[s]: 1 inside the subtree, 2 outside, 0 not known yet. Each slot
+    // walks up only until it meets a known one, so the sweep is linear.
+    const size_t n = next->size();
+    std::vector<uint8_t> below(n, 0);
+    std::vector<uint32_t> doomed = {slot};
+    std::vector<uint32_t> chain;
+    below[slot] = 1;
+    for (uint32_t s = 0; s < n && doomed.size() < u.files + u.dirs; ++s) {
+        if (!next->key(s).name || below[s]) continue;
+        uint32_t p = s;
+        chain.clear();
+        while (p != ROOT_DIR && !below[p]) {
+            chain.push_back(p);
+            p = next->key(p).parent;
+        }
+        uint8_t v = p == ROOT_DIR ? 2 : below[p];
+        for (uint32_t c : chain) {
+            below[c] = v;
+            if (v == 1) doomed.push_back(c);
+        }
+    }
+    if (!caller.admin)
+        for (uint32_t s : doomed)
+            if (!check_file_permission(next->key(s).owner, caller)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+
+    charge(*next, d->parent, u, false);
+    std::vector<uint32_t> superseded;
+    std::vector<Fragment> superseded_fragments;
+    std::vector<std::string_view> names;
+    for (uint32_t s : doomed) {
+        const OFSInstance::InMemoryFile& f = *next->file(s);
+        superseded.insert(superseded.end(), f.blocks.begin(), f.blocks.end());
+        if (f.fragment.units) superseded_fragments.push_back(f.fragment);
+        names.push_back(f.name);
+        stage_slot(inst, s, nullptr);
+        next->children.erase(next->pages, s);
+        next->edit_key(s) = {};
+        next->edit_file(s).reset();
+        next->edit_usage(s) = {};
+        next->renamed.push_back(s);
+    }
+    next->paths = new_path_generation();
+    publish_table(inst, std::move(next));
+    retire_blocks(inst, std::move(superseded), std::move(superseded_fragments), std::move(names));
+    inst->dirty = true;
+    persist_metadata(inst);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Reads the totals table_put and table_remove keep: O(1) for any directory.
+// The root's are for admins; a directory's for its owner.
+int dir_usage(void* instance, void* session, const char* path, DirUsage* usage) {
+    if (!instance || !path || !usage) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    SnapshotGuard snap(inst);
+    const OFSInstance::FileTable& table = *snap.table;
+    Caller caller = caller_of(inst, session);
+    uint32_t dir = resolve(table, path);
+    if (!is_dir(table, dir)) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (dir == ROOT_DIR ? !caller.admin : !check_file_permission(table.key(dir).owner, caller))
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    *usage = dir == ROOT_DIR ? table.root_usage : table.usage(dir);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Calls emit(FileEntry) for each immediate child of `path` the session may see.
+template <typename Emit>
+static void scan_dir(OFSInstance* inst, void* session, const char* path, Emit emit) {
+    SnapshotGuard snap(inst);  // names of deleted files are reused once unpinned
+    const OFSInstance::FileTable& table = *snap.table;
+    Caller caller = caller_of(inst, session);
+    uint32_t dir = resolve(table, path);
+    if (!is_dir(table, dir)) return;
+    const std::string& prefix = dir_path(table, dir);  // no other dir_path call while in use
+    // Only the keys are scanned, a page at a time; entries are built for the matches.
+    const OFSInstance::TablePage* page = nullptr;
+    for (uint32_t s = 0; s < table.size(); ++s) {
+        uint32_t i = s % OFSInstance::TABLE_PAGE_SLOTS;
+        if (i == 0) page = table.pages[s / OFSInstance::TABLE_PAGE_SLOTS].get();
+        const OFSInstance::FileKey& k = page->keys[i];
+        // Only show files the user owns (or all if admin)
+        if (k.parent == dir && k.name && check_file_permission(k.owner, caller)) emit(entry_of(inst, *page->files[i], &prefix));
+    }
+}
+
+int dir_list(void* instance, void* session, const char* path, FileEntry** entries, int* count) {
+    TraceSpan span("dir_list");
+    if (!instance || !path || !entries || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::vector<FileEntry> found;
+    scan_dir(inst, session, path, [&](const FileEntry& e) { found.push_back(e); });
+    *count = (int)found.size();
+    if (found.empty()) { *entries = nullptr; return static_cast<int>(OFSErrorCodes::SUCCESS); }
+    FileEntry* out = new FileEntry[found.size()];
+    for (size_t i = 0; i < found.size(); ++i) out[i] = found[i];
+    *entries = out;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_list_arena(void* instance, void* session, const char* path, BumpArena* arena, FileEntry** entries, int* count) {
+    TraceSpan span("dir_list");
+    if (!instance || !path || !arena || !entries || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    FileEntry* out = nullptr;
+    size_t n = 0, cap = 0;
+    scan_dir(inst, session, path, [&](const FileEntry& e) {
+        if (n == cap) {
+            size_t grown = cap ? cap * 2 : 16;
+            out = arena->grow(out, n, grown);
+            cap = grown;
+        }
+        out[n++] = e;
+    });
+    *count = (int)n;
+    *entries = n ? out : nullptr;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Calls emit(FileEntry) for up to `limit` entries (0: all) the session may
+// see whose names match. The index's candidate slots refer to the table
+// loaded under the same shared lock. Patterns it cannot narrow (no three-byte
+// literal) check every name, and so does a batch's own thread, since the
+// index only has published names.
+template <typename Emit>
+static int search_names(OFSInstance* inst, void* session, const char* pattern, int glob, int limit, Emit emit) {
+    NamePattern q(pattern, glob != 0);
+    if (q.empty()) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    std::shared_lock<std::shared_mutex> lk(inst->search_mutex);
+    SnapshotGuard snap(inst);  // names of deleted files are reused once unpinned
+    const OFSInstance::FileTable& table = *snap.table;
+    std::vector<uint32_t> slots;
+    bool indexed = !in_batch(inst) && inst->name_index.candidates(q.trigrams(), slots);
+    lk.unlock();
+    Caller caller = caller_of(inst, session);
+    size_t found = 0;
+    auto check = [&](uint32_t s) {
+        const OFSInstance::FileKey& k = table.key(s);
+        if (!k.name || !check_file_permission(k.owner, caller) || !q.matches(std::string_view(k.name, k.name_len))) return true;
+        emit(entry_of(inst, *table.file(s), &dir_path(table, k.parent)));
+        return limit <= 0 || ++found < (size_t)limit;
+    };
+    if (indexed) {
+        for (uint32_t s : slots)
+            if (!check(s)) break;
+    } else {
+        for (uint32_t s = 0; s < table.size(); ++s)
+            if (!check(s)) break;
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_search(void* instance, void* session, const char* pattern, int glob, int limit, FileEntry** entries, int* count) {
+    TraceSpan span("file_search");
+    if (!instance || !pattern || !entries || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::vector<FileEntry> found;
+    int rc = search_names(inst, session, pattern, glob, limit, [&](const FileEntry& e) { found.push_back(e); });
+    *count = (int)found.size();
+    *entries = nullptr;
+    if (found.empty()) return rc;
+    FileEntry* out = new FileEntry[found.size()];
+    for (size_t i = 0; i < found.size(); ++i) out[i] = found[i];
+    *entries = out;
+    return rc;
+}
+
+int file_search_arena(void* instance, void* session, const char* pattern, int glob, int limit, BumpArena* arena,
+                      FileEntry** entries, int* count) {
+    TraceSpan span("file_search");
+    if (!instance || !pattern || !arena || !entries || !count) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    FileEntry* out = nullptr;
+    size_t n = 0, cap = 0;
+    int rc = search_names(inst, session, pattern, glob, limit, [&](const FileEntry& e) {
+        if (n == cap) {
+            size_t grown = cap ? cap * 2 : 16;
+            out = arena->grow(out, n, grown);
+            cap = grown;
+        }
+        out[n++] = e;
+    });
+    *count = (int)n;
+    *entries = n ? out : nullptr;
+    return rc;
+}
+
+// Opens a batch on the calling thread: it holds write_mutex until
+// fs_batch_end, so the batch's writes are neither interleaved with nor
+// visible to anyone else before they are published together.
+int fs_batch_begin(void* instance) {
+    if (!instance) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    inst->write_mutex.lock();
+    if (in_batch(inst)) {
+        inst->write_mutex.unlock();
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    auto cur = std::atomic_load(&inst->table);
+    inst->batch.staged = std::make_shared<OFSInstance::FileTable>(*cur);
+    inst->batch.staged->version = cur->version + 1;
+    inst->batch.staged->paths = new_path_generation();  // dropped with the batch if it is discarded
+    inst->batch.free_map = inst->free_map;
+    inst->batch.free_slots = inst->free_slots;
+    inst->batch.fragment_blocks = inst->fragment_blocks;
+    inst->batch.retired.clear();
+    inst->batch.retired_fragments.clear();
+    inst->batch.retired_names.clear();
+    inst->batch.new_names.clear();
+    inst->batch.owner.store(std::this_thread::get_id());
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// commit != 0 publishes the staged table and persists metadata once.
+// commit == 0 drops it; blocks allocated by the batch were never visible to
+// readers, so restoring the free map releases them immediately.
+int fs_batch_end(void* instance, int commit) {
+    TraceSpan span("fs_batch_end");
+    if (!instance) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    if (!in_batch(inst)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    inst->batch.owner.store(std::thread::id());
+    auto staged = std::move(inst->batch.staged);
+    std::vector<uint32_t> retired = std::move(inst->batch.retired);
+    std::vector<Fragment> retired_fragments = std::move(inst->batch.retired_fragments);
+    std::vector<std::string_view> retired_names = std::move(inst->batch.retired_names);
+    std::vector<std::string_view> new_names = std::move(inst->batch.new_names);
+    inst->batch.retired.clear();
+    inst->batch.retired_fragments.clear();
+    inst->batch.retired_names.clear();
+    inst->batch.new_names.clear();
+    if (commit) {
+        publish_table(inst, std::move(staged));
+        retire_blocks(inst, std::move(retired), std::move(retired_fragments), std::move(retired_names));
+        persist_metadata(inst);
+    } else {
+        // Names interned by the batch were never published.
+        for (std::string_view n : new_names) inst->names.release(n);
+        // free_map_dirty keeps the entries the batch touched; the next
+        // persist writes their restored values, which match the disk anyway.
+        inst->free_map.swap(inst->batch.free_map);
+        inst->free_slots.swap(inst->batch.free_slots);
+        inst->fragment_blocks.swap(inst->batch.fragment_blocks);
+        inst->pending_slots.clear();
+    }
+    inst->batch.free_map.clear();
+    inst->batch.free_slots.clear();
+    inst->batch.fragment_blocks.clear();
+    inst->write_mutex.unlock();
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// ---------------------------------------------------------------------------
+// Chunked transfers. An upload writes each chunk straight into freshly
+// allocated blocks; only a partial trailing block (< block_size) is buffered.
+// Commit stores that tail the way file_create does and publishes the result
+// as a new file version in one step; abort frees the blocks. A download pins
+// the version that was current at open, so reads at any offset stay
+// consistent while writers keep publishing.
+// ---------------------------------------------------------------------------
+
+static const uint64_t TRANSFER_IDLE_SECS = 600;
+
+static bool session_owns_transfer(void* session, const std::string& owner) {
+    if (!session) return owner.empty();
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    return owner == s->user.username;
+}
+
+static void release_download(OFSInstance* inst, OFSInstance::Download& d) {
+    inst->epochs.release_held(d.epoch);
+    d.file.reset();
+}
+
+// Drops transfers nobody touched for TRANSFER_IDLE_SECS. Caller holds
+// transfer_mutex. Idle uploads are reaped only when `blocks` is given: their
+// blocks are moved there for the caller to free under write_mutex once
+// transfer_mutex is released, so this never waits for the writer (a batch may
+// take transfer_mutex while holding write_mutex). Download opens, which run
+// beside the writer, leave uploads to the next upload_open.
+static void reap_idle_transfers(OFSInstance* inst, uint64_t now, std::vector<uint32_t>* blocks) {
+    for (auto it = inst->uploads.begin(); blocks && it != inst->uploads.end();) {
+        if (now - it->second.last_used > TRANSFER_IDLE_SECS) {
+            blocks->insert(blocks->end(), it->second.blocks.begin(), it->second.blocks.end());
+            it = inst->uploads.erase(it);
+        } else ++it;
+    }
+    for (auto it = inst->downloads.begin(); it != inst->downloads.end();) {
+        if (now - it->second.last_used > TRANSFER_IDLE_SECS) {
+            release_download(inst, it->second);
+            it = inst->downloads.erase(it);
+        } else ++it;
+    }
+}
+
+int file_upload_open(void* instance, void* session, const char* path, uint64_t* handle_out) {
+    if (!instance || !path || !handle_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    {
+        SnapshotGuard snap(inst);
+        int rc = check_create_target(inst, *snap.table, path, session);
+        if (rc != 0) return rc;
+    }
+    uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    std::vector<uint32_t> reaped;
+    {
+        std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+        reap_idle_transfers(inst, now, &reaped);
+        uint64_t h = inst->next_transfer_id++;
+        OFSInstance::Upload& up = inst->uploads[h];
+        up.path = path;
+        if (session) up.owner = reinterpret_cast<SessionInfo*>(session)->user.username;
+        up.last_used = now;
+        *handle_out = h;
+    }
+    if (!reaped.empty()) {
+        std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+        free_blocks(inst, reaped);
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Appends a chunk at `offset`, which must equal the bytes received so far.
+// *size_out (optional) reports that count, so a client that lost a reply can
+// resume from the right offset.
+int file_upload_write(void* instance, void* session, uint64_t handle, uint64_t offset, const char* data, size_t size, uint64_t* size_out) {
+    TraceSpan span("file_upload_write");
+    if (!instance || (size > 0 && !data)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+    auto it = inst->uploads.find(handle);
+    if (it == inst->uploads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    OFSInstance::Upload& up = it->second;
+    if (!session_owns_transfer(session, up.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    if (size_out) *size_out = up.size;
+    if (offset != up.size) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    up.last_used = static_cast<uint64_t>(std::time(nullptr));
+
+    // A chunk is taken whole or not at all: every full block it completes is
+    // allocated up front, and on a failure the tail goes back to its length on
+    // entry and the blocks are freed. The client retries at the same offset.
+    size_t bs = (size_t)inst->block_size;
+    size_t tail0 = up.tail.size();
+    size_t nblocks = (tail0 + size) / bs;
+    const char* p = data;
+    size_t left = size;
+    if (nblocks > 0) {
+        std::vector<uint32_t> nb;
+        std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+        if (!allocate_blocks(inst, nblocks, nb)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        size_t done = 0;
+        bool ok = true;
+        // Top up a buffered partial block first.
+        if (tail0 > 0) {
+            size_t take = bs - tail0;
+            up.tail.insert(up.tail.end(), p, p + take);
+            ok = write_blocks(inst, nb.data(), 1, up.tail.data(), bs);
+            up.tail.resize(tail0);
+            p += take; left -= take;
+            done = 1;
+        }
+        // Whole blocks go straight from the caller's buffer to disk.
+        if (ok && done < nblocks) ok = write_blocks(inst, nb.data() + done, nblocks - done, p, (nblocks - done) * bs);
+        if (!ok) {
+            free_blocks(inst, nb);
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        p += (nblocks - done) * bs; left -= (nblocks - done) * bs;
+        up.blocks.insert(up.blocks.end(), nb.begin(), nb.end());
+        up.tail.clear();
+    }
+    if (left > 0) {
+        up.tail.reserve(bs);
+        up.tail.insert(up.tail.end(), p, p + left);
+    }
+    up.size += size;
+    if (size_out) *size_out = up.size;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_upload_commit(void* instance, void* session, uint64_t handle) {
+    TraceSpan span("file_upload_commit");
+    if (!instance) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+    auto it = inst->uploads.find(handle);
+    if (it == inst->uploads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    OFSInstance::Upload& up = it->second;
+    if (!session_owns_transfer(session, up.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+    FileExtents ext;
+    ext.blocks.swap(up.blocks);
+    int rc = write_tail(inst, up.tail.data(), up.tail.size(), ext);
+    if (rc != 0) {
+        up.blocks.swap(ext.blocks);
+        return rc;
+    }
+    std::string path = std::move(up.path);
+    uint64_t size = up.size;
+    inst->uploads.erase(it);
+    return publish_file_version(inst, session, path.c_str(), std::move(ext), size);
+}
+
+int file_upload_abort(void* instance, void* session, uint64_t handle) {
+    if (!instance) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+    auto it = inst->uploads.find(handle);
+    if (it == inst->uploads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (!session_owns_transfer(session, it->second.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    {
+        std::lock_guard<std::recursive_mutex> wl(inst->write_mutex);
+        free_blocks(inst, it->second.blocks);
+    }
+    inst->uploads.erase(it);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_download_open(void* instance, void* session, const char* path, uint64_t* handle_out, uint64_t* size_out) {
+    if (!instance || !path || !handle_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    OFSInstance::Download d;
+    {
+        // Convert the short snapshot pin into a long-lived hold before unpinning.
+        SnapshotGuard snap(inst);
+        uint32_t idx = 0;
+        const OFSInstance::InMemoryFile* f = find_file(*snap.table, path, &idx);
+        if (!f || f->getType() != EntryType::FILE) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        if (!check_file_permission(f->owner, caller_of(inst, session))) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+        d.file = snap.table->file(idx);
+        d.epoch = inst->epochs.reader_epoch[snap.slot].load();
+        inst->epochs.hold(d.epoch);
+    }
+    if (session) d.owner = reinterpret_cast<SessionInfo*>(session)->user.username;
+    uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    d.last_used = now;
+    if (size_out) *size_out = d.file->size;
+    std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+    reap_idle_transfers(inst, now, nullptr);
+    uint64_t h = inst->next_transfer_id++;
+    inst->downloads[h] = std::move(d);
+    *handle_out = h;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_download_read(void* instance, void* session, uint64_t handle, uint64_t offset, char* buffer, size_t len, size_t* read_out) {
+    TraceSpan span("file_download_read");
+    if (!instance || !read_out || (len > 0 && !buffer)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::shared_ptr<const OFSInstance::InMemoryFile> file;
+    {
+        std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+        auto it = inst->downloads.find(handle);
+        if (it == inst->downloads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        if (!session_owns_transfer(session, it->second.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+        it->second.last_used = static_cast<uint64_t>(std::time(nullptr));
+        file = it->second.file;
+    }
+    // The hold taken at open keeps these blocks allocated until close.
+    *read_out = 0;
+    uint64_t size = file->size;
+    if (offset > size) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    size_t n = (size_t)std::min<uint64_t>(len, size - offset);
+    if (!read_file_range(inst, *file, offset, buffer, n)) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    *read_out = n;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// The returned hold is separate from the download's, so a close while the
+// extents are still being sent does not free their blocks.
+int file_download_map(void* instance, void* session, uint64_t handle, uint64_t offset, uint64_t len, BumpArena* arena,
+                      FileExtent** extents, int* count, uint64_t* hold_out) {
+    TraceSpan span("file_download_map");
+    if (!instance || !arena || !extents || !count || !hold_out) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::shared_ptr<const OFSInstance::InMemoryFile> file;
+    uint64_t epoch = 0;
+    {
+        std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+        auto it = inst->downloads.find(handle);
+        if (it == inst->downloads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        if (!session_owns_transfer(session, it->second.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+        it->second.last_used = static_cast<uint64_t>(std::time(nullptr));
+        file = it->second.file;
+        epoch = it->second.epoch;
+        if (offset <= file->size) inst->epochs.hold(epoch);
+    }
+    if (offset > file->size) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    len = std::min(len, file->size - offset);
+    if (!verify_mapped_range(inst, *file, offset, len)) {
+        inst->epochs.release_held(epoch);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    map_file_range(inst, *file, offset, len, arena, extents, count);
+    *hold_out = epoch;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_download_close(void* instance, void* session, uint64_t handle) {
+    if (!instance) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    std::lock_guard<std::mutex> tl(inst->transfer_mutex);
+    auto it = inst->downloads.find(handle);
+    if (it == inst->downloads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (!session_owns_transfer(session, it->second.owner)) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    release_download(inst, it->second);
+    inst->downloads.erase(it);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// ---------------------------------------------------------------------------
+// Scrubbing. A pass first checks, under write_mutex and without I/O, that
+// every block held by a published version, a retired version or an upload is
+// in range, held once and marked in the free map with the right kind, and
+// that the free map marks nothing else. Worker threads then read every block
+// and fragment tail of the published versions and compare them with their
+// checksums. A version is read only while still published under the
+// worker's pin, so its blocks cannot be reused mid-read; versions replaced
+// since the map check are skipped and left to the next pass.
+// ---------------------------------------------------------------------------
+
+static const uint64_t SCRUB_ITEM_BYTES = 1 << 20;  // blocks read per work item
+
+// A run of a version's blocks, or (count == 0) its fragment tail.
+struct ScrubItem {
+    std::shared_ptr<const OFSInstance::InMemoryFile> file;
+    uint32_t first;
+    uint32_t count;
+};
+
+// Serializes calls to the caller's report function.
+struct ScrubLog {
+    const ScrubOptions& opts;
+    std::mutex mutex;
+    explicit ScrubLog(const ScrubOptions& o) : opts(o) {}
+    void operator()(const std::string& problem) {
+        if (!opts.report) return;
+        std::lock_guard<std::mutex> lg(mutex);
+        opts.report(opts.ctx, problem.c_str());
+    }
+};
+
+// The map half of a pass; see above. Caller holds transfer_mutex and
+// write_mutex. With `repair`, damaged slots are cleared, references marked
+// free or with the wrong kind are marked again and leaked blocks (including
+// those of the cleared slots) freed.
+static void scrub_maps(OFSInstance* inst, const OFSInstance::FileTable& table, bool repair, ScrubLog& log, ScrubReport& r) {
+    r.damaged_slots = inst->damaged_slots.size();
+    for (uint32_t slot : inst->damaged_slots) {
+        log("file slot " + std::to_string(slot) + " failed its checksum at startup");
+        if (repair) {
+            stage_slot(inst, slot, nullptr);
+            ++r.repaired;
+        }
+    }
+    if (repair) inst->damaged_slots.clear();
+
+    // What each block should be marked: 0 free, 1 used or FREE_MAP_FRAGMENTS.
+    std::vector<uint8_t> want(inst->free_map.size(), 0);
+    std::map<uint32_t, std::vector<uint8_t>> units;  // fragment block -> units taken
+    // `who` names the holder, built only for a report.
+    auto use_block = [&](uint32_t b, const auto& who) {
+        if (b < want.size() && want[b] == 0) {
+            want[b] = 1;
+            return;
+        }
+        ++r.map_errors;
+        log(who() + ": block " + std::to_string(b) + (b < want.size() ? " is also used elsewhere" : " is out of range"));
+    };
+    auto use_fragment = [&](const Fragment& f, const auto& who) {
+        if (f.units == 0) return;
+        const char* problem = nullptr;
+        if (f.block >= want.size() || f.unit + f.units > units_per_block(inst)) problem = " is out of range";
+        else if (want[f.block] == 1) problem = " is also used as a whole block";
+        if (!problem) {
+            want[f.block] = FREE_MAP_FRAGMENTS;
+            std::vector<uint8_t>& u = units[f.block];
+            u.resize(units_per_block(inst));
+            for (uint32_t i = f.unit; i < f.unit + f.units && !problem; ++i) {
+                if (u[i]) problem = " overlaps another tail";
+                u[i] = 1;
+            }
+            if (!problem) return;
+        }
+        ++r.map_errors;
+        log(who() + ": tail in fragment block " + std::to_string(f.block) + problem);
+    };
+    for (uint32_t s = 0; s < table.size(); ++s) {
+        const auto& f = table.file(s);
+        if (!f) continue;
+        auto path = [&] { return path_of(table, *f); };
+        for (uint32_t b : f->blocks) use_block(b, path);
+        use_fragment(f->fragment, path);
+    }
+    auto retired = [] { return std::string("retired version"); };
+    for (const auto& ret : inst->epochs.retired) {
+        for (uint32_t b : ret.blocks) use_block(b, retired);
+        for (const Fragment& f : ret.fragments) use_fragment(f, retired);
+    }
+    for (const auto& kv : inst->uploads)
+        for (uint32_t b : kv.second.blocks) use_block(b, [&] { return "upload to " + kv.second.path; });
+
+    // Reported per run of neighbouring blocks with the same problem.
+    auto problem_of = [&](size_t b) {
+        if (inst->free_map[b] == want[b]) return 0;
+        if (want[b] == 0) return 1;
+        return inst->free_map[b] == 0 ? 2 : 3;
+    };
+    static const char* const problems[] = {"", " marked used but referenced by nothing", " in use but marked free",
+                                           " marked with the wrong kind"};
+    for (size_t b = 0; b < want.size();) {
+        int p = problem_of(b);
+        size_t end = b + 1;
+        while (p != 0 && end < want.size() && problem_of(end) == p) ++end;
+        if (p != 0) {
+            if (p == 1) r.leaked_blocks += end - b;
+            else r.map_errors += end - b;
+            log((end - b == 1 ? "block " + std::to_string(b) : "blocks " + std::to_string(b) + "-" + std::to_string(end - 1)) + problems[p]);
+        }
+        for (; repair && p != 0 && b < end; ++b) {
+            set_free_map(inst, (uint32_t)b, want[b]);
+            if (want[b] != FREE_MAP_FRAGMENTS) inst->fragment_blocks.erase((uint32_t)b);
+            ++r.repaired;
+        }
+        b = end;
+    }
+    if (r.repaired) {
+        inst->dirty = true;
+        persist_metadata(inst);
+    }
+}
+
+static bool still_published(const OFSInstance::FileTable& table, const OFSInstance::InMemoryFile* f) {
+    return f->slot < table.size() && table.file(f->slot).get() == f;
+}
+
+// Holds readers sharing `next_ns` to `rate` bytes per second: a read of
+// `bytes` takes the next slot on the schedule and waits for it. False once
+// `stop` is raised.
+static bool scrub_pace(std::atomic<uint64_t>& next_ns, uint64_t rate, uint64_t bytes, const std::atomic<bool>* stop) {
+    if (rate > 0) {
+        uint64_t cost = (uint64_t)((double)bytes * 1e9 / (double)rate);
+        uint64_t now = metrics_now_ns();
+        uint64_t at = next_ns.load();
+        while (!next_ns.compare_exchange_weak(at, std::max(at, now) + cost)) {}
+        at = std::max(at, now);
+        for (uint64_t t; (t = metrics_now_ns()) < at && !(stop && stop->load());)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<uint64_t>(at - t, 100000000)));
+    }
+    return !(stop && stop->load());
+}
+
+static int run_scrub(OFSInstance* inst, const ScrubOptions& opts, ScrubReport& r, const std::atomic<bool>* stop) {
+    TraceSpan span("scrub");
+    if (in_batch(inst)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    r = ScrubReport{};
+    auto t0 = std::chrono::steady_clock::now();
+    ScrubLog log(opts);
+    const uint64_t bs = inst->block_size;
+    const uint32_t per_item = (uint32_t)std::max<uint64_t>(1, SCRUB_ITEM_BYTES / bs);
+    std::shared_ptr<const OFSInstance::FileTable> table;
+    std::vector<ScrubItem> items;
+    {
+        // transfer_mutex comes first, but a batch holds write_mutex for its
+        // whole length and may take transfer_mutex inside it: back off
+        // instead of waiting for write_mutex while holding transfer_mutex.
+        std::unique_lock<std::mutex> tl(inst->transfer_mutex);
+        while (!inst->write_mutex.try_lock()) {
+            tl.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            tl.lock();
+        }
+        std::lock_guard<std::recursive_mutex> wl(inst->write_mutex, std::adopt_lock);
+        table = std::atomic_load(&inst->table);
+        scrub_maps(inst, *table, opts.repair != 0, log, r);
+        r.checksums = has_checksums(inst) ? 1 : 0;
+        for (uint32_t s = 0; s < table->size(); ++s) {
+            const auto& f = table->file(s);
+            if (!f || !r.checksums || (f->blocks.empty() && f->fragment.units == 0)) continue;
+            ++r.files;
+            for (size_t i = 0; i < f->blocks.size(); i += per_item)
+                items.push_back({f, (uint32_t)i, (uint32_t)std::min<size_t>(per_item, f->blocks.size() - i)});
+            if (f->fragment.units) items.push_back({f, 0, 0});
+        }
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> next_ns{0};
+    std::atomic<uint64_t> blocks{0}, bytes{0}, skipped{0}, checksum_errors{0}, read_errors{0};
+    auto worker = [&]() {
+        std::vector<char> buf((size_t)(per_item * bs));
+        std::vector<IoRequest> reqs;
+        for (size_t i; !(stop && stop->load()) && (i = next.fetch_add(1)) < items.size();) {
+            const ScrubItem& it = items[i];
+            const OFSInstance::InMemoryFile& f = *it.file;
+            uint64_t in_blocks = (uint64_t)f.blocks.size() * bs;
+            uint64_t start = it.count ? it.first * bs : in_blocks;
+            uint64_t end = it.count ? std::min((it.first + it.count) * bs, f.size) : f.size;
+            if (end <= start) continue;
+            if (!scrub_pace(next_ns, opts.bytes_per_sec, end - start, stop)) break;
+            // Report against this snapshot: by now the pass's table may name a
+            // recycled slot, but f is confirmed published in snap.table.
+            SnapshotGuard snap(inst);
+            if (snap.table->version != table->version && !still_published(*snap.table, &f)) {
+                skipped.fetch_add(it.count ? it.count : 1);
+                continue;
+            }
+            reqs.clear();
+            if (it.count) {
+                for (uint32_t k = 0; k < it.count; ++k) {
+                    uint64_t off = inst->content_offset + (uint64_t)f.blocks[it.first + k] * bs;
+                    size_t n = (size_t)std::min<uint64_t>(bs, end - (it.first + k) * bs);
+                    if (!reqs.empty() && reqs.back().offset + reqs.back().len == off) reqs.back().len += n;
+                    else reqs.push_back({off, buf.data() + k * bs, n});
+                }
+            } else {
+                reqs.push_back({inst->content_offset + (uint64_t)f.fragment.block * bs + (uint64_t)f.fragment.unit * FRAGMENT_SIZE,
+                                buf.data(), (size_t)(end - start)});
+            }
+            if (!inst->io.read(reqs.data(), reqs.size())) {
+                read_errors.fetch_add(1);
+                log(path_of(*snap.table, f) + ": read failed at byte " + std::to_string(start));
+                continue;
+            }
+            bytes.fetch_add(end - start);
+            g_core_metrics.scrub_bytes.fetch_add(end - start, std::memory_order_relaxed);
+            auto bad = [&](const std::string& what) {
+                checksum_errors.fetch_add(1);
+                g_core_metrics.checksum_errors.fetch_add(1, std::memory_order_relaxed);
+                log(path_of(*snap.table, f) + ": " + what + " fails its checksum");
+            };
+            if (it.count) {
+                for (uint32_t k = 0; k < it.count; ++k) {
+                    uint32_t b = f.blocks[it.first + k];
+                    size_t n = (size_t)std::min<uint64_t>(bs, end - (it.first + k) * bs);
+                    if (crc32c(buf.data() + k * bs, n) != inst->block_crc[b])
+                        bad("block " + std::to_string(it.first + k) + " (container block " + std::to_string(b) + ")");
+                }
+                blocks.fetch_add(it.count);
+            } else {
+                if (crc32c(buf.data(), (size_t)(end - start)) != f.tail_crc)
+                    bad("tail (fragment block " + std::to_string(f.fragment.block) + ")");
+                blocks.fetch_add(1);
+            }
+        }
+    };
+    size_t threads = opts.threads > 0 ? (size_t)opts.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, items.size());
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+    if (threads > 0) worker();
+    for (auto& t : pool) t.join();
+
+    r.blocks = blocks.load();
+    r.bytes = bytes.load();
+    r.skipped = skipped.load();
+    r.checksum_errors = checksum_errors.load();
+    r.read_errors = read_errors.load();
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (!(stop && stop->load())) g_core_metrics.scrub_passes.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int fs_scrub(void* instance, const ScrubOptions* options, ScrubReport* report) {
+    if (!instance || !report) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    ScrubOptions opts = options ? *options : ScrubOptions{};
+    return run_scrub(reinterpret_cast<OFSInstance*>(instance), opts, *report, nullptr);
+}
+
+// The first pass starts one interval after the call, not at startup.
+int fs_scrubber_start(void* instance, const ScrubOptions* options, uint64_t interval_secs) {
+    if (!instance || !options || interval_secs == 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance* inst = reinterpret_cast<OFSInstance*>(instance);
+    OFSInstance::Scrubber& s = inst->scrubber;
+    if (s.thread.joinable()) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    s.stop.store(false);
+    ScrubOptions opts = *options;
+    opts.repair = 0;
+    s.thread = std::thread([inst, opts, interval_secs]() {
+        OFSInstance::Scrubber& s = inst->scrubber;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(s.mutex);
+                if (s.cv.wait_for(lk, std::chrono::seconds(interval_secs), [&] { return s.stop.load(); })) return;
+            }
+            ScrubReport r;
+            if (run_scrub(inst, opts, r, &s.stop) != 0 || s.stop.load()) continue;
+            std::lock_guard<std::mutex> lk(s.mutex);
+            s.last = r;
+            ++s.passes;
+        }
+    });
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+void fs_scrubber_stop(void* instance) {
+    if (!instance) return;
+    OFSInstance::Scrubber& s = reinterpret_cast<OFSInstance*>(instance)->scrubber;
+    if (!s.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(s.mutex);
+        s.stop.store(true);
+    }
+    s.cv.notify_all();
+    s.thread.join();
+}
+
+int fs_scrub_status(void* instance, ScrubReport* last, uint64_t* passes) {
+    if (!instance || !last) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSInstance::Scrubber& s = reinterpret_cast<OFSInstance*>(instance)->scrubber;
+    std::lock_guard<std::mutex> lk(s.mutex);
+    *last = s.last;
+    if (passes) *passes = s.passes;
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
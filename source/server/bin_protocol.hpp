@@ -0,0 +1,67 @@
+#ifndef BIN_PROTOCOL_HPP
+#define BIN_PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Length-prefixed binary framing, served on the same port as JSON lines and
+// HTTP (detected from the magic). Every frame, in both directions, is
+//
+//   BinHeader (32 bytes) | meta (meta_len bytes) | payload (payload_len bytes)
+//
+// `meta` is a small JSON object carrying the request parameters (token,
+// path, ...) or, in a response, the JSON result; `payload` is raw file bytes,
+// never escaped. All integers are little-endian.
+
+static const char BIN_MAGIC[4] = {'O', 'F', 'B', '1'};
+// Largest request payload: one upload chunk (or a FILE_WRITE of that size).
+// Bigger files go through UPLOAD_CHUNK, so no request needs more memory.
+static const uint64_t BIN_MAX_PAYLOAD = 16u << 20;
+static const uint32_t BIN_MAX_META = 64 * 1024;
+
+// Response statuses the server itself produces, outside the OFSErrorCodes range.
+static const int16_t BIN_STATUS_BUSY = -100;       // queue full, request not admitted
+static const int16_t BIN_STATUS_TIMEOUT = -101;    // waited past the queue deadline, not executed
+static const int16_t BIN_STATUS_TOO_LARGE = -102;  // frame over BIN_MAX_META / BIN_MAX_PAYLOAD; connection closed
+
+enum class BinOpcode : uint8_t {
+    PING = 1,
+    FILE_WRITE = 2,  // meta: token, path        payload: file contents
+    FILE_READ = 3,   // meta: token, path        response payload: file contents
+    JSON = 4,        // meta: any JSON request   response meta: JSON response
+    UPLOAD_CHUNK = 5,   // meta: token, handle, offset           payload: chunk; response meta: size
+    DOWNLOAD_CHUNK = 6, // meta: token, handle, offset, length   response payload: chunk (empty at eof)
+};
+
+#pragma pack(push, 1)
+struct BinHeader {
+    char magic[4];
+    uint8_t opcode;        // BinOpcode
+    uint8_t flags;         // reserved, 0
+    int16_t status;        // response: OFSErrorCodes value (0 = success)
+    uint32_t request_id;   // echoed back in the response
+    uint32_t meta_len;
+    uint64_t payload_len;
+    uint64_t reserved;
+};
+#pragma pack(pop)
+static_assert(sizeof(BinHeader) == 32, "BinHeader must stay 32 bytes");
+
+inline BinHeader make_bin_header(BinOpcode op, uint32_t request_id, uint32_t meta_len, uint64_t payload_len, int16_t status = 0) {
+    BinHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, BIN_MAGIC, sizeof(h.magic));
+    h.opcode = static_cast<uint8_t>(op);
+    h.status = status;
+    h.request_id = request_id;
+    h.meta_len = meta_len;
+    h.payload_len = payload_len;
+    return h;
+}
+
+inline void append_bin_header(std::string& out, const BinHeader& h) {
+    out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+#endif // BIN_PROTOCOL_HPP
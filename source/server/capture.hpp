@@ -0,0 +1,118 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Request capture file, written by the server (FILEVERSE_CAPTURE) and read by
+// tools/fs_replay:
+//
+//   CaptureFileHeader | CaptureRecord | body | CaptureRecord | body | ...
+//
+// One record per framed request, in arrival order across all connections.
+// `body` is exactly what the worker would parse: the JSON line, the HTTP
+// body, or the whole binary frame. Tokens, passwords and file contents are
+// stored as sent, so treat a capture like the .omni image itself.
+
+static const char CAPTURE_MAGIC[8] = {'O', 'F', 'S', 'C', 'A', 'P', '1', '\n'};
+
+enum class CaptureProto : uint8_t { JSON_LINES = 0, HTTP = 1, BINARY = 2 };
+
+#pragma pack(push, 1)
+struct CaptureFileHeader {
+    char magic[8];
+    uint64_t started_unix_ns;  // wall clock when the capture was opened
+};
+
+struct CaptureRecord {
+    uint64_t offset_ns;  // arrival time since the capture was opened
+    uint32_t conn_id;    // per-server connection number, in accept order
+    uint8_t proto;       // CaptureProto
+    uint8_t reserved[3];
+    uint32_t len;        // body bytes that follow
+};
+#pragma pack(pop)
+static_assert(sizeof(CaptureRecord) == 20, "CaptureRecord must stay 20 bytes");
+
+// Appends records from any thread. Writes go through a 1 MiB stdio buffer
+// under one mutex; capture is off unless a path is configured, and then
+// costs one buffered copy per request.
+class CaptureWriter {
+public:
+    ~CaptureWriter() { close(); }
+
+    bool open(const char* path, uint64_t now_ns, uint64_t unix_ns) {
+        std::lock_guard<std::mutex> lg(mutex_);
+        f_ = std::fopen(path, "wb");
+        if (!f_) return false;
+        std::setvbuf(f_, nullptr, _IOFBF, 1 << 20);
+        CaptureFileHeader h;
+        std::memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+        h.started_unix_ns = unix_ns;
+        std::fwrite(&h, sizeof(h), 1, f_);
+        start_ns_ = now_ns;
+        enabled_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    void record(uint64_t now_ns, uint32_t conn_id, CaptureProto proto, std::string_view body) {
+        CaptureRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.offset_ns = now_ns > start_ns_ ? now_ns - start_ns_ : 0;
+        r.conn_id = conn_id;
+        r.proto = static_cast<uint8_t>(proto);
+        r.len = (uint32_t)body.size();
+        std::lock_guard<std::mutex> lg(mutex_);
+        if (!f_) return;
+        std::fwrite(&r, sizeof(r), 1, f_);
+        std::fwrite(body.data(), 1, body.size(), f_);
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lg(mutex_);
+        enabled_.store(false, std::memory_order_release);
+        if (f_) std::fclose(f_);
+        f_ = nullptr;
+    }
+
+private:
+    std::mutex mutex_;
+    std::FILE* f_ = nullptr;
+    std::atomic<bool> enabled_{false};
+    uint64_t start_ns_ = 0;
+};
+
+struct CapturedRequest {
+    CaptureRecord rec;
+    std::string body;
+};
+
+// Reads a whole capture; false if the file is missing or not a capture. A
+// truncated last record (server killed mid-write) is dropped.
+inline bool read_capture(const char* path, std::vector<CapturedRequest>& out) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (!f) return false;
+    CaptureFileHeader h;
+    if (std::fread(&h, sizeof(h), 1, f) != 1 || std::memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic)) != 0) {
+        std::fclose(f);
+        return false;
+    }
+    CapturedRequest cr;
+    while (std::fread(&cr.rec, sizeof(cr.rec), 1, f) == 1) {
+        cr.body.resize(cr.rec.len);
+        if (cr.rec.len && std::fread(&cr.body[0], 1, cr.rec.len, f) != cr.rec.len) break;
+        out.push_back(cr);
+    }
+    std::fclose(f);
+    return true;
+}
+
+#endif // CAPTURE_HPP
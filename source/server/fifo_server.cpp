@@ -1,39 +1,65 @@
 #include "fifo_server.hpp"
+#include "json_view.hpp"
+#include "response_writer.hpp"
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <iostream>
 #include <cstring>
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <csignal>
 
-static std::string extract_json_string(const std::string& json, const std::string& key) {
-    std::string pat = "\"" + key + "\"";
-    auto pos = json.find(pat);
-    if (pos == std::string::npos) return std::string();
-    pos = json.find(':', pos);
-    if (pos == std::string::npos) return std::string();
-    pos++;
-    
-    while (pos < json.size() && isspace((unsigned char)json[pos])) pos++;
-    if (pos < json.size() && json[pos] == '"') {
-        pos++;
-        size_t end = pos;
-        while (end < json.size() && json[end] != '"') end++;
-        return json.substr(pos, end - pos);
-    }
-    return std::string();
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-FIFOService::FIFOService(int port, OFSInstance* inst) : port_(port), instance_(inst) {}
+// Operation names as reported in metrics; binary opcodes other than JSON get
+// a "bin_" name. Anything unrecognized is counted as "other".
+static const char* const OP_NAMES[] = {
+    "ping", "user_login", "user_list", "user_create", "file_create", "file_read", "file_exists",
+    "file_delete", "file_rename", "dir_create", "dir_list", "dir_delete", "dir_usage", "file_search", "upload_open",
+    "upload_chunk", "upload_commit", "upload_abort", "download_open", "download_chunk", "download_close", "batch", "stats", "trace_sample",
+    "bin_ping", "bin_file_write", "bin_file_read", "bin_upload_chunk", "bin_download_chunk", "other"};
+
+static int op_index(std::string_view op) {
+    const int n = (int)(sizeof(OP_NAMES) / sizeof(OP_NAMES[0]));
+    for (int i = 0; i < n - 1; ++i)
+        if (op == OP_NAMES[i]) return i;
+    return n - 1;
+}
+
+thread_local BumpArena FIFOService::arena_;
+
+FIFOService::FIFOService(int port, OFSInstance* inst, int loop_threads)
+    : port_(port), loop_count_(loop_threads), instance_(inst), container_fd_(container_fd(inst)) {
+    static_assert(sizeof(OP_NAMES) / sizeof(OP_NAMES[0]) == OP_COUNT, "OP_NAMES and OP_COUNT disagree");
+    started_ms_ = steady_ms();
+    if (loop_count_ <= 0) {
+        unsigned hc = std::thread::hardware_concurrency();
+        loop_count_ = hc == 0 ? 2 : (int)std::min(4u, hc);
+    }
+}
 
 FIFOService::~FIFOService() { stop(); }
 
 bool FIFOService::start() {
     if (running_) return true;
+    // A peer that resets mid-response must not kill the server; sendfile()
+    // has no MSG_NOSIGNAL.
+    signal(SIGPIPE, SIG_IGN);
 
-    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    server_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_fd_ < 0) { perror("socket"); return false; }
 
     int opt = 1;
@@ -47,348 +73,1525 @@ bool FIFOService::start() {
 
     if (bind(server_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return false; }
 
-    if (listen(server_fd_, 16) < 0) { perror("listen"); return false; }
+    if (listen(server_fd_, SOMAXCONN) < 0) { perror("listen"); return false; }
+
+    for (int i = 0; i < loop_count_; ++i) {
+        std::unique_ptr<EventLoop> loop(new EventLoop());
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0) { perror("epoll"); return false; }
+        // The listening socket is shared by all loops; EPOLLEXCLUSIVE wakes
+        // only one of them per incoming connection.
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = server_fd_;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, server_fd_, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->wake_fd;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+        loops_.push_back(std::move(loop));
+    }
     running_ = true;
 
-    accept_thread_ = std::thread(&FIFOService::accept_loop, this);
-    worker_thread_ = std::thread(&FIFOService::worker_loop, this);
+    for (auto& loop : loops_) loop->thread = std::thread(&FIFOService::event_loop, this, loop.get());
+    worker_thread_ = std::thread(&FIFOService::worker_loop, this, false);
+    int readers = read_workers_;
+    if (readers <= 0) {
+        unsigned hc = std::thread::hardware_concurrency();
+        readers = hc == 0 ? 2 : (int)std::min(4u, hc);
+    }
+    for (int i = 0; i < readers; ++i) read_threads_.emplace_back(&FIFOService::worker_loop, this, true);
     return true;
 }
 
 void FIFOService::stop() {
     if (!running_) return;
     running_ = false;
-    shutdown(server_fd_, SHUT_RDWR);
+    for (auto& loop : loops_) {
+        uint64_t one = 1;
+        ssize_t w = write(loop->wake_fd, &one, sizeof(one));
+        (void)w;
+    }
+    for (auto& loop : loops_) {
+        if (loop->thread.joinable()) loop->thread.join();
+        for (auto& kv : loop->conns) {
+            {
+                // Held requests point back at their connection.
+                std::lock_guard<std::mutex> ql(queue_mutex_);
+                held_count_ -= kv.second->held.size();
+                kv.second->held.clear();
+            }
+            std::lock_guard<std::mutex> lg(kv.second->out_mutex);
+            kv.second->closed = true;
+            drop_output_locked(kv.second.get());
+            close(kv.first);
+        }
+        loop->conns.clear();
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
+    }
+    loops_.clear();
     close(server_fd_);
-    if (accept_thread_.joinable()) accept_thread_.join();
-    
+
     queue_cv_.notify_all();
+    read_cv_.notify_all();
     if (worker_thread_.joinable()) worker_thread_.join();
+    for (auto& t : read_threads_) t.join();
+    read_threads_.clear();
+    capture_.close();
+}
+
+bool FIFOService::set_capture(const char* path) {
+    uint64_t unix_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    return capture_.open(path, metrics_now_ns(), unix_ns);
 }
 
-void FIFOService::accept_loop() {
+void FIFOService::event_loop(EventLoop* loop) {
+    trace_thread_name("event_loop");
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
     while (running_) {
+        // Wake at least once a second to expire idle keep-alive connections.
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        int64_t now = steady_ms();
+        if (now - loop->last_sweep_ms >= 1000) {
+            loop->last_sweep_ms = now;
+            close_idle_connections(loop, now);
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == server_fd_) { accept_connections(loop); continue; }
+            if (fd == loop->wake_fd) continue;  // stop() requested
+            auto it = loop->conns.find(fd);
+            if (it == loop->conns.end()) continue;
+            std::shared_ptr<Connection> conn = it->second;
+            uint32_t ev = events[i].events;
+            if (ev & EPOLLOUT) {
+                std::lock_guard<std::mutex> lg(conn->out_mutex);
+                flush_locked(conn.get());
+            }
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) on_readable(loop, conn);
+        }
+    }
+}
+
+void FIFOService::accept_connections(EventLoop* loop) {
+    while (true) {
         struct sockaddr_in cli;
         socklen_t len = sizeof(cli);
-        int c = accept(server_fd_, (struct sockaddr*)&cli, &len);
+        int c = accept4(server_fd_, (struct sockaddr*)&cli, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (c < 0) {
-            if (!running_) break;
-            perror("accept");
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (running_) perror("accept");
+            return;
+        }
+        if (max_connections_ > 0 && open_connections_.load() >= max_connections_) {
+            // Over the limit: refuse promptly rather than leave the client in the backlog.
+            close(c);
+            rejected_connections_.fetch_add(1, std::memory_order_relaxed);
             continue;
         }
-    char peekbuf[32] = {0};
-    ssize_t pr = recv(c, peekbuf, sizeof(peekbuf) - 1, MSG_PEEK);
-        if (pr > 0) {
-            std::string s(peekbuf, (size_t)pr);
-            if (s.rfind("POST ", 0) == 0 || s.rfind("GET ", 0) == 0 || s.rfind("OPTIONS ", 0) == 0) {
-                std::thread(&FIFOService::handle_http_connection, this, c).detach();
-                continue;
-            }
+        int one = 1;
+        setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto conn = std::make_shared<Connection>();
+        conn->fd = c;
+        conn->id = next_conn_id_.fetch_add(1, std::memory_order_relaxed);
+        conn->last_active_ms = steady_ms();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = c;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, c, &ev) < 0) {
+            perror("epoll_ctl");
+            close(c);
+            continue;
         }
-        int flags = fcntl(c, F_GETFL, 0);
-        fcntl(c, F_SETFL, flags | O_NONBLOCK);
-        std::thread(&FIFOService::reader_loop, this, c).detach();
+        loop->conns[c] = std::move(conn);
+        open_connections_.fetch_add(1);
+    }
+}
+
+void FIFOService::close_connection(EventLoop* loop, const std::shared_ptr<Connection>& conn) {
+    int fd = conn->fd;
+    buffered_input_.fetch_sub(conn->buffered, std::memory_order_relaxed);
+    conn->buffered = 0;
+    {
+        std::lock_guard<std::mutex> lg(conn->out_mutex);
+        if (conn->closed) return;
+        conn->closed = true;
+        drop_output_locked(conn.get());  // releases the holds of unsent file ranges
+        close(fd);  // also removes it from the epoll set
     }
+    loop->conns.erase(fd);
+    open_connections_.fetch_sub(1);
 }
 
-void FIFOService::handle_http_connection(int client_fd) {
-    std::string headers;
-    char buf[1024];
-    ssize_t r;
+// Longest JSON line accepted. A longer one is answered request_too_large and
+// the connection closed; bulk data belongs in upload chunks.
+static const size_t MAX_JSON_LINE = 64u << 20;
+
+// HTTP requests: a longer header block closes the connection, a larger
+// Content-Length is answered 413.
+static const size_t MAX_HTTP_HEADER = 64 * 1024;
+static const uint64_t MAX_HTTP_BODY = 64u << 20;
+
+// Unframed input across all connections. The connection whose read would
+// pass it is refused (413 over HTTP), so idle peers holding partial requests
+// cannot exhaust memory between them.
+static const size_t MAX_BUFFERED_INPUT = 512u << 20;
+
+// Unframed bytes a connection may buffer before on_readable frames what it
+// has mid-read; each parser refuses a remainder over its own limit, so the
+// buffer stays bounded however fast the peer sends.
+static size_t max_unframed(Connection::Protocol proto) {
+    switch (proto) {
+        case Connection::Protocol::UNKNOWN: return 0;
+        case Connection::Protocol::JSON_LINES: return MAX_JSON_LINE;
+        case Connection::Protocol::HTTP: return MAX_HTTP_HEADER + MAX_HTTP_BODY;
+        case Connection::Protocol::BINARY: return sizeof(BinHeader) + BIN_MAX_META + BIN_MAX_PAYLOAD;
+    }
+    return 0;
+}
+
+// Edge-triggered: drain the socket until EAGAIN, then frame whatever arrived.
+void FIFOService::on_readable(EventLoop* loop, const std::shared_ptr<Connection>& conn) {
+    char tmp[16384];
+    bool eof = false;
+    bool keep = true;
     while (true) {
-        r = recv(client_fd, buf, sizeof(buf), 0);
-        if (r <= 0) { close(client_fd); return; }
-        headers.append(buf, buf + r);
-        size_t pos = headers.find("\r\n\r\n");
-        if (pos != std::string::npos) {
-            std::string hdrs = headers.substr(0, pos + 4);
-            std::string rest = headers.substr(pos + 4);
-            // parse request line to check method and path
-            std::istringstream hs(hdrs);
-            std::string request_line;
-            std::getline(hs, request_line);
-            // trim CR if present
-            if (!request_line.empty() && request_line.back() == '\r') request_line.pop_back();
-            std::istringstream rl(request_line);
-            std::string method, path, proto;
-            rl >> method >> path >> proto;
-            // handle CORS preflight
-            if (method == "OPTIONS") {
-                std::string pre = "HTTP/1.1 204 No Content\r\n";
-                pre += "Access-Control-Allow-Origin: *\r\n";
-                pre += "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
-                pre += "Access-Control-Allow-Headers: Content-Type\r\n";
-                pre += "Content-Length: 0\r\n";
-                pre += "Connection: close\r\n\r\n";
-                send(client_fd, pre.c_str(), pre.size(), 0);
-                close(client_fd);
-                return;
+        ssize_t r = recv(conn->fd, tmp, sizeof(tmp), 0);
+        if (r > 0) {
+            if (conn->input_closed) continue;  // refused or closing: drain and drop
+            conn->inbuf.append(tmp, (size_t)r);
+            bool over_budget = over_input_budget(conn.get());
+            if (conn->inbuf.size() > max_unframed(conn->proto) || over_budget) {
+                if (!(keep = frame_input(conn))) break;
+                if (over_budget && over_input_budget(conn.get())) reject_input(conn);
             }
-            std::string cl_key = "Content-Length:";
-            size_t clpos = hdrs.find(cl_key);
-            int content_length = 0;
-            if (clpos != std::string::npos) {
-                size_t lineend = hdrs.find('\r', clpos);
-                std::string clv = hdrs.substr(clpos + cl_key.size(), lineend - (clpos + cl_key.size()));
-                try { content_length = std::stoi(clv); } catch(...) { content_length = 0; }
+            continue;
+        }
+        if (r == 0) { eof = true; break; }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) eof = true;
+        break;
+    }
+    conn->last_active_ms = steady_ms();
+    if (keep) keep = frame_input(conn);
+    buffered_input_.fetch_add(conn->inbuf.size() - conn->buffered, std::memory_order_relaxed);  // wraps when it shrank
+    conn->buffered = conn->inbuf.size();
+
+    if (!keep) { close_connection(loop, conn); return; }
+    if (eof) {
+        // Let in-flight responses go out before closing; the worker shuts the
+        // socket down once the last one is flushed.
+        std::lock_guard<std::mutex> lg(conn->out_mutex);
+        if (conn->inflight.load() > 0 || !conn->outq.empty()) {
+            conn->close_after_flush = true;
+            return;
+        }
+    }
+    if (eof) close_connection(loop, conn);
+}
+
+// Whether this connection's buffer, counted as it is now, would take the
+// server past MAX_BUFFERED_INPUT.
+bool FIFOService::over_input_budget(const Connection* conn) const {
+    return buffered_input_.load(std::memory_order_relaxed) + conn->inbuf.size() > MAX_BUFFERED_INPUT + conn->buffered;
+}
+
+// Detects the protocol from the first bytes, then frames every complete
+// request in the buffer. Returns false when the connection should be closed
+// right away.
+bool FIFOService::frame_input(const std::shared_ptr<Connection>& conn) {
+    if (conn->input_closed) {
+        conn->inbuf.clear();
+        return true;
+    }
+    if (conn->proto == Connection::Protocol::UNKNOWN && !conn->inbuf.empty()) {
+        // Same detection as the old blocking peek: HTTP method prefix, binary
+        // frame magic, otherwise JSON lines.
+        static const std::string_view prefixes[] = {"POST ", "GET ", "OPTIONS ", std::string_view(BIN_MAGIC, 4)};
+        static const Connection::Protocol protos[] = {Connection::Protocol::HTTP, Connection::Protocol::HTTP,
+                                                      Connection::Protocol::HTTP, Connection::Protocol::BINARY};
+        bool maybe_more = false;
+        for (size_t i = 0; i < 4; ++i) {
+            size_t ml = prefixes[i].size();
+            size_t cmp = std::min(ml, conn->inbuf.size());
+            if (conn->inbuf.compare(0, cmp, prefixes[i].data(), cmp) == 0) {
+                if (cmp == ml) conn->proto = protos[i];
+                else maybe_more = true;
             }
-            // Log the incoming HTTP request (method, path, content-length)
-            std::cerr << "[HTTP] " << method << " " << path << " len=" << content_length << "\n";
-            while ((int)rest.size() < content_length) {
-                r = recv(client_fd, buf, sizeof(buf), 0);
-                if (r <= 0) { close(client_fd); return; }
-                rest.append(buf, buf + r);
+        }
+        if (conn->proto == Connection::Protocol::UNKNOWN && !maybe_more)
+            conn->proto = Connection::Protocol::JSON_LINES;
+    }
+
+    if (conn->proto == Connection::Protocol::JSON_LINES) return parse_json_lines(conn);
+    if (conn->proto == Connection::Protocol::HTTP) return handle_http_connection(conn);
+    if (conn->proto == Connection::Protocol::BINARY) return parse_binary_frames(conn);
+    return true;
+}
+
+// Answers input over a framing limit with request_too_large, after the
+// responses still owed on the connection, then stops reading; the socket is
+// shut down once the answer is sent.
+void FIFOService::reject_input(const std::shared_ptr<Connection>& conn, const BinHeader* bin) {
+    std::string segs[4];
+    take_buffers(conn.get(), segs, 4);
+    ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+    w.error(std::string_view(), "request_too_large");
+    w.end(conn->proto == Connection::Protocol::JSON_LINES);
+    if (bin) {
+        append_bin_header(segs[0], make_bin_header(static_cast<BinOpcode>(bin->opcode), bin->request_id, (uint32_t)w.size(), 0,
+                                                   BIN_STATUS_TOO_LARGE));
+    } else if (conn->proto == Connection::Protocol::HTTP) {
+        segs[0].append("HTTP/1.1 413 Payload Too Large\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: ");
+        segs[0].append(std::to_string(w.size()));
+        segs[0].append("\r\nConnection: close\r\n\r\n");
+    }
+    conn->input_closed = true;
+    std::string().swap(conn->inbuf);
+    send_segments(conn, conn->next_seq++, segs, 4, true, false);
+}
+
+bool FIFOService::parse_json_lines(const std::shared_ptr<Connection>& conn) {
+    size_t start = 0;
+    size_t pos;
+    while ((pos = conn->inbuf.find('\n', start)) != std::string::npos) {
+        FSRequest req;
+        take_buffers(conn.get(), &req.raw, 1);
+        req.raw.assign(conn->inbuf, start, pos - start);
+        start = pos + 1;
+        req.conn = conn;
+        req.seq = conn->next_seq++;
+        enqueue(std::move(req));
+    }
+    if (start > 0) conn->inbuf.erase(0, start);
+    // What is left is one partial line.
+    if (conn->inbuf.size() > MAX_JSON_LINE) reject_input(conn);
+    return true;
+}
+
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+static std::string_view trim(std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t' || v.back() == '\r')) v.remove_suffix(1);
+    return v;
+}
+
+// Case-insensitive lookup of a header in a "\r\n"-separated header block
+// (request line included; it never contains ':' before a space).
+static bool http_header(std::string_view hdrs, std::string_view name, std::string_view& value) {
+    size_t line = hdrs.find("\r\n");
+    while (line != std::string_view::npos && line + 2 < hdrs.size()) {
+        size_t start = line + 2;
+        size_t end = hdrs.find("\r\n", start);
+        if (end == std::string_view::npos) end = hdrs.size();
+        std::string_view l = hdrs.substr(start, end - start);
+        size_t colon = l.find(':');
+        if (colon != std::string_view::npos && iequals(trim(l.substr(0, colon)), name)) {
+            value = trim(l.substr(colon + 1));
+            return true;
+        }
+        line = end;
+    }
+    return false;
+}
+
+// /metrics and /trace show what every user is doing (operation counts, and
+// for traced requests their timings), so both answer only to an admin session
+// sent as "Authorization: Bearer <token>". Returns the status to reply with.
+static int http_admin_status(OFSInstance* inst, std::string_view hdrs) {
+    std::string_view v;
+    if (!http_header(hdrs, "Authorization", v) || v.size() <= 7 || !iequals(v.substr(0, 7), "Bearer ")) return 401;
+    std::string token(trim(v.substr(7)));
+    SessionInfo s;
+    if (get_session_into(inst, token.c_str(), &s) != 0) return 401;
+    return s.user.role == UserRole::ADMIN ? 200 : 403;
+}
+
+// Frames every complete HTTP/1.1 request in the connection buffer. Requests
+// may be pipelined; each gets the next sequence number so responses go out in
+// order. Returns false when the connection should be closed right away.
+bool FIFOService::handle_http_connection(const std::shared_ptr<Connection>& conn) {
+    std::string& in = conn->inbuf;
+    size_t start = 0;
+    bool keep = true;
+    while (!conn->input_closed && start < in.size()) {
+        size_t pos = in.find("\r\n\r\n", start);
+        if (pos == std::string::npos) {
+            if (in.size() - start > MAX_HTTP_HEADER) keep = false;
+            break;
+        }
+        std::string_view hdrs(in.data() + start, pos + 2 - start);
+        // parse request line to check method and path
+        size_t rl_end = hdrs.find("\r\n");
+        std::string_view request_line = hdrs.substr(0, rl_end);
+        size_t sp1 = request_line.find(' ');
+        size_t sp2 = request_line.find(' ', sp1 == std::string_view::npos ? sp1 : sp1 + 1);
+        if (sp1 == std::string_view::npos || sp2 == std::string_view::npos) { keep = false; break; }
+        std::string_view method = request_line.substr(0, sp1);
+        std::string_view path = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+        std::string_view proto = request_line.substr(sp2 + 1);
+
+        uint64_t content_length = 0;
+        std::string_view v;
+        if (http_header(hdrs, "Content-Length", v)) {
+            auto r = std::from_chars(v.data(), v.data() + v.size(), content_length);
+            if (r.ec != std::errc() || r.ptr != v.data() + v.size()) {
+                keep = false;
+                break;
             }
-            std::string body = rest.substr(0, content_length);
-            Pending pend;
+            if (content_length > MAX_HTTP_BODY) {
+                reject_input(conn);  // answered after the requests framed before it
+                return true;
+            }
+        }
+        size_t body_start = pos + 4;
+        // Wait for the body. The buffer grows as it arrives: Content-Length
+        // is the peer's claim, not something to allocate for up front.
+        if (in.size() - body_start < content_length) break;
+
+        bool close_after = proto == "HTTP/1.0";
+        if (http_header(hdrs, "Connection", v)) {
+            if (iequals(v, "close")) close_after = true;
+            else if (iequals(v, "keep-alive")) close_after = false;
+        }
+        uint64_t seq = conn->next_seq++;
+        // Scrapes and trace dumps are answered from the loop: neither takes the
+        // worker's time, and reading the counters takes no lock. The session
+        // check is one short lookup under the instance mutex.
+        int admin = 0;
+        if (method == "GET" && (path == "/metrics" || path == "/trace")) admin = http_admin_status(instance_, hdrs);
+        if (admin == 401 || admin == 403) {
+            std::string segs[4];
+            take_buffers(conn.get(), segs, 4);
+            ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+            w.error(std::string_view(), admin == 401 ? "invalid_session" : "permission_denied");
+            w.end(false);
+            segs[0] = admin == 401 ? "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Bearer\r\n" : "HTTP/1.1 403 Forbidden\r\n";
+            segs[0] += "Content-Type: application/json\r\nContent-Length: ";
+            segs[0] += std::to_string(w.size());
+            segs[0] += close_after ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n";
+            send_segments(conn, seq, segs, 4, close_after, false);
+        } else if (method == "GET" && path == "/metrics") {
+            std::string segs[2];
+            render_metrics(segs[1]);
+            segs[0] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+            segs[0] += std::to_string(segs[1].size());
+            segs[0] += close_after ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n";
+            send_segments(conn, seq, segs, 2, close_after, false);
+        } else if (method == "GET" && path == "/trace") {
+            std::string segs[2];
+            trace_dump_chrome(segs[1]);
+            segs[0] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: ";
+            segs[0] += std::to_string(segs[1].size());
+            segs[0] += close_after ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n";
+            send_segments(conn, seq, segs, 2, close_after, false);
+        } else if (method == "OPTIONS") {
+            // handle CORS preflight
+            std::string pre = "HTTP/1.1 204 No Content\r\n";
+            pre += "Access-Control-Allow-Origin: *\r\n";
+            pre += "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
+            pre += "Access-Control-Allow-Headers: Content-Type\r\n";
+            pre += "Content-Length: 0\r\n";
+            pre += close_after ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+            send_segments(conn, seq, &pre, 1, close_after, false);
+        } else {
             FSRequest req;
-            req.raw = body;
-            req.client_fd = client_fd;
-            req.id = extract_json_string(body, "request_id");
+            take_buffers(conn.get(), &req.raw, 1);
+            req.raw.assign(in, body_start, (size_t)content_length);
+            req.conn = conn;
             req.is_http = true;
-            req.pending = &pend;
-            {
-                std::lock_guard<std::mutex> lg(queue_mutex_);
-                request_queue_.push_back(req);
+            req.close_after = close_after;
+            req.seq = seq;
+            enqueue(std::move(req));
+        }
+        start = body_start + (size_t)content_length;
+        if (close_after) conn->input_closed = true;
+    }
+    if (conn->input_closed) in.clear();
+    else if (start > 0) in.erase(0, start);
+    return keep;
+}
+
+void FIFOService::close_idle_connections(EventLoop* loop, int64_t now_ms) {
+    std::vector<std::shared_ptr<Connection>> idle;
+    for (auto& kv : loop->conns) {
+        Connection* c = kv.second.get();
+        if (c->proto != Connection::Protocol::HTTP) continue;
+        if (now_ms - c->last_active_ms < http_idle_timeout_ms_) continue;
+        std::lock_guard<std::mutex> lg(c->out_mutex);
+        if (c->inflight.load() == 0 && c->outq.empty()) idle.push_back(kv.second);
+    }
+    for (auto& c : idle) close_connection(loop, c);
+}
+
+// Longest request body read_only_request parses on the loop. Reads are small;
+// anything longer is a write, or goes to the worker as if it were one.
+static const size_t MAX_CLASSIFIED_REQUEST = 4096;
+
+// Whether a request only reads, so it can run on a read worker next to the
+// worker's writes: these take a snapshot of the file table (or a download's
+// pinned version) and no write lock. Anything else counts as a write.
+static bool read_only_request(const FSRequest& req) {
+    std::string_view body = req.raw;
+    if (req.is_binary) {
+        BinOpcode op = static_cast<BinOpcode>(req.bin.opcode);
+        if (op == BinOpcode::PING || op == BinOpcode::FILE_READ || op == BinOpcode::DOWNLOAD_CHUNK) return true;
+        if (op != BinOpcode::JSON) return false;
+        body = body.substr(sizeof(BinHeader), req.bin.meta_len);
+    }
+    if (body.size() > MAX_CLASSIFIED_REQUEST) return false;
+    JsonView jv;
+    if (!jv.parse(body)) return false;
+    std::string scratch;
+    std::string_view op = jv.str("operation", scratch);
+    return op == "ping" || op == "file_read" || op == "file_exists" || op == "dir_list" || op == "dir_usage" ||
+           op == "file_search" || op == "download_open" || op == "download_chunk" || op == "download_close" ||
+           op == "stats";
+}
+
+// Called from the loops. A full queue answers "busy" immediately, so an
+// overloaded server sheds load instead of growing the queue and everyone's
+// latency with it.
+void FIFOService::enqueue(FSRequest req) {
+    req.conn->inflight.fetch_add(1);
+    req.enqueued_ns = metrics_now_ns();
+    req.trace_id = trace_sample();
+    // Captured before admission, so a replay also offers what was turned away.
+    if (capture_.enabled())
+        capture_.record(req.enqueued_ns, req.conn->id,
+                        req.is_binary ? CaptureProto::BINARY : req.is_http ? CaptureProto::HTTP : CaptureProto::JSON_LINES,
+                        req.raw);
+    uint64_t trace_id = req.trace_id;
+    bool read = read_only_request(req);
+    std::condition_variable* wake = nullptr;
+    {
+        std::lock_guard<std::mutex> lg(queue_mutex_);
+        if (request_queue_.size() + read_queue_.size() + held_count_ < max_queue_depth_) {
+            Connection& c = *req.conn;
+            if (c.held.empty() && read && c.writes_queued == 0) {
+                ++c.reads_running;
+                req.read_lane = true;
+                read_queue_.push_back(std::move(req));
+                wake = &read_cv_;
+            } else if (c.held.empty() && (read || c.reads_running == 0)) {
+                // A write, or a read that must see the writes queued before it.
+                ++c.writes_queued;
+                request_queue_.push_back(std::move(req));
+                wake = &queue_cv_;
+            } else {
+                // A write behind reads still running, or anything behind it.
+                c.held.push_back(std::move(req));
+                ++held_count_;
             }
-            queue_cv_.notify_one();
-
-            std::unique_lock<std::mutex> ul(pend.m);
-            pend.cv.wait(ul, [&pend]() { return pend.done; });
-            std::string resp_body = pend.response;
-            std::ostringstream oss;
-            oss << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: " << resp_body.size() << "\r\n\r\n";
-            oss << resp_body;
-            std::string out = oss.str();
-            send(client_fd, out.c_str(), out.size(), 0);
-            close(client_fd);
-            return;
+            req.conn.reset();
         }
     }
+    // The request's async span opens on this loop and closes on the worker.
+    if (trace_id) trace_emit(req.conn ? "rejected" : "request", req.conn ? 'n' : 'b', metrics_now_ns(), trace_id);
+    if (req.conn) {
+        rejected_busy_.fetch_add(1, std::memory_order_relaxed);
+        send_error(req, "busy", BIN_STATUS_BUSY);
+    } else if (wake) {
+        wake->notify_one();
+    }
 }
 
-void FIFOService::reader_loop(int client_fd) {
-    // Read until EOF or newline separated JSON messages
-    std::string buf;
-    char tmp[1024];
-    while (running_) {
-        ssize_t r = recv(client_fd, tmp, sizeof(tmp), 0);
-        if (r > 0) {
-            buf.append(tmp, tmp + r);
-            // try to extract lines
-            size_t pos;
-            while ((pos = buf.find('\n')) != std::string::npos) {
-                std::string line = buf.substr(0, pos);
-                buf.erase(0, pos + 1);
-                FSRequest req;
-                req.raw = line;
-                req.client_fd = client_fd;
-                req.id = extract_json_string(line, "request_id");
-                {
-                    std::lock_guard<std::mutex> lg(queue_mutex_);
-                    request_queue_.push_back(req);
-                }
-                queue_cv_.notify_one();
+// Called by a worker once a request is answered. The last read of a
+// connection to finish hands its held requests to the worker, in order.
+void FIFOService::finish_request(FSRequest& req) {
+    std::lock_guard<std::mutex> lg(queue_mutex_);
+    Connection& c = *req.conn;
+    if (!req.read_lane) {
+        --c.writes_queued;
+        return;
+    }
+    if (--c.reads_running > 0 || c.held.empty()) return;
+    for (FSRequest& r : c.held) request_queue_.push_back(std::move(r));
+    c.writes_queued += (int)c.held.size();
+    held_count_ -= c.held.size();
+    c.held.clear();
+    queue_cv_.notify_one();
+}
+
+// Answers a request that will not be executed (busy / timeout) in its own
+// protocol: an error object, HTTP 503, or a binary frame with `bin_status`.
+void FIFOService::send_error(FSRequest& req, const char* code, int16_t bin_status) {
+    std::string segs[4];
+    take_buffers(req.conn.get(), segs, 4);
+    if (req.is_binary) {
+        append_bin_header(segs[0], make_bin_header(static_cast<BinOpcode>(req.bin.opcode), req.bin.request_id, 0, 0, bin_status));
+    } else {
+        JsonView jv;
+        jv.parse(req.raw);
+        ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+        w.error(jv.raw("request_id"), code);
+        w.end(!req.is_http);
+        if (req.is_http) {
+            segs[0].append("HTTP/1.1 503 Service Unavailable\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nRetry-After: 1\r\nContent-Length: ");
+            segs[0].append(std::to_string(w.size()));
+            segs[0].append(req.close_after ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n");
+        }
+    }
+    send_segments(req.conn, req.seq, segs, 4, req.close_after, true);
+}
+
+// Hands out a cleared buffer from the connection's pool so steady-state
+// requests and responses reuse capacity instead of allocating. Buffers are
+// given a floor capacity the first time out: which pooled buffer serves
+// which role varies with timing, so a buffer that only ever carried an empty
+// segment must still fit the next small request without growing.
+void FIFOService::take_buffers(Connection* conn, std::string* bufs, size_t n) {
+    std::lock_guard<std::mutex> lg(conn->out_mutex);
+    for (size_t i = 0; i < n; ++i) {
+        if (!conn->spare.empty()) {
+            bufs[i].swap(conn->spare.back());
+            conn->spare.pop_back();
+        }
+        bufs[i].clear();
+        bufs[i].reserve(Connection::MIN_BUFFER);
+    }
+}
+
+static void recycle_buffer(Connection* conn, std::string& buf) {
+    // Keep a few buffers per connection; give very large ones back to the heap.
+    if (conn->spare.size() >= Connection::MAX_SPARE || buf.capacity() > Connection::MAX_SPARE_BYTES) {
+        std::string().swap(buf);
+        return;
+    }
+    buf.clear();
+    conn->spare.push_back(std::move(buf));
+}
+
+// Request bodies come from the same pool as responses (see the parsers) and
+// go back to it once the request is answered.
+void FIFOService::recycle_request(FSRequest& req) {
+    std::lock_guard<std::mutex> lg(req.conn->out_mutex);
+    recycle_buffer(req.conn.get(), req.raw);
+}
+
+// Called from the worker (and the loop for OPTIONS). Queues the segments
+// (moved, not copied) and writes as much as the socket takes with writev, or
+// sendfile for the container ranges in `files`; the rest is sent by the loop
+// on the next EPOLLOUT edge.
+void FIFOService::send_segments(const std::shared_ptr<Connection>& conn, uint64_t seq, std::string* segs, size_t n, bool close_after,
+                                bool completes_request, const FilePayload* files) {
+    std::lock_guard<std::mutex> lg(conn->out_mutex);
+    // Decrement under out_mutex so the loop's EOF check sees either the
+    // request still in flight or its response already buffered.
+    if (completes_request) conn->inflight.fetch_sub(1);
+    if (conn->closed) {
+        for (size_t i = 0; i < n; ++i) recycle_buffer(conn.get(), segs[i]);
+        if (files) file_release_map(instance_, files->hold);
+        return;
+    }
+    if (seq != conn->send_seq) {
+        // An earlier request on this connection is still being served.
+        Connection::Parked& p = conn->parked[seq];
+        append_segments_locked(conn.get(), p.segs, segs, n, files);
+        p.close_after = close_after;
+        return;
+    }
+    append_segments_locked(conn.get(), conn->outq, segs, n, files);
+    if (close_after) conn->close_after_flush = true;
+    ++conn->send_seq;
+    while (!conn->parked.empty() && conn->parked.begin()->first == conn->send_seq) {
+        Connection::Parked& p = conn->parked.begin()->second;
+        for (auto& seg : p.segs) conn->outq.push_back(std::move(seg));
+        if (p.close_after) conn->close_after_flush = true;
+        conn->parked.erase(conn->parked.begin());
+        ++conn->send_seq;
+    }
+    flush_locked(conn.get());
+}
+
+void FIFOService::append_segments_locked(Connection* conn, std::vector<Connection::OutSegment>& dst, std::string* segs, size_t n,
+                                         const FilePayload* files) {
+    for (size_t i = 0; i < n; ++i) {
+        if (segs[i].empty()) { recycle_buffer(conn, segs[i]); continue; }
+        dst.emplace_back();
+        dst.back().bytes = std::move(segs[i]);
+    }
+    if (!files) return;
+    size_t first = dst.size();
+    for (int i = 0; i < files->count; ++i) {
+        const FileExtent& e = files->extents[i];
+        if (e.len == 0) continue;
+        dst.emplace_back();
+        Connection::OutSegment& seg = dst.back();
+        if (e.data) {
+            // Inline tails are small; copy them into a pooled buffer.
+            if (!conn->spare.empty()) {
+                seg.bytes.swap(conn->spare.back());
+                conn->spare.pop_back();
             }
-        } else if (r == 0) {
-            break; // client closed
+            seg.bytes.assign(e.data, (size_t)e.len);
         } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(20));
-                continue;
+            seg.file_offset = e.offset;
+            seg.file_len = e.len;
+        }
+    }
+    if (dst.size() > first) dst.back().hold = files->hold;
+    else file_release_map(instance_, files->hold);
+}
+
+// Returns a sent (or dropped) segment's buffer to the pool and its hold to the core.
+void FIFOService::retire_segment_locked(Connection* conn, Connection::OutSegment& seg) {
+    if (seg.hold) {
+        file_release_map(instance_, seg.hold);
+        seg.hold = 0;
+    }
+    if (!seg.file_len) recycle_buffer(conn, seg.bytes);
+}
+
+void FIFOService::drop_output_locked(Connection* conn) {
+    for (auto& seg : conn->outq) retire_segment_locked(conn, seg);
+    conn->outq.clear();
+    conn->out_off = 0;
+    for (auto& kv : conn->parked)
+        for (auto& seg : kv.second.segs) retire_segment_locked(conn, seg);
+    conn->parked.clear();
+}
+
+void FIFOService::flush_locked(Connection* conn) {
+    if (conn->closed) return;
+    while (!conn->outq.empty()) {
+        ssize_t w;
+        const Connection::OutSegment& head = conn->outq.front();
+        if (head.file_len) {
+            // Container range: page cache to socket without a user-space copy.
+            off_t off = (off_t)(head.file_offset + conn->out_off);
+            w = sendfile(conn->fd, container_fd_, &off, (size_t)std::min<uint64_t>(head.file_len - conn->out_off, 1u << 30));
+        } else {
+            // Memory segments up to the next file range; MSG_MORE lets the
+            // header share packets with the range that follows it.
+            struct iovec iov[Connection::MAX_IOV];
+            size_t cnt = 0;
+            bool more = false;
+            for (size_t i = 0; i < conn->outq.size() && cnt < Connection::MAX_IOV; ++i) {
+                const Connection::OutSegment& seg = conn->outq[i];
+                if (seg.file_len) { more = true; break; }
+                size_t skip = (i == 0) ? conn->out_off : 0;
+                iov[cnt].iov_base = const_cast<char*>(seg.bytes.data() + skip);
+                iov[cnt].iov_len = seg.bytes.size() - skip;
+                ++cnt;
             }
-            break;
+            struct msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+            w = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
         }
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (w <= 0) {
+            // Peer is gone (or the container came up short): drop the output
+            // and let the loop see the hangup.
+            for (auto& seg : conn->outq) retire_segment_locked(conn, seg);
+            conn->outq.clear();
+            conn->out_off = 0;
+            shutdown(conn->fd, SHUT_RDWR);
+            return;
+        }
+        // Retire fully written segments back to the pool.
+        size_t left = (size_t)w;
+        size_t done = 0;
+        while (done < conn->outq.size() && left > 0) {
+            size_t avail = conn->outq[done].size() - conn->out_off;
+            if (left < avail) { conn->out_off += left; left = 0; break; }
+            left -= avail;
+            conn->out_off = 0;
+            ++done;
+        }
+        for (size_t i = 0; i < done; ++i) retire_segment_locked(conn, conn->outq[i]);
+        conn->outq.erase(conn->outq.begin(), conn->outq.begin() + (std::ptrdiff_t)done);
     }
-    close(client_fd);
+    // Shutting down wakes the owning loop (EPOLLHUP), which does the close().
+    if (conn->close_after_flush && conn->inflight.load() == 0) shutdown(conn->fd, SHUT_RDWR);
 }
 
-// Worker thread: processes requests FIFO and sends JSON responses
-void FIFOService::worker_loop() {
-    while (running_) {
-        FSRequest req;
-        {
-            std::unique_lock<std::mutex> ul(queue_mutex_);
-            queue_cv_.wait(ul, [this]() { return !request_queue_.empty() || !running_; });
-            if (!running_) break;
-            req = request_queue_.front();
-            request_queue_.pop_front();
-        }
-
-    // Process request: dispatcher supports ping, user_login and user_list
-        std::string op = extract_json_string(req.raw, "operation");
-        std::string resp;
-        if (op == "ping") {
-            resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\",\"message\":\"pong\"}\n";
-        } else if (op == "user_login") {
-            // parameters: username, password
-            std::string username = extract_json_string(req.raw, "username");
-            std::string password = extract_json_string(req.raw, "password");
-            // operate on instance_ directly (no env var)
-            void* session = nullptr;
-            int r = user_login(instance_, &session, username.c_str(), password.c_str());
-            if (r == 0 && session) {
-                SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-                std::string token(s->session_id);
-                resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\",\"token\":\"" + token + "\"}";
-                delete s; // the core stored its own copy; this was a temporary copy
+// Decoded string field as a NUL-terminated copy in the request arena, for
+// the C API; "" when missing. Only values with escapes touch the heap.
+static const char* arena_field(const JsonView& jv, std::string_view key, BumpArena& arena) {
+    std::string scratch;
+    return arena.strdup(jv.str(key, scratch));
+}
+
+// Resolves the request token to a session copy in `sess`, allocated from the
+// request arena. Returns false (and writes the invalid_session error) when
+// the token is unknown. Inside a batch the batch's session is copied instead
+// of looking the token up again.
+static bool require_session(OFSInstance* inst, const JsonView& jv, std::string_view id, ResponseWriter& w, void** sess,
+                            const SessionInfo* batch_session, BumpArena& arena) {
+    if (batch_session) {
+        *sess = arena.make<SessionInfo>(*batch_session);
+        return true;
+    }
+    SessionInfo* s = arena.make<SessionInfo>();
+    *sess = nullptr;
+    if (get_session_into(inst, arena_field(jv, "token", arena), s) != 0) {
+        w.error(id, "invalid_session");
+        return false;
+    }
+    *sess = s;
+    return true;
+}
+
+// Unsigned integer field, sent either as a JSON number or a numeric string.
+static uint64_t json_u64(const JsonView& jv, std::string_view key, uint64_t dflt = 0) {
+    std::string_view v = jv.raw(key);
+    uint64_t out = 0;
+    auto r = std::from_chars(v.data(), v.data() + v.size(), out);
+    if (v.empty() || r.ec != std::errc() || r.ptr != v.data() + v.size()) return dflt;
+    return out;
+}
+
+// Largest piece a single download_chunk returns; clients loop until eof.
+static const size_t MAX_DOWNLOAD_CHUNK = 16u << 20;
+
+// Most entries one file_search returns, and how many when the request does
+// not say.
+static const uint64_t MAX_SEARCH_RESULTS = 10000;
+static const uint64_t DEFAULT_SEARCH_RESULTS = 100;
+
+// Binary reads at least this large are sent with sendfile() from the
+// container; below it one copy and a single writev are cheaper.
+static const uint64_t SENDFILE_MIN = 64u << 10;
+
+static uint64_t payload_bytes(const FilePayload& files) {
+    uint64_t n = 0;
+    for (int i = 0; i < files.count; ++i) n += files.extents[i].len;
+    return n;
+}
+
+// Executes one JSON operation and writes its result object (without the
+// closing brace) into w.
+void FIFOService::execute_json(const JsonView& jv, ResponseWriter& w, const SessionInfo* batch_session) {
+    uint64_t t0 = metrics_now_ns();
+    std::string_view id = jv.raw("request_id");
+    std::string op_scratch;
+    std::string_view op = jv.str("operation", op_scratch);
+    if (op == "ping") {
+        w.begin("success", id);
+        w.field("message", "pong");
+    } else if (op == "stats") {
+        // Admin only, like /metrics: the counters cover every user's requests.
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            if (reinterpret_cast<SessionInfo*>(sessptr)->user.role == UserRole::ADMIN) {
+                w.begin("success", id);
+                write_stats(w);
             } else {
-                resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"login_failed\"}";
+                w.error(id, "permission_denied");
             }
-        } else if (op == "user_list") {
-            // expect token in request body
-            std::string token = extract_json_string(req.raw, "token");
-            void* sessptr = nullptr;
-            int r = get_session_by_token(instance_, token.c_str(), &sessptr);
-            UserInfo* users = nullptr;
-            int count = 0;
-            if (r == 0 && sessptr) {
-                r = user_list(instance_, sessptr, &users, &count);
-                delete reinterpret_cast<SessionInfo*>(sessptr);
+        }
+    } else if (op == "trace_sample") {
+        // Admin only: trace one request in sample_every (0 turns tracing off).
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            SessionInfo* sess = reinterpret_cast<SessionInfo*>(sessptr);
+            if (sess->user.role == UserRole::ADMIN) {
+                trace_set_sample_every((uint32_t)json_u64(jv, "sample_every"));
+                w.begin("success", id);
             } else {
-                r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+                w.error(id, "permission_denied");
             }
+        }
+    } else if (op == "batch") {
+        if (batch_session) w.error(id, "not_allowed_in_batch");
+        else execute_batch(jv, w);
+    } else if (batch_session && op != "file_create" && op != "file_read" && op != "file_exists" &&
+               op != "file_delete" && op != "file_rename" && op != "dir_create" && op != "dir_list" &&
+               op != "dir_delete" && op != "dir_usage" && op != "file_search") {
+        // Batches cover filesystem operations only; anything else keeps its own request.
+        w.error(id, "not_allowed_in_batch");
+    } else if (op == "user_login") {
+        // parameters: username, password
+        const char* username = arena_field(jv, "username", arena_);
+        const char* password = arena_field(jv, "password", arena_);
+        // operate on instance_ directly (no env var)
+        void* session = nullptr;
+        int r = user_login(instance_, &session, username, password);
+        if (r == 0 && session) {
+            SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+            w.begin("success", id);
+            w.field("token", s->session_id);
+            delete s; // the core stored its own copy; this was a temporary copy
+        } else {
+            w.error(id, "login_failed");
+        }
+    } else if (op == "user_list") {
+        // expect token in request body
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            UserInfo* users = nullptr;
+            int count = 0;
+            int r = user_list_arena(instance_, sessptr, &arena_, &users, &count);
             if (r == 0) {
-                std::ostringstream oss;
-                oss << "{\"status\":\"success\",\"request_id\":\"" << req.id << "\",\"users\":[";
+                w.begin("success", id);
+                w.begin_array("users");
                 for (int i = 0; i < count; ++i) {
-                    if (i) oss << ",";
-                    oss << "{\"username\":\"" << users[i].username << "\",\"role\":\"" << (int)users[i].role << "\"}";
+                    w.begin_object();
+                    w.field("username", users[i].username);
+                    w.key("role");
+                    w.string(std::to_string((int)users[i].role));
+                    w.end_object();
                 }
-                oss << "]}";
-                resp = oss.str();
-                delete [] users;
+                w.end_array();
             } else {
-                resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"list_failed\"}";
+                w.error(id, "list_failed");
             }
-        } else {
-            // File and directory operations: require token
-            if (op == "file_create") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string path = extract_json_string(req.raw, "path");
-                std::string data = extract_json_string(req.raw, "data");
-                void* sessptr = nullptr;
-                int gr = get_session_by_token(instance_, token.c_str(), &sessptr);
-                if (gr != 0) {
-                    resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"invalid_session\"}";
-                } else {
-                    int cr = file_create(instance_, sessptr, path.c_str(), data.c_str(), data.size());
-                    delete reinterpret_cast<SessionInfo*>(sessptr);
-                    if (cr == 0) {
-                        resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\"}";
-                    } else {
-                        resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"create_failed\"}";
-                    }
-                }
-            } else if (op == "file_read") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string path = extract_json_string(req.raw, "path");
-                void* sessptr = nullptr;
-                int gr = get_session_by_token(instance_, token.c_str(), &sessptr);
-                if (gr != 0) {
-                    resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"invalid_session\"}";
-                } else {
-                    char* buf = nullptr; size_t sz = 0;
-                    int rr = file_read(instance_, sessptr, path.c_str(), &buf, &sz);
-                    delete reinterpret_cast<SessionInfo*>(sessptr);
-                    if (rr == 0) {
-                        std::string s(buf, sz);
-                        std::string esc;
-                        for (char c : s) {
-                            if (c == '\\') esc += "\\\\";
-                            else if (c == '"') esc += "\\\"";
-                            else if (c == '\n') esc += "\\n";
-                            else esc += c;
-                        }
-                        resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\",\"data\":\"" + esc + "\"}";
-                        delete [] buf;
-                    } else {
-                        resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"read_failed\"}";
-                    }
-                }
-            } else if (op == "file_delete") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string path = extract_json_string(req.raw, "path");
-                void* sessptr = nullptr;
-                int gr = get_session_by_token(instance_, token.c_str(), &sessptr);
-                if (gr != 0) {
-                    resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"invalid_session\"}";
-                } else {
-                    int dr = file_delete(instance_, sessptr, path.c_str());
-                    delete reinterpret_cast<SessionInfo*>(sessptr);
-                    if (dr == 0) resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\"}";
-                    else resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"delete_failed\"}";
-                }
-            } else if (op == "dir_create") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string path = extract_json_string(req.raw, "path");
-                void* sessptr = nullptr;
-                int gr = get_session_by_token(instance_, token.c_str(), &sessptr);
-                if (gr != 0) {
-                    resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"invalid_session\"}";
-                } else {
-                    int dc = dir_create(instance_, sessptr, path.c_str());
-                    delete reinterpret_cast<SessionInfo*>(sessptr);
-                    if (dc == 0) resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\"}";
-                    else resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"mkdir_failed\"}";
-                }
-            } else if (op == "dir_list") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string path = extract_json_string(req.raw, "path");
-                void* sessptr = nullptr;
-                int gr = get_session_by_token(instance_, token.c_str(), &sessptr);
-                if (gr != 0) {
-                    resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"invalid_session\"}";
-                } else {
-                    FileEntry* entries = nullptr; int cnt = 0;
-                    int dl = dir_list(instance_, sessptr, path.c_str(), &entries, &cnt);
-                    delete reinterpret_cast<SessionInfo*>(sessptr);
-                    if (dl == 0) {
-                        std::ostringstream oss;
-                        oss << "{\"status\":\"success\",\"request_id\":\"" << req.id << "\",\"entries\":[";
-                        for (int i = 0; i < cnt; ++i) {
-                            if (i) oss << ",";
-                            oss << "{\"name\":\"" << entries[i].name << "\",\"type\":\"" << (int)entries[i].type << "\"}";
-                        }
-                        oss << "]}";
-                        resp = oss.str();
-                        if (entries) delete [] entries;
-                    } else {
-                        resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"list_failed\"}";
-                    }
+        }
+    } else if (op == "file_create") {
+        // File and directory operations: require token
+        const char* path = arena_field(jv, "path", arena_);
+        std::string data_scratch;
+        std::string_view data = jv.str("data", data_scratch);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int cr = file_create(instance_, sessptr, path, data.data(), data.size());
+            if (cr == 0) w.begin("success", id);
+            else w.error(id, "create_failed");
+        }
+    } else if (op == "file_read") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            char* buf = nullptr; size_t sz = 0;
+            int rr = file_read_arena(instance_, sessptr, path, &arena_, &buf, &sz);
+            if (rr == 0) {
+                w.begin("success", id);
+                w.bulk_string("data", std::string_view(buf, sz));
+            } else {
+                w.error(id, "read_failed");
+            }
+        }
+    } else if (op == "file_exists") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int er = file_exists(instance_, sessptr, path);
+            w.begin("success", id);
+            w.key("exists");
+            w.raw(er == 0 ? "true" : "false");
+        }
+    } else if (op == "file_delete") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int dr = file_delete(instance_, sessptr, path);
+            if (dr == 0) w.begin("success", id);
+            else w.error(id, "delete_failed");
+        }
+    } else if (op == "file_rename") {
+        // parameters: path, new_path
+        const char* path = arena_field(jv, "path", arena_);
+        const char* new_path = arena_field(jv, "new_path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int mr = file_rename(instance_, sessptr, path, new_path);
+            if (mr == 0) w.begin("success", id);
+            else w.error(id, "rename_failed");
+        }
+    } else if (op == "dir_create") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int dc = dir_create(instance_, sessptr, path);
+            if (dc == 0) w.begin("success", id);
+            else w.error(id, "mkdir_failed");
+        }
+    } else if (op == "dir_list") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            FileEntry* entries = nullptr; int cnt = 0;
+            int dl = dir_list_arena(instance_, sessptr, path, &arena_, &entries, &cnt);
+            if (dl == 0) {
+                w.begin("success", id);
+                w.begin_array("entries");
+                for (int i = 0; i < cnt; ++i) {
+                    w.begin_object();
+                    w.field("name", entries[i].name);
+                    w.key("type");
+                    w.string(entries[i].type ? "1" : "0");
+                    w.end_object();
                 }
-            } else if (op == "user_create") {
-                std::string token = extract_json_string(req.raw, "token");
-                std::string username = extract_json_string(req.raw, "username");
-                std::string password = extract_json_string(req.raw, "password");
-                std::string role_s = extract_json_string(req.raw, "role");
-                UserRole role = UserRole::NORMAL;
-                if (role_s == "admin" || role_s == "ADMIN" || role_s == "1") role = UserRole::ADMIN;
-                void* admin_sess = nullptr;
-                if (!token.empty()) {
-                    int gr = get_session_by_token(instance_, token.c_str(), &admin_sess);
-                    if (gr != 0) admin_sess = nullptr;
+                w.end_array();
+            } else {
+                w.error(id, "list_failed");
+            }
+        }
+    } else if (op == "dir_delete") {
+        // parameters: path, recursive (default false)
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int dd = dir_delete(instance_, sessptr, path, jv.raw("recursive") == "true" ? 1 : 0);
+            if (dd == 0) w.begin("success", id);
+            else if (dd == static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY)) w.error(id, "directory_not_empty");
+            else w.error(id, "rmdir_failed");
+        }
+    } else if (op == "dir_usage") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            DirUsage u;
+            int du = dir_usage(instance_, sessptr, path, &u);
+            if (du == 0) {
+                w.begin("success", id);
+                w.field("bytes", u.bytes);
+                w.field("blocks", u.blocks);
+                w.field("files", u.files);
+                w.field("dirs", u.dirs);
+            } else {
+                w.error(id, "usage_failed");
+            }
+        }
+    } else if (op == "file_search") {
+        // parameters: pattern, glob (default false), limit
+        const char* pattern = arena_field(jv, "pattern", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            uint64_t limit = std::min(json_u64(jv, "limit", DEFAULT_SEARCH_RESULTS), MAX_SEARCH_RESULTS);
+            if (limit == 0) limit = DEFAULT_SEARCH_RESULTS;
+            FileEntry* entries = nullptr; int cnt = 0;
+            int fs = file_search_arena(instance_, sessptr, pattern, jv.raw("glob") == "true" ? 1 : 0, (int)limit, &arena_,
+                                       &entries, &cnt);
+            if (fs == 0) {
+                w.begin("success", id);
+                w.begin_array("entries");
+                for (int i = 0; i < cnt; ++i) {
+                    w.begin_object();
+                    w.field("name", entries[i].name);
+                    w.key("type");
+                    w.string(entries[i].type ? "1" : "0");
+                    w.end_object();
                 }
-                int uc = user_create(instance_, admin_sess, username.c_str(), password.c_str(), role);
-                if (admin_sess) delete reinterpret_cast<SessionInfo*>(admin_sess);
-                if (uc == 0) resp = "{\"status\":\"success\",\"request_id\":\"" + req.id + "\"}";
-                else resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"create_failed\"}";
+                w.end_array();
+            } else {
+                w.error(id, "search_failed");
+            }
+        }
+    } else if (op == "upload_open") {
+        // Chunked upload: upload_open -> upload_chunk* -> upload_commit | upload_abort
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            uint64_t handle = 0;
+            int r = file_upload_open(instance_, sessptr, path, &handle);
+            if (r == 0) { w.begin("success", id); w.field("handle", handle); }
+            else w.error(id, "upload_failed");
+        }
+    } else if (op == "upload_chunk") {
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            std::string data_scratch;
+            std::string_view data = jv.str("data", data_scratch);
+            uint64_t size = 0;
+            int r = file_upload_write(instance_, sessptr, json_u64(jv, "handle"), json_u64(jv, "offset"),
+                                      data.data(), data.size(), &size);
+            // On an offset mismatch the client resumes from the reported size.
+            if (r == 0) w.begin("success", id);
+            else w.error(id, r == static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) ? "bad_offset" : "upload_failed");
+            w.field("size", size);
+        }
+    } else if (op == "upload_commit" || op == "upload_abort") {
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            uint64_t handle = json_u64(jv, "handle");
+            int r = op == "upload_commit" ? file_upload_commit(instance_, sessptr, handle)
+                                          : file_upload_abort(instance_, sessptr, handle);
+            if (r == 0) w.begin("success", id);
+            else w.error(id, "upload_failed");
+        }
+    } else if (op == "download_open") {
+        const char* path = arena_field(jv, "path", arena_);
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            uint64_t handle = 0, size = 0;
+            int r = file_download_open(instance_, sessptr, path, &handle, &size);
+            if (r == 0) {
+                w.begin("success", id);
+                w.field("handle", handle);
+                w.field("size", size);
+            } else {
+                w.error(id, "download_failed");
+            }
+        }
+    } else if (op == "download_chunk") {
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            size_t len = (size_t)std::min<uint64_t>(json_u64(jv, "length", MAX_DOWNLOAD_CHUNK), MAX_DOWNLOAD_CHUNK);
+            char* buf = arena_.alloc_array<char>(len);
+            size_t got = 0;
+            int r = file_download_read(instance_, sessptr, json_u64(jv, "handle"), json_u64(jv, "offset"),
+                                       buf, len, &got);
+            if (r == 0) {
+                w.begin("success", id);
+                w.field("length", (uint64_t)got);
+                w.bulk_string("data", std::string_view(buf, got));
             } else {
-                resp = "{\"status\":\"error\",\"request_id\":\"" + req.id + "\",\"error\":\"unknown_operation\"}";
+                w.error(id, "download_failed");
             }
         }
+    } else if (op == "download_close") {
+        void* sessptr = nullptr;
+        if (require_session(instance_, jv, id, w, &sessptr, batch_session, arena_)) {
+            int r = file_download_close(instance_, sessptr, json_u64(jv, "handle"));
+            if (r == 0) w.begin("success", id);
+            else w.error(id, "download_failed");
+        }
+    } else if (op == "user_create") {
+        const char* token = arena_field(jv, "token", arena_);
+        const char* username = arena_field(jv, "username", arena_);
+        const char* password = arena_field(jv, "password", arena_);
+        std::string_view role_s = arena_field(jv, "role", arena_);
+        UserRole role = UserRole::NORMAL;
+        if (role_s == "admin" || role_s == "ADMIN" || role_s == "1") role = UserRole::ADMIN;
+        SessionInfo* admin_sess = nullptr;
+        if (*token) {
+            admin_sess = arena_.make<SessionInfo>();
+            if (get_session_into(instance_, token, admin_sess) != 0) admin_sess = nullptr;
+        }
+        int uc = user_create(instance_, admin_sess, username, password, role);
+        if (uc == 0) w.begin("success", id);
+        else w.error(id, "create_failed");
+    } else {
+        w.error(id, "unknown_operation");
+    }
+    record_op(op, t0, w.failed());
+}
 
-        if (req.is_http && req.pending) {
-            Pending* p = reinterpret_cast<Pending*>(req.pending);
-            {
-                std::lock_guard<std::mutex> lg(p->m);
-                p->response = resp;
-                p->done = true;
+// {"operation":"batch","token":...,"atomic":true,"ops":[{...},...]}
+// Runs the sub-operations back to back under one session lookup and one
+// core batch, so their metadata is persisted once at the end. Each result is
+// the sub-operation's usual response object. With "atomic":true the first
+// failing operation stops the batch and nothing it did is kept.
+void FIFOService::execute_batch(const JsonView& jv, ResponseWriter& w) {
+    std::string_view id = jv.raw("request_id");
+    void* sessptr = nullptr;
+    if (!require_session(instance_, jv, id, w, &sessptr, nullptr, arena_)) return;
+    const SessionInfo* sess = reinterpret_cast<SessionInfo*>(sessptr);
+    const JsonView::Field* ops = jv.find("ops");
+    if (!ops || ops->kind != JsonView::Kind::RAW) {
+        w.error(id, "invalid_batch");
+        return;
+    }
+    bool atomic = jv.raw("atomic") == "true";
+
+    // Sub-results are rendered into scratch buffers, then copied into w.
+    std::string results, sub[3];
+    size_t count = 0, failed_index = 0;
+    bool failed = false;
+    fs_batch_begin(instance_);
+    bool well_formed = JsonView::for_each_element(ops->value, [&](std::string_view op_json) {
+        if (failed && atomic) return;
+        ResponseWriter sw(&sub[0], &sub[1], &sub[2]);
+        JsonView sv;
+        if (sv.parse(op_json)) execute_json(sv, sw, sess);
+        else sw.error(std::string_view(), "invalid_json");
+        sw.end(false);
+        if (count > 0) results += ',';
+        for (const std::string& seg : sub) results += seg;
+        if (sw.failed() && !failed) { failed = true; failed_index = count; }
+        ++count;
+    });
+    bool commit = well_formed && !(atomic && failed);
+    fs_batch_end(instance_, commit ? 1 : 0);
+
+    if (!well_formed) {
+        w.error(id, "invalid_batch");
+        return;
+    }
+    if (commit) w.begin("success", id);
+    else w.error(id, "batch_aborted");
+    if (failed) w.field("failed_index", (uint64_t)failed_index);
+    w.key("results");
+    w.raw("[");
+    w.raw(results);
+    w.raw("]");
+}
+
+// Binary frames: parameters come from the JSON meta, file bytes travel
+// verbatim in the payload. The response header goes in segs[0], an optional
+// JSON meta in segs[1..3] and the bytes read in segs[3], or, for reads of
+// SENDFILE_MIN and up, as container ranges in `files`.
+void FIFOService::execute_binary(FSRequest& req, std::string* segs, FilePayload& files) {
+    const BinHeader& h = req.bin;
+    std::string_view meta(req.raw.data() + sizeof(BinHeader), h.meta_len);
+    std::string_view payload(meta.data() + h.meta_len, (size_t)h.payload_len);
+    BinOpcode op = static_cast<BinOpcode>(h.opcode);
+    uint64_t t0 = metrics_now_ns();
+    int status = 0;
+    std::string* data = nullptr;  // FILE_READ result
+    ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+    bool wrote_meta = false;
+
+    JsonView jv;
+    if (!jv.parse(meta.empty() ? std::string_view("{}") : meta)) {
+        status = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        w.error(std::string_view(), "invalid_json");
+        wrote_meta = true;
+    } else if (op == BinOpcode::PING) {
+        // nothing to do
+    } else if (op == BinOpcode::JSON) {
+        execute_json(jv, w);
+        wrote_meta = true;
+    } else if (op == BinOpcode::FILE_WRITE || op == BinOpcode::FILE_READ ||
+               op == BinOpcode::UPLOAD_CHUNK || op == BinOpcode::DOWNLOAD_CHUNK) {
+        const char* path = arena_field(jv, "path", arena_);
+        SessionInfo* sessptr = arena_.make<SessionInfo>();
+        if (get_session_into(instance_, arena_field(jv, "token", arena_), sessptr) != 0) {
+            status = static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+            w.error(jv.raw("request_id"), "invalid_session");
+            wrote_meta = true;
+        } else if (op == BinOpcode::FILE_WRITE) {
+            status = file_create(instance_, sessptr, path, payload.data(), payload.size());
+            if (status != 0) { w.error(jv.raw("request_id"), "create_failed"); wrote_meta = true; }
+        } else if (op == BinOpcode::UPLOAD_CHUNK) {
+            uint64_t size = 0;
+            status = file_upload_write(instance_, sessptr, json_u64(jv, "handle"), json_u64(jv, "offset"),
+                                       payload.data(), payload.size(), &size);
+            if (status == 0) w.begin("success", jv.raw("request_id"));
+            else w.error(jv.raw("request_id"), "upload_failed");
+            w.field("size", size);
+            wrote_meta = true;
+        } else if (op == BinOpcode::DOWNLOAD_CHUNK) {
+            size_t len = (size_t)std::min<uint64_t>(json_u64(jv, "length", MAX_DOWNLOAD_CHUNK), MAX_DOWNLOAD_CHUNK);
+            if (len >= SENDFILE_MIN) {
+                FileExtent* ext = nullptr;
+                status = file_download_map(instance_, sessptr, json_u64(jv, "handle"), json_u64(jv, "offset"), len, &arena_,
+                                           &ext, &files.count, &files.hold);
+                files.extents = ext;
+                if (status != 0) {
+                    w.error(jv.raw("request_id"), "download_failed");
+                    wrote_meta = true;
+                }
+            } else {
+                data = &segs[3];
+                data->resize(len);
+                size_t got = 0;
+                status = file_download_read(instance_, sessptr, json_u64(jv, "handle"), json_u64(jv, "offset"),
+                                            &(*data)[0], len, &got);
+                data->resize(got);
+                if (status != 0) {
+                    data = nullptr;
+                    w.error(jv.raw("request_id"), "download_failed");
+                    wrote_meta = true;
+                }
             }
-            p->cv.notify_one();
         } else {
-            std::string out = resp + "\n";
-            send(req.client_fd, out.c_str(), out.size(), 0);
+            // Size the buffer from the current version, then read straight
+            // into it; retry if a writer published a new size in between.
+            data = &segs[3];
+            for (int attempt = 0; attempt < 4; ++attempt) {
+                uint64_t size = 0;
+                size_t got = 0;
+                status = file_read_range(instance_, sessptr, path, 0, nullptr, 0, &got, &size);
+                if (status != 0) break;
+                if (size >= SENDFILE_MIN) {
+                    // Large: send the version current now from the container instead.
+                    FileExtent* ext = nullptr;
+                    status = file_map_range(instance_, sessptr, path, 0, UINT64_MAX, &arena_, &ext, &files.count, &size, &files.hold);
+                    files.extents = ext;
+                    data = nullptr;
+                    break;
+                }
+                data->resize((size_t)size);
+                uint64_t size_now = 0;
+                status = file_read_range(instance_, sessptr, path, 0, &(*data)[0], data->size(), &got, &size_now);
+                if (status != 0 || size_now == size) break;
+            }
+            if (status != 0) {
+                if (data) data->clear();
+                data = nullptr;
+                files = FilePayload();
+                w.error(jv.raw("request_id"), "read_failed");
+                wrote_meta = true;
+            }
         }
+    } else {
+        status = static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
+        w.error(std::string_view(), "unknown_operation");
+        wrote_meta = true;
+    }
+    if (wrote_meta) w.end(false);
+    // Read payloads went into segs[3] (which the writer only uses after
+    // bulk_string()) or into `files`.
+    bool raw = data || files.hold;
+    size_t meta_len = raw ? segs[1].size() : w.size();
+    uint64_t payload_len = data ? data->size() : payload_bytes(files);
+    append_bin_header(segs[0], make_bin_header(op, h.request_id, (uint32_t)meta_len, payload_len, (int16_t)status));
+    // JSON frames were recorded by execute_json under their own operation.
+    static const char* const bin_names[] = {"other", "bin_ping", "bin_file_write", "bin_file_read", "other",
+                                            "bin_upload_chunk", "bin_download_chunk"};
+    if (op != BinOpcode::JSON)
+        record_op(h.opcode < 7 ? bin_names[h.opcode] : "other", t0, status != 0);
+}
+
+void FIFOService::record_op(std::string_view op, uint64_t t0_ns, bool failed) {
+    OpStats& st = op_stats_[op_index(op)];
+    st.exec.record(metrics_now_ns() - t0_ns);
+    if (failed) st.errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void append_u64(std::string& out, uint64_t v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, (size_t)(r.ptr - buf));
+}
+
+// One Prometheus histogram series. Buckets are reported from 1us to ~34s
+// (2^10..2^35 ns); the +Inf bucket carries the rest.
+static void append_prom_histogram(std::string& out, const char* name, const char* labels, const LatencyHistogram& h) {
+    uint64_t cum = 0;
+    for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+        cum += h.buckets[i].load(std::memory_order_relaxed);
+        if (i < 9 || i > 34) continue;
+        char le[32];
+        snprintf(le, sizeof(le), "%.9g", (double)(2ull << i) / 1e9);
+        out.append(name).append("_bucket{").append(labels);
+        if (*labels) out += ',';
+        out.append("le=\"").append(le).append("\"} ");
+        append_u64(out, cum);
+        out += '\n';
+    }
+    out.append(name).append("_bucket{").append(labels);
+    if (*labels) out += ',';
+    out.append("le=\"+Inf\"} ");
+    append_u64(out, cum);
+    out += '\n';
+    char sum[32];
+    snprintf(sum, sizeof(sum), "%.9g", (double)h.sum_ns.load(std::memory_order_relaxed) / 1e9);
+    std::string tags = *labels ? std::string("{") + labels + "} " : std::string(" ");
+    out.append(name).append("_sum").append(tags).append(sum).append("\n");
+    out.append(name).append("_count").append(tags);
+    append_u64(out, cum);
+    out += '\n';
+}
+
+static void append_prom_value(std::string& out, const char* type, const char* name, uint64_t v) {
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n").append(name).append(" ");
+    append_u64(out, v);
+    out += '\n';
+}
+
+// Prometheus text exposition format (version 0.0.4).
+void FIFOService::render_metrics(std::string& out) {
+    size_t depth;
+    {
+        std::lock_guard<std::mutex> lg(queue_mutex_);
+        depth = request_queue_.size() + read_queue_.size() + held_count_;
+    }
+    out.append("# TYPE ofs_request_duration_seconds histogram\n");
+    std::string labels;
+    for (int i = 0; i < OP_COUNT; ++i) {
+        if (op_stats_[i].exec.count() == 0) continue;
+        labels.assign("op=\"").append(OP_NAMES[i]).append("\"");
+        append_prom_histogram(out, "ofs_request_duration_seconds", labels.c_str(), op_stats_[i].exec);
+    }
+    out.append("# TYPE ofs_request_errors_total counter\n");
+    for (int i = 0; i < OP_COUNT; ++i) {
+        if (op_stats_[i].exec.count() == 0) continue;
+        out.append("ofs_request_errors_total{op=\"").append(OP_NAMES[i]).append("\"} ");
+        append_u64(out, op_stats_[i].errors.load(std::memory_order_relaxed));
+        out += '\n';
+    }
+    struct { const char* name; const LatencyHistogram* h; } hists[] = {
+        {"ofs_queue_wait_seconds", &queue_wait_},
+        {"ofs_response_send_seconds", &send_},
+        {"ofs_io_read_seconds", &g_core_metrics.io_read},
+        {"ofs_io_write_seconds", &g_core_metrics.io_write},
+        {"ofs_metadata_persist_seconds", &g_core_metrics.metadata_persist},
+    };
+    for (auto& e : hists) {
+        out.append("# TYPE ").append(e.name).append(" histogram\n");
+        append_prom_histogram(out, e.name, "", *e.h);
+    }
+    append_prom_value(out, "counter", "ofs_io_read_bytes_total", g_core_metrics.bytes_read.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_io_written_bytes_total", g_core_metrics.bytes_written.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_checksum_errors_total", g_core_metrics.checksum_errors.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_scrub_bytes_total", g_core_metrics.scrub_bytes.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_scrub_passes_total", g_core_metrics.scrub_passes.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_rejected_busy_total", rejected_busy_.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_rejected_timeout_total", rejected_timeout_.load(std::memory_order_relaxed));
+    append_prom_value(out, "counter", "ofs_rejected_connections_total", rejected_connections_.load(std::memory_order_relaxed));
+    append_prom_value(out, "gauge", "ofs_open_connections", (uint64_t)open_connections_.load());
+    append_prom_value(out, "gauge", "ofs_queue_depth", depth);
+}
+
+static void write_histogram_summary(ResponseWriter& w, const LatencyHistogram& h) {
+    uint64_t n = h.count();
+    w.field("count", n);
+    w.field("mean_ns", n ? h.sum_ns.load(std::memory_order_relaxed) / n : (uint64_t)0);
+    w.field("p50_ns", h.quantile_ns(0.50));
+    w.field("p99_ns", h.quantile_ns(0.99));
+    w.field("p999_ns", h.quantile_ns(0.999));
+}
+
+// Body of the "stats" operation: the same data as /metrics, summarized.
+// Percentiles are bucket upper bounds (within 2x).
+void FIFOService::write_stats(ResponseWriter& w) {
+    w.field("uptime_s", (uint64_t)((steady_ms() - started_ms_) / 1000));
+    w.field("open_connections", (uint64_t)open_connections_.load());
+    w.field("rejected_busy", rejected_busy_.load(std::memory_order_relaxed));
+    w.field("rejected_timeout", rejected_timeout_.load(std::memory_order_relaxed));
+    w.field("checksum_errors", g_core_metrics.checksum_errors.load(std::memory_order_relaxed));
+    w.field("scrub_passes", g_core_metrics.scrub_passes.load(std::memory_order_relaxed));
+    w.begin_array("ops");
+    for (int i = 0; i < OP_COUNT; ++i) {
+        if (op_stats_[i].exec.count() == 0) continue;
+        w.begin_object();
+        w.field("op", OP_NAMES[i]);
+        w.field("errors", op_stats_[i].errors.load(std::memory_order_relaxed));
+        write_histogram_summary(w, op_stats_[i].exec);
+        w.end_object();
+    }
+    w.end_array();
+    struct { const char* name; const LatencyHistogram* h; } hists[] = {
+        {"queue_wait", &queue_wait_}, {"response_send", &send_}, {"io_read", &g_core_metrics.io_read},
+        {"io_write", &g_core_metrics.io_write}, {"metadata_persist", &g_core_metrics.metadata_persist},
+    };
+    w.begin_array("latency");
+    for (auto& e : hists) {
+        w.begin_object();
+        w.field("name", e.name);
+        write_histogram_summary(w, *e.h);
+        w.end_object();
+    }
+    w.end_array();
+}
+
+// Frames every complete binary request in the connection buffer. A frame
+// that fills the whole buffer (the common case for large uploads) is handed
+// to the worker by swapping buffers rather than copying.
+bool FIFOService::parse_binary_frames(const std::shared_ptr<Connection>& conn) {
+    std::string& in = conn->inbuf;
+    size_t start = 0;
+    while (in.size() - start >= sizeof(BinHeader)) {
+        BinHeader h;
+        std::memcpy(&h, in.data() + start, sizeof(h));
+        if (std::memcmp(h.magic, BIN_MAGIC, sizeof(h.magic)) != 0) return false;
+        if (h.meta_len > BIN_MAX_META || h.payload_len > BIN_MAX_PAYLOAD) {
+            reject_input(conn, &h);  // answered after the frames before it
+            return true;
+        }
+        size_t frame = sizeof(BinHeader) + h.meta_len + (size_t)h.payload_len;
+        if (in.size() - start < frame) break;
+        FSRequest req;
+        take_buffers(conn.get(), &req.raw, 1);
+        if (start == 0 && in.size() == frame) req.raw.swap(in);
+        else req.raw.assign(in, start, frame);
+        req.conn = conn;
+        req.is_binary = true;
+        req.bin = h;
+        req.seq = conn->next_seq++;
+        enqueue(std::move(req));
+        if (in.empty()) { start = 0; break; }
+        start += frame;
+    }
+    // A partial frame waits for the rest; the buffer grows as it arrives
+    // rather than being sized from the header's lengths.
+    if (start > 0) in.erase(0, start);
+    return true;
+}
+
+// Worker threads: the worker (read_lane false) runs its queue FIFO; read
+// workers take read_queue_. Both send the responses themselves.
+void FIFOService::worker_loop(bool read_lane) {
+    trace_thread_name(read_lane ? "read_worker" : "worker");
+    RequestRing& queue = read_lane ? read_queue_ : request_queue_;
+    std::condition_variable& cv = read_lane ? read_cv_ : queue_cv_;
+    while (running_) {
+        FSRequest req;
+        {
+            std::unique_lock<std::mutex> ul(queue_mutex_);
+            cv.wait(ul, [this, &queue]() { return !queue.empty() || !running_; });
+            if (!running_) break;
+            req = std::move(queue.front());
+            queue.pop_front();
+        }
+        TraceScope scope(req.trace_id);
+        if (req.trace_id) {
+            trace_emit("queue_wait", 'b', req.enqueued_ns, req.trace_id);
+            trace_emit("queue_wait", 'e', metrics_now_ns(), req.trace_id);
+        }
+        process_request(req);
+        // Everything the request borrowed goes back in one step.
+        arena_.reset();
+        recycle_request(req);
+        finish_request(req);
+        if (req.trace_id) trace_emit("request", 'e', metrics_now_ns(), req.trace_id);
+    }
+}
+
+// Runs one dequeued request and sends its response.
+void FIFOService::process_request(FSRequest& req) {
+    uint64_t waited_ns = metrics_now_ns() - req.enqueued_ns;
+    queue_wait_.record(waited_ns);
+    // Stale requests are dropped rather than executed: the client has
+    // likely given up, and running them only delays the fresh ones.
+    if (queue_timeout_ms_ > 0 && (int64_t)(waited_ns / 1000000) > queue_timeout_ms_) {
+        rejected_timeout_.fetch_add(1, std::memory_order_relaxed);
+        send_error(req, "timeout", BIN_STATUS_TIMEOUT);
+        return;
+    }
+
+    // segs[0] = HTTP headers / binary frame header, segs[1..3] = JSON head / bulk data / tail
+    std::string segs[4];
+    take_buffers(req.conn.get(), segs, 4);
+    if (req.is_binary) {
+        FilePayload files;
+        {
+            TraceSpan span("execute");
+            execute_binary(req, segs, files);
+        }
+        TraceSpan span("send");
+        ScopedLatency timed(send_);
+        send_segments(req.conn, req.seq, segs, 4, false, true, &files);
+        return;
+    }
+    ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+
+    // Parse once; every handler reads fields from this view.
+    JsonView jv;
+    bool parsed;
+    {
+        TraceSpan span("parse");
+        parsed = jv.parse(req.raw);
+    }
+    if (parsed) {
+        TraceSpan span("execute");
+        execute_json(jv, w);
+    } else {
+        w.error(std::string_view(), "invalid_json");
+    }
+    w.end(!req.is_http);
+
+    if (req.is_http) {
+        std::string& head = segs[0];
+        head.append("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: ");
+        char num[24];
+        auto r = std::to_chars(num, num + sizeof(num), (uint64_t)w.size());
+        head.append(num, (size_t)(r.ptr - num));
+        head.append(req.close_after ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n");
     }
+    TraceSpan span("send");
+    ScopedLatency timed(send_);
+    send_segments(req.conn, req.seq, segs, 4, req.close_after, true);
 }
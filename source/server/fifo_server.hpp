@@ -5,16 +5,128 @@
 #include <thread>
 #include <mutex>
 #include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <map>
 #include <condition_variable>
 #include "../include/omni_core.hpp"
+#include "../include/metrics.hpp"
+#include "../include/trace.hpp"
+#include "bin_protocol.hpp"
+#include "capture.hpp"
+
+class JsonView;
+class ResponseWriter;
+struct FSRequest;
+
+// Per-socket state. Owned by the event loop that accepted it; the worker holds
+// a shared_ptr only to write the response back. The fd is only ever closed by
+// the owning loop, after `closed` is set under out_mutex.
+struct Connection {
+    enum class Protocol { UNKNOWN, JSON_LINES, HTTP, BINARY };
+    int fd = -1;
+    uint32_t id = 0;                // accept order, for request captures
+    Protocol proto = Protocol::UNKNOWN;
+    std::string inbuf;              // loop thread only
+    bool input_closed = false;      // loop thread only: stop framing (HTTP "Connection: close", input refused)
+    uint64_t next_seq = 0;          // loop thread only: sequence of the next framed request
+    int64_t last_active_ms = 0;     // loop thread only: for the HTTP idle timeout
+    size_t buffered = 0;            // loop thread only: inbuf bytes counted in FIFOService::buffered_input_
+
+    static const size_t MAX_IOV = 64;
+    static const size_t MAX_SPARE = 8;
+    static const size_t MAX_SPARE_BYTES = 4u << 20;
+    static const size_t MIN_BUFFER = 1024;  // every pooled buffer holds a small request or response
+
+    // A response segment: bytes in memory, or (file_len > 0) a range of the
+    // container sent with sendfile(). A zero-copy response's last segment
+    // carries its map hold, released once it is sent or dropped.
+    struct OutSegment {
+        std::string bytes;
+        uint64_t file_offset = 0;
+        uint64_t file_len = 0;
+        uint64_t hold = 0;
+        size_t size() const { return file_len ? (size_t)file_len : bytes.size(); }
+    };
+
+    std::mutex out_mutex;
+    std::vector<OutSegment> outq;   // unsent response segments, sent with writev/sendfile
+    size_t out_off = 0;             // bytes of outq.front() already sent
+    std::vector<std::string> spare; // cleared buffers reused for later responses
+    // Pipelined requests are answered in arrival order: a response that is
+    // ready before its predecessors is parked until send_seq reaches it.
+    struct Parked {
+        std::vector<OutSegment> segs;
+        bool close_after = false;
+    };
+    uint64_t send_seq = 0;
+    std::map<uint64_t, Parked> parked;
+    bool close_after_flush = false;
+    bool closed = false;
+    std::atomic<int> inflight{0};   // requests queued but not yet answered
+
+    // Reads run on the read workers only while no write of this connection is
+    // queued, and a write waits in `held` until the connection's reads are
+    // done, so each request still sees exactly the writes sent before it.
+    // Guarded by FIFOService::queue_mutex_.
+    int reads_running = 0;          // on the read lane: queued or executing
+    int writes_queued = 0;          // on the worker's lane: queued or executing
+    std::vector<FSRequest> held;    // arrival order; released when reads_running drops to 0
+};
 
 // Simple request/response wrapper
 struct FSRequest {
-    std::string raw;   // raw JSON request
-    int client_fd;     // socket fd to reply to
+    std::string raw;   // raw JSON request, or the whole frame for binary requests
+    std::shared_ptr<Connection> conn;  // connection to reply to
     std::string id;    // request_id if present
     bool is_http = false;
-    void* pending = nullptr; // pointer to Pending when used for HTTP
+    bool close_after = false;  // HTTP: close once this response is sent
+    uint64_t seq = 0;          // position among this connection's requests
+    bool is_binary = false;
+    BinHeader bin;             // binary requests: the frame header
+    uint64_t enqueued_ns = 0;  // queue deadline and queue-wait histogram
+    uint64_t trace_id = 0;     // nonzero when this request is sampled for tracing
+    bool read_lane = false;    // queued for the read workers
+};
+
+// FIFO of queued requests. Slots are reused, so once the ring has grown to
+// the working depth, queueing a request moves it into an existing slot
+// instead of allocating (std::deque allocated a node every few requests).
+class RequestRing {
+public:
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+    void push_back(FSRequest&& req) {
+        if (count_ == slots_.size()) grow();
+        slots_[(head_ + count_) % slots_.size()] = std::move(req);
+        ++count_;
+    }
+    FSRequest& front() { return slots_[head_]; }
+    void pop_front() {
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+    }
+
+private:
+    void grow() {
+        std::vector<FSRequest> bigger(slots_.empty() ? 64 : slots_.size() * 2);
+        for (size_t i = 0; i < count_; ++i) bigger[i] = std::move(slots_[(head_ + i) % slots_.size()]);
+        slots_.swap(bigger);
+        head_ = 0;
+    }
+    std::vector<FSRequest> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+};
+
+// Payload of a zero-copy read: container ranges (and copied inline tails) in
+// file order, sent after the response's memory segments. See file_map_range.
+struct FilePayload {
+    const FileExtent* extents = nullptr;
+    int count = 0;
+    uint64_t hold = 0;
 };
 
 struct FSResponse {
@@ -24,9 +136,30 @@ struct FSResponse {
 
 class FIFOService {
 public:
-    FIFOService(int port, OFSInstance* inst);
+    FIFOService(int port, OFSInstance* inst, int loop_threads = 0);
     ~FIFOService();
 
+    // Idle keep-alive HTTP connections are closed after this many seconds.
+    void set_http_idle_timeout(int seconds) { http_idle_timeout_ms_ = (int64_t)seconds * 1000; }
+
+    // Admission control. At most `depth` requests wait for the worker; beyond
+    // that new requests are answered "busy" right away. A request that waited
+    // longer than `timeout_seconds` is answered "timeout" instead of executed.
+    void set_queue_limits(size_t depth, int timeout_seconds) {
+        max_queue_depth_ = depth;
+        queue_timeout_ms_ = (int64_t)timeout_seconds * 1000;
+    }
+    // Trace one request in `every` (0 = off); dump with GET /trace.
+    void set_trace_sampling(uint32_t every) { trace_set_sample_every(every); }
+    // Threads serving read-only requests beside the worker (<= 0: one per
+    // core, at most 4). Call before start().
+    void set_read_workers(int n) { read_workers_ = n; }
+    // Connections beyond this many are closed on accept (0 = unlimited).
+    void set_max_connections(int n) { max_connections_ = n; }
+    // Record every framed request to `path` (see capture.hpp); replay it with
+    // tools/fs_replay. Call before start().
+    bool set_capture(const char* path);
+
     // start listening (background thread)
     bool start();
 
@@ -34,32 +167,99 @@ public:
     void stop();
 
 private:
-    struct Pending {
-        std::mutex m;
-        std::condition_variable cv;
-        std::string response;
-        bool done = false;
+    // One epoll instance per loop thread; connections stay on the loop that
+    // accepted them.
+    struct EventLoop {
+        int epoll_fd = -1;
+        int wake_fd = -1;  // eventfd used to interrupt epoll_wait on stop()
+        std::thread thread;
+        int64_t last_sweep_ms = 0;
+        std::unordered_map<int, std::shared_ptr<Connection>> conns;
     };
 
-    void accept_loop();
-    void reader_loop(int client_fd);
-    void handle_http_connection(int client_fd);
-    void worker_loop();
+    void event_loop(EventLoop* loop);
+    void accept_connections(EventLoop* loop);
+    void on_readable(EventLoop* loop, const std::shared_ptr<Connection>& conn);
+    void close_connection(EventLoop* loop, const std::shared_ptr<Connection>& conn);
+    void close_idle_connections(EventLoop* loop, int64_t now_ms);
+    bool frame_input(const std::shared_ptr<Connection>& conn);
+    void reject_input(const std::shared_ptr<Connection>& conn, const BinHeader* bin = nullptr);
+    bool over_input_budget(const Connection* conn) const;
+    bool parse_json_lines(const std::shared_ptr<Connection>& conn);
+    bool parse_binary_frames(const std::shared_ptr<Connection>& conn);
+    bool handle_http_connection(const std::shared_ptr<Connection>& conn);
+    void enqueue(FSRequest req);
+    void send_error(FSRequest& req, const char* code, int16_t bin_status);
+    void take_buffers(Connection* conn, std::string* bufs, size_t n);
+    void recycle_request(FSRequest& req);
+    void send_segments(const std::shared_ptr<Connection>& conn, uint64_t seq, std::string* segs, size_t n, bool close_after,
+                       bool completes_request, const FilePayload* files = nullptr);
+    void append_segments_locked(Connection* conn, std::vector<Connection::OutSegment>& dst, std::string* segs, size_t n,
+                                const FilePayload* files);
+    void retire_segment_locked(Connection* conn, Connection::OutSegment& seg);
+    void drop_output_locked(Connection* conn);
+    void flush_locked(Connection* conn);
+    void worker_loop(bool read_lane);
+    void process_request(FSRequest& req);
+    void finish_request(FSRequest& req);
+    // Handlers draw their scratch from arena_; batch_session: inside a batch,
+    // the session resolved once for the batch.
+    void execute_json(const JsonView& jv, ResponseWriter& w, const SessionInfo* batch_session = nullptr);
+    void execute_batch(const JsonView& jv, ResponseWriter& w);
+    void execute_binary(FSRequest& req, std::string* segs, FilePayload& files);
+    void record_op(std::string_view op, uint64_t t0_ns, bool failed);
+    void render_metrics(std::string& out);
+    void write_stats(ResponseWriter& w);
 
     int port_;
     int server_fd_ = -1;
-    std::thread accept_thread_;
+    int loop_count_ = 0;
+    int64_t http_idle_timeout_ms_ = 60000;
+    size_t max_queue_depth_ = 1024;
+    int64_t queue_timeout_ms_ = 30000;
+    int max_connections_ = 0;
+    std::atomic<int> open_connections_{0};
+    std::atomic<size_t> buffered_input_{0};  // unframed request bytes across all connections
+    std::atomic<uint32_t> next_conn_id_{0};
+    CaptureWriter capture_;
+
+    // Metrics (GET /metrics, "stats"): per-operation execution latency and
+    // errors, indexed like OP_NAMES in fifo_server.cpp; the last slot is
+    // "other".
+    struct OpStats {
+        LatencyHistogram exec;
+        std::atomic<uint64_t> errors{0};
+    };
+    static const int OP_COUNT = 30;
+    OpStats op_stats_[OP_COUNT];
+    LatencyHistogram queue_wait_;
+    LatencyHistogram send_;
+    std::atomic<uint64_t> rejected_busy_{0};
+    std::atomic<uint64_t> rejected_timeout_{0};
+    std::atomic<uint64_t> rejected_connections_{0};
+    int64_t started_ms_ = 0;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
     std::thread worker_thread_;
+    int read_workers_ = 0;
+    std::vector<std::thread> read_threads_;
 
+    // Writes, and reads queued behind a write of their connection, go to the
+    // worker through request_queue_; other read-only requests go to the read
+    // workers through read_queue_. Lane counts in Connection are guarded here.
     std::mutex queue_mutex_;
     std::condition_variable queue_cv_;
-    std::deque<FSRequest> request_queue_;
+    std::condition_variable read_cv_;
+    RequestRing request_queue_;
+    RequestRing read_queue_;
+    size_t held_count_ = 0;  // requests in Connection::held across connections
+    static thread_local BumpArena arena_;  // one per worker: per-request scratch, reset after each response
 
     std::mutex resp_mutex_;
     std::deque<FSResponse> response_queue_;
 
-    bool running_ = false;
+    std::atomic<bool> running_{false};
     OFSInstance* instance_ = nullptr;
+    int container_fd_ = -1;  // source for sendfile()
 };
 
 #endif // FIFO_SERVER_HPP
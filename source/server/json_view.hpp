@@ -0,0 +1,286 @@
+#ifndef JSON_VIEW_HPP
+#define JSON_VIEW_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+
+// Single-pass, non-allocating view over a flat JSON request object.
+// parse() walks the buffer once and records up to MAX_FIELDS key/value pairs
+// as string_views into it. String values keep their escapes until a caller
+// asks for them with str(), which only decodes (into a caller-provided
+// scratch string) when the value actually contains a backslash.
+// Nested objects/arrays are recorded as raw spans and can be parsed with
+// another JsonView.
+class JsonView {
+public:
+    static const size_t MAX_FIELDS = 16;
+
+    enum class Kind : uint8_t { STRING, RAW };
+
+    struct Field {
+        std::string_view key;
+        std::string_view value;  // string contents without quotes, or raw token
+        Kind kind;
+        bool has_escape;
+    };
+
+    bool parse(std::string_view json) {
+        count_ = 0;
+        const char* p = json.data();
+        const char* end = p + json.size();
+        p = skip_ws(p, end);
+        if (p == end || *p != '{') return false;
+        ++p;
+        while (true) {
+            p = skip_ws(p, end);
+            if (p == end) return false;
+            if (*p == '}') return true;
+            if (*p != '"') return false;
+            std::string_view key;
+            bool key_esc = false;
+            p = scan_string(p, end, key, key_esc);
+            if (!p) return false;
+            p = skip_ws(p, end);
+            if (p == end || *p != ':') return false;
+            p = skip_ws(p + 1, end);
+            if (p == end) return false;
+            Field f;
+            f.key = key;
+            f.has_escape = false;
+            if (*p == '"') {
+                f.kind = Kind::STRING;
+                p = scan_string(p, end, f.value, f.has_escape);
+                // A value str() could not decode fails the whole request
+                // rather than reaching a handler cut short.
+                if (p && f.has_escape && !escapes_valid(f.value)) return false;
+            } else {
+                f.kind = Kind::RAW;
+                p = scan_raw(p, end, f.value);
+            }
+            if (!p) return false;
+            if (count_ < MAX_FIELDS) fields_[count_++] = f;
+            p = skip_ws(p, end);
+            if (p == end) return false;
+            if (*p == ',') { ++p; continue; }
+            if (*p == '}') return true;
+            return false;
+        }
+    }
+
+    const Field* find(std::string_view key) const {
+        for (size_t i = 0; i < count_; ++i)
+            if (fields_[i].key == key) return &fields_[i];
+        return nullptr;
+    }
+
+    bool has(std::string_view key) const { return find(key) != nullptr; }
+
+    // Undecoded value (escapes intact); safe to echo back inside a JSON string.
+    std::string_view raw(std::string_view key) const {
+        const Field* f = find(key);
+        return f ? f->value : std::string_view();
+    }
+
+    // Decoded string value. Points into the request buffer unless the value
+    // had escapes, in which case it is decoded into `scratch`.
+    std::string_view str(std::string_view key, std::string& scratch) const {
+        const Field* f = find(key);
+        if (!f || f->kind != Kind::STRING) return std::string_view();
+        if (!f->has_escape) return f->value;
+        if (!decode(f->value, scratch)) return std::string_view();  // parse() already refused these
+        return scratch;
+    }
+
+    // Convenience for small fields where an owned copy is wanted anyway.
+    std::string get(std::string_view key) const {
+        std::string scratch;
+        std::string_view v = str(key, scratch);
+        return std::string(v);
+    }
+
+    size_t size() const { return count_; }
+    const Field& field(size_t i) const { return fields_[i]; }
+
+    // Calls fn(std::string_view element) for each element of a raw JSON array
+    // span (as recorded for a RAW field). Returns false on malformed input.
+    template <typename Fn>
+    static bool for_each_element(std::string_view array, Fn fn) {
+        const char* p = array.data();
+        const char* end = p + array.size();
+        p = skip_ws(p, end);
+        if (p == end || *p != '[') return false;
+        ++p;
+        while (true) {
+            p = skip_ws(p, end);
+            if (p == end) return false;
+            if (*p == ']') return true;
+            std::string_view elem;
+            const char* start = p;
+            if (*p == '"') {
+                bool esc;
+                p = scan_string(p, end, elem, esc);
+                if (p) elem = std::string_view(start, (size_t)(p - start));
+            } else {
+                p = scan_raw(p, end, elem);
+            }
+            if (!p) return false;
+            fn(elem);
+            p = skip_ws(p, end);
+            if (p == end) return false;
+            if (*p == ',') { ++p; continue; }
+            if (*p == ']') return true;
+            return false;
+        }
+    }
+
+    // False on a malformed \u escape (bad hex digits, or a surrogate that is
+    // not part of a pair); `out` then holds only what came before it.
+    static bool decode(std::string_view in, std::string& out) {
+        out.clear();
+        out.reserve(in.size());
+        const char* p = in.data();
+        const char* end = p + in.size();
+        while (p < end) {
+            const char* bs = static_cast<const char*>(std::memchr(p, '\\', (size_t)(end - p)));
+            if (!bs) { out.append(p, (size_t)(end - p)); break; }
+            out.append(p, (size_t)(bs - p));
+            p = bs + 1;
+            if (p == end) break;
+            char c = *p++;
+            switch (c) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    uint32_t cp = 0;
+                    p = scan_code_point(p, end, cp);
+                    if (!p) return false;
+                    append_utf8(out, cp);
+                    break;
+                }
+                default: out += c; break;  // \" \\ \/ and anything unknown
+            }
+        }
+        return true;
+    }
+
+private:
+    static const char* skip_ws(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+        return p;
+    }
+
+    // p points at the opening quote. Uses memchr so multi-megabyte values are
+    // scanned at memory speed; a quote preceded by an odd run of backslashes
+    // is escaped and skipped.
+    static const char* scan_string(const char* p, const char* end, std::string_view& out, bool& has_escape) {
+        const char* start = ++p;
+        while (true) {
+            const char* q = static_cast<const char*>(std::memchr(p, '"', (size_t)(end - p)));
+            if (!q) return nullptr;
+            size_t slashes = 0;
+            for (const char* b = q; b > start && b[-1] == '\\'; --b) ++slashes;
+            if ((slashes & 1) == 0) {
+                out = std::string_view(start, (size_t)(q - start));
+                has_escape = q > start && std::memchr(start, '\\', (size_t)(q - start)) != nullptr;
+                return q + 1;
+            }
+            p = q + 1;
+        }
+    }
+
+    // Numbers, literals and balanced nested objects/arrays.
+    static const char* scan_raw(const char* p, const char* end, std::string_view& out) {
+        const char* start = p;
+        if (*p == '{' || *p == '[') {
+            int depth = 0;
+            while (p < end) {
+                char c = *p;
+                if (c == '"') {
+                    std::string_view s;
+                    bool esc;
+                    p = scan_string(p, end, s, esc);
+                    if (!p) return nullptr;
+                    continue;
+                }
+                if (c == '{' || c == '[') ++depth;
+                else if (c == '}' || c == ']') {
+                    if (--depth == 0) { ++p; out = std::string_view(start, (size_t)(p - start)); return p; }
+                }
+                ++p;
+            }
+            return nullptr;
+        }
+        while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') ++p;
+        if (p == start) return nullptr;
+        out = std::string_view(start, (size_t)(p - start));
+        return p;
+    }
+
+    // The \u escape's digits at p (just past the "u"), with a following low
+    // surrogate escape folded in. Returns the end of the escape, or null when
+    // it is malformed.
+    static const char* scan_code_point(const char* p, const char* end, uint32_t& cp) {
+        if (!hex4(p, end, cp)) return nullptr;
+        p += 4;
+        if (cp >= 0xDC00 && cp <= 0xDFFF) return nullptr;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            uint32_t lo = 0;
+            if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !hex4(p + 2, end, lo) || lo < 0xDC00 || lo > 0xDFFF)
+                return nullptr;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            p += 6;
+        }
+        return p;
+    }
+
+    // decode() without the output: walks the escapes only.
+    static bool escapes_valid(std::string_view in) {
+        const char* p = in.data();
+        const char* end = p + in.size();
+        while (p < end) {
+            const char* bs = static_cast<const char*>(std::memchr(p, '\\', (size_t)(end - p)));
+            if (!bs || bs + 1 == end) return true;
+            p = bs + 2;
+            if (bs[1] != 'u') continue;
+            uint32_t cp;
+            p = scan_code_point(p, end, cp);
+            if (!p) return false;
+        }
+        return true;
+    }
+
+    static bool hex4(const char* p, const char* end, uint32_t& v) {
+        if (end - p < 4) return false;
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = p[i];
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) out += (char)cp;
+        else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+        else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xF0 | (cp >> 18)); out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    Field fields_[MAX_FIELDS];
+    size_t count_ = 0;
+};
+
+#endif // JSON_VIEW_HPP
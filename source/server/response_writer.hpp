@@ -0,0 +1,173 @@
+#ifndef RESPONSE_WRITER_HPP
+#define RESPONSE_WRITER_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <charconv>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Length of the leading run of `p` that can be copied into a JSON string
+// verbatim (no '"', '\\' or control characters). Scans 16 bytes at a time.
+inline size_t json_clean_prefix(const char* p, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));  // v <= 0x1f
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#endif
+    for (; i < n; ++i) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == '"' || c == '\\' || c < 0x20) return i;
+    }
+    return n;
+}
+
+// Appends `in` JSON-escaped, copying clean runs in bulk.
+inline void append_json_escaped(std::string& out, std::string_view in) {
+    static const char hex[] = "0123456789abcdef";
+    const char* p = in.data();
+    size_t n = in.size();
+    while (n > 0) {
+        size_t run = json_clean_prefix(p, n);
+        out.append(p, run);
+        p += run; n -= run;
+        if (n == 0) break;
+        unsigned char c = (unsigned char)*p++;
+        --n;
+        switch (c) {
+            case '"': out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            default: {
+                char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(u, 6);
+            }
+        }
+    }
+}
+
+// Serializes one JSON response into caller-owned, reusable buffers. Small
+// responses go entirely into `head`; bulk_string() escapes a large payload
+// into its own `bulk` buffer and continues in `tail`, so the three pieces
+// can be handed to writev without being concatenated.
+class ResponseWriter {
+public:
+    ResponseWriter(std::string* head, std::string* bulk, std::string* tail)
+        : segs_{head, bulk, tail} {
+        for (std::string* s : segs_) s->clear();
+    }
+
+    // {"status":"<status>","request_id":"<id>"   (id is echoed pre-escaped)
+    void begin(const char* status, std::string_view request_id) {
+        out().append("{\"status\":\"", 11);
+        out().append(status);
+        out().append("\",\"request_id\":\"", 16);
+        out().append(request_id.data(), request_id.size());
+        out() += '"';
+        depth_ = 0;
+        first_[0] = false;
+        failed_ = false;
+    }
+
+    void error(std::string_view request_id, const char* code) {
+        begin("error", request_id);
+        field("error", code);
+        failed_ = true;
+    }
+
+    bool failed() const { return failed_; }
+
+    void key(std::string_view k) {
+        comma();
+        out() += '"';
+        out().append(k.data(), k.size());
+        out().append("\":", 2);
+    }
+
+    void field(std::string_view k, std::string_view v) { key(k); string(v); }
+    void field(std::string_view k, const char* v) { key(k); string(v); }
+    void field(std::string_view k, int64_t v) { key(k); number(v); }
+    void field(std::string_view k, uint64_t v) { key(k); number(v); }
+    void field(std::string_view k, int v) { key(k); number((int64_t)v); }
+
+    void string(std::string_view v) {
+        out() += '"';
+        append_json_escaped(out(), v);
+        out() += '"';
+    }
+
+    void number(int64_t v) {
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        out().append(buf, (size_t)(r.ptr - buf));
+    }
+    void number(uint64_t v) {
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        out().append(buf, (size_t)(r.ptr - buf));
+    }
+
+    void raw(std::string_view v) { out().append(v.data(), v.size()); }
+
+    // Array/object nesting; element()/key() take care of the commas.
+    void begin_array(std::string_view k) { key(k); push('['); }
+    void end_array() { pop(']'); }
+    void begin_object() { comma(); push('{'); }
+    void end_object() { pop('}'); }
+    void element() { comma(); }
+
+    // Large string value: escaped straight into the bulk segment.
+    void bulk_string(std::string_view k, std::string_view v) {
+        key(k);
+        out() += '"';
+        cur_ = 1;
+        out().reserve(v.size() + v.size() / 8 + 16);
+        append_json_escaped(out(), v);
+        cur_ = 2;
+        out() += '"';
+    }
+
+    void end(bool newline) {
+        out() += '}';
+        if (newline) out() += '\n';
+    }
+
+    size_t size() const { return segs_[0]->size() + segs_[1]->size() + segs_[2]->size(); }
+
+private:
+    std::string& out() { return *segs_[cur_]; }
+    void comma() {
+        if (first_[depth_]) first_[depth_] = false;
+        else out() += ',';
+    }
+    void push(char c) {
+        out() += c;
+        if (depth_ + 1 < MAX_DEPTH) ++depth_;
+        first_[depth_] = true;
+    }
+    void pop(char c) {
+        out() += c;
+        if (depth_ > 0) --depth_;
+    }
+
+    static const int MAX_DEPTH = 8;
+    std::string* segs_[3];
+    int cur_ = 0;
+    int depth_ = 0;
+    bool first_[MAX_DEPTH] = {};
+    bool failed_ = false;
+};
+
+#endif // RESPONSE_WRITER_HPP
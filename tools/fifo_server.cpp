@@ -1,17 +1,38 @@
 #include "../source/server/fifo_server.hpp"
 #include <iostream>
 #include <csignal>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <string>
 #include "../source/include/omni_core.hpp"
+#include "../source/include/uconf.hpp"
 
 static FIFOService* g_service = nullptr;
 
+static void log_scrub_problem(void*, const char* problem) {
+    std::cerr << "scrub: " << problem << std::endl;
+}
+
 void sigint_handler(int) {
     if (g_service) g_service->stop();
     exit(0);
 }
 
 int main(int argc, char** argv) {
-    int port = 8080;
+    // Settings come from the config: argv[2], $FILEVERSE_CONFIG, or the default
+    // one. An explicitly named config must load; a missing default means
+    // compiled-in defaults.
+    const char* config = argc > 2 ? argv[2] : std::getenv("FILEVERSE_CONFIG");
+    UConf conf;
+    if (config) {
+        if (!conf.load(config)) {
+            std::cerr << "config: " << conf.error() << std::endl;
+            return 1;
+        }
+    } else if (conf.load("compiled/default.uconf")) {
+        config = "compiled/default.uconf";
+    }
+    int port = conf.get_int("server", "port", 8080);
     if (argc > 1) port = std::atoi(argv[1]);
 
     // Require FILEVERSE_OMNI env var and instance
@@ -21,17 +42,55 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // A missing container is formatted with the config's geometry.
+    if (access(omni, F_OK) != 0) {
+        int fr = fs_format(omni, config);
+        if (fr != 0) {
+            std::cerr << "fs_format failed: " << fr << std::endl;
+            return 1;
+        }
+        std::cout << "Formatted " << omni << (config ? std::string(" from ") + config : std::string()) << std::endl;
+    }
+
     void* inst_ptr = nullptr;
-    int r = fs_init(&inst_ptr, omni, nullptr);
+    int r = fs_init(&inst_ptr, omni, config);
     if (r != 0) {
         std::cerr << "fs_init failed: " << r << std::endl;
         return 1;
     }
     OFSInstance* inst = reinterpret_cast<OFSInstance*>(inst_ptr);
 
+    // Background integrity checks, throttled so they do not starve requests.
+    int scrub_interval = conf.get_int("scrub", "interval", 0);
+    if (scrub_interval > 0) {
+        ScrubOptions so = {conf.get_int("scrub", "threads", 0), (uint64_t)conf.get_int("scrub", "rate_mb", 32) << 20, 0,
+                           log_scrub_problem, nullptr};
+        fs_scrubber_start(inst_ptr, &so, (uint64_t)scrub_interval);
+    }
+
+    // Idle connections cost an fd each, not a thread; lift the soft fd limit.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
     FIFOService service(port, inst);
+    service.set_max_connections(conf.get_int("server", "max_connections", 0));
+    service.set_read_workers(conf.get_int("server", "read_workers", 0));
+    service.set_queue_limits((size_t)conf.get_int("server", "max_queue_depth", 1024),
+                             conf.get_int("server", "queue_timeout", 30));
+    service.set_trace_sampling((uint32_t)conf.get_int("server", "trace_sample", 0));
+    // Optional request capture for tools/fs_replay.
+    const char* capture = std::getenv("FILEVERSE_CAPTURE");
+    if (capture && !service.set_capture(capture)) {
+        std::cerr << "cannot open capture file " << capture << std::endl;
+        fs_shutdown(inst_ptr);
+        return 1;
+    }
     g_service = &service;
     signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);  // stop() also flushes a capture
 
     if (!service.start()) {
         std::cerr << "Service failed to start" << std::endl;
@@ -0,0 +1,192 @@
+// Counts heap allocations made by the server's threads (event loop and
+// worker) while they answer small requests, to keep the steady-state request
+// path off the global heap. The client runs on the main thread and is not
+// counted. Exits non-zero if a warmed-up request allocates.
+//
+// malloc/calloc/realloc are interposed (glibc), which also covers operator
+// new and the request arena's blocks.
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../source/server/fifo_server.hpp"
+#include "../source/server/json_view.hpp"
+#include "omni_core.hpp"
+
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+
+static std::atomic<uint64_t> g_allocs{0};
+static thread_local bool t_client = false;
+
+extern "C" void* malloc(size_t n) {
+    if (!t_client) g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(n);
+}
+extern "C" void* calloc(size_t n, size_t m) {
+    if (!t_client) g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, m);
+}
+extern "C" void* realloc(void* p, size_t n) {
+    if (!t_client) g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, n);
+}
+
+static bool send_all(int fd, const std::string& s) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t w = send(fd, s.data() + off, s.size() - off, 0);
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    return true;
+}
+
+static bool recv_exact(int fd, std::string& buf, size_t n) {
+    while (buf.size() < n) {
+        char tmp[65536];
+        ssize_t r = recv(fd, tmp, sizeof(tmp), 0);
+        if (r <= 0) return false;
+        buf.append(tmp, (size_t)r);
+    }
+    return true;
+}
+
+// Reads one newline-terminated JSON response.
+static bool recv_line(int fd, std::string& pending, std::string& line) {
+    size_t nl;
+    while ((nl = pending.find('\n')) == std::string::npos) {
+        if (!recv_exact(fd, pending, pending.size() + 1)) return false;
+    }
+    line.assign(pending, 0, nl);
+    pending.erase(0, nl + 1);
+    return true;
+}
+
+// Reads one binary response frame; returns its status.
+static bool recv_frame(int fd, std::string& pending, int16_t& status) {
+    if (!recv_exact(fd, pending, sizeof(BinHeader))) return false;
+    BinHeader h;
+    std::memcpy(&h, pending.data(), sizeof(h));
+    size_t frame = sizeof(BinHeader) + h.meta_len + (size_t)h.payload_len;
+    if (!recv_exact(fd, pending, frame)) return false;
+    pending.erase(0, frame);
+    status = h.status;
+    return true;
+}
+
+// Sends `n` copies of a request one at a time; false on a failed response.
+static bool run(int fd, const std::string& req, bool binary, int n, std::string& pending) {
+    std::string line;
+    for (int i = 0; i < n; ++i) {
+        if (!send_all(fd, req)) return false;
+        if (binary) {
+            int16_t status = 0;
+            if (!recv_frame(fd, pending, status) || status != 0) return false;
+        } else {
+            if (!recv_line(fd, pending, line) || line.find("\"status\":\"success\"") == std::string::npos) {
+                std::cout << "  unexpected response: " << line << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    t_client = true;
+    const char* path = "fs_alloc_test.omni";
+    std::remove(path);
+    if (fs_format(path, nullptr) != 0) return 1;
+    void* instance = nullptr;
+    if (fs_init(&instance, path, nullptr) != 0) return 1;
+    user_create(instance, nullptr, "admin", "admin123", UserRole::ADMIN);
+    void* session = nullptr;
+    if (user_login(instance, &session, "admin", "admin123") != 0) return 1;
+    std::string small(100, 's'), mid(3000, 'm'), big(70000, 'b');
+    file_create(instance, session, "/small.txt", small.data(), small.size());
+    file_create(instance, session, "/mid.bin", mid.data(), mid.size());
+    file_create(instance, session, "/big.bin", big.data(), big.size());
+    dir_create(instance, session, "/docs");
+    for (int i = 0; i < 20; ++i) {
+        std::string p = "/docs/file_" + std::to_string(i) + ".txt";
+        file_create(instance, session, p.c_str(), small.data(), small.size());
+    }
+    std::string token = reinterpret_cast<SessionInfo*>(session)->session_id;
+    delete reinterpret_cast<SessionInfo*>(session);
+
+    int port = 20000 + (int)(getpid() % 20000);
+    FIFOService service(port, reinterpret_cast<OFSInstance*>(instance), 1);
+    service.set_read_workers(1);  // one warm arena for the reads, as for the writes
+    if (!service.start()) return 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) { perror("connect"); return 1; }
+
+    std::string tok = "\"token\":\"" + token + "\"";
+    struct Case { const char* name; std::string req; bool binary; };
+    Case json_cases[] = {
+        {"ping", "{\"operation\":\"ping\",\"request_id\":\"1\"}\n", false},
+        {"file_exists", "{\"operation\":\"file_exists\",\"request_id\":\"2\"," + tok + ",\"path\":\"/docs/file_7.txt\"}\n", false},
+        {"file_read (100 B)", "{\"operation\":\"file_read\",\"request_id\":\"3\"," + tok + ",\"path\":\"/small.txt\"}\n", false},
+        {"file_read (3 KB)", "{\"operation\":\"file_read\",\"request_id\":\"4\"," + tok + ",\"path\":\"/mid.bin\"}\n", false},
+        {"file_read (70 KB)", "{\"operation\":\"file_read\",\"request_id\":\"5\"," + tok + ",\"path\":\"/big.bin\"}\n", false},
+        {"dir_list (20)", "{\"operation\":\"dir_list\",\"request_id\":\"6\"," + tok + ",\"path\":\"/docs\"}\n", false},
+        {"user_list", "{\"operation\":\"user_list\",\"request_id\":\"7\"," + tok + "}\n", false},
+        {"dir_usage", "{\"operation\":\"dir_usage\",\"request_id\":\"8\"," + tok + ",\"path\":\"/docs\"}\n", false},
+    };
+    const int WARMUP = 50, MEASURED = 500;
+    std::string pending;
+    bool ok = true;
+    std::cout << "allocations per request (server threads, after " << WARMUP << " warmup requests):" << std::endl;
+    for (Case& c : json_cases) {
+        if (!run(fd, c.req, false, WARMUP, pending)) { ok = false; break; }
+        uint64_t before = g_allocs.load();
+        if (!run(fd, c.req, false, MEASURED, pending)) { ok = false; break; }
+        uint64_t n = g_allocs.load() - before;
+        std::cout << "  " << c.name << ": " << (double)n / MEASURED << std::endl;
+        if (n != 0) ok = false;
+    }
+    close(fd);
+
+    // Binary FILE_READ on its own connection (the protocol is chosen per connection).
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (ok && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        std::string meta = "{" + tok + ",\"path\":\"/mid.bin\"}";
+        std::string frame;
+        append_bin_header(frame, make_bin_header(BinOpcode::FILE_READ, 1, (uint32_t)meta.size(), 0));
+        frame += meta;
+        pending.clear();
+        if (!run(fd, frame, true, WARMUP, pending)) ok = false;
+        uint64_t before = g_allocs.load();
+        if (ok && !run(fd, frame, true, MEASURED, pending)) ok = false;
+        uint64_t n = g_allocs.load() - before;
+        std::cout << "  bin FILE_READ (3 KB): " << (double)n / MEASURED << std::endl;
+        if (n != 0) ok = false;
+    } else {
+        ok = false;
+    }
+    close(fd);
+
+    service.stop();
+    fs_shutdown(instance);
+    std::remove(path);
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "omni_core.hpp"
+#include "odf_types.hpp"
+
+// In-process microbenchmarks of the core C API across file sizes, file
+// counts and directory fan-outs. Prints a table and writes one JSON result
+// per line, so two runs (e.g. two commits) can be compared:
+//
+//   fs_bench [--quick] [--repeat N] [--config geometry.uconf] [--direct]
+//            [--out results.json] [--compare baseline.json] [--threshold 0.10]
+//
+// --config formats the scratch container with that .uconf's geometry (block
+// size, max files, ...) instead of the compiled defaults.
+//
+// The block_read cases sweep the I/O queue depth on each BlockIO backend:
+// one op is a batch of random block reads kept `depth` deep. Without
+// --direct they mostly measure the page cache; with it (O_DIRECT), the device.
+//
+// The suite runs N times (default 3) and each case keeps its fastest run,
+// which filters out most scheduling and page-cache noise. With --compare,
+// any case whose ops/s dropped by more than the threshold (default 10%) is
+// reported and the exit status is 1.
+
+static const char* BENCH_OMNI = "fs_bench.omni";
+static const char* g_config = nullptr;
+static bool g_direct = false;
+
+struct Result {
+    std::string name;
+    size_t ops = 0;
+    double ops_per_sec = 0;
+    double p50_us = 0, p99_us = 0, max_us = 0;
+};
+
+static std::vector<Result> g_results;  // best run per case
+
+static double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Times fn(i) for i in [0, n) and records percentiles of the per-call latency.
+static void run_case(const std::string& name, size_t n, const std::function<int(size_t)>& fn) {
+    std::vector<double> lat(n);
+    size_t failures = 0;
+    double start = now_us();
+    for (size_t i = 0; i < n; ++i) {
+        double t0 = now_us();
+        if (fn(i) != 0) ++failures;
+        lat[i] = now_us() - t0;
+    }
+    double total = now_us() - start;
+    std::sort(lat.begin(), lat.end());
+    Result r;
+    r.name = name;
+    r.ops = n;
+    r.ops_per_sec = total > 0 ? (double)n * 1e6 / total : 0;
+    r.p50_us = lat[n / 2];
+    r.p99_us = lat[std::min(n - 1, (n * 99) / 100)];
+    r.max_us = lat[n - 1];
+    auto prev = std::find_if(g_results.begin(), g_results.end(), [&](const Result& x) { return x.name == name; });
+    if (prev == g_results.end()) g_results.push_back(r);
+    else if (r.ops_per_sec > prev->ops_per_sec) *prev = r;
+    if (failures) fprintf(stderr, "%s: %zu of %zu calls failed\n", name.c_str(), failures, n);
+}
+
+// Fresh filesystem with an admin session for each group of cases.
+struct Fixture {
+    void* inst = nullptr;
+    void* session = nullptr;
+    explicit Fixture(const char* config = g_config) {
+        if (fs_format(BENCH_OMNI, config) != 0 || fs_init(&inst, BENCH_OMNI, config) != 0) {
+            fprintf(stderr, "cannot format %s\n", BENCH_OMNI);
+            exit(1);
+        }
+        user_create(inst, nullptr, "admin", "admin123", UserRole::ADMIN);
+        user_login(inst, &session, "admin", "admin123");
+    }
+    ~Fixture() {
+        delete reinterpret_cast<SessionInfo*>(session);
+        fs_shutdown(inst);
+        std::remove(BENCH_OMNI);
+    }
+};
+
+static std::string path_of(const char* dir, size_t i) {
+    return std::string(dir) + "/f" + std::to_string(i);
+}
+
+static void bench_files(size_t size, size_t count) {
+    Fixture fx;
+    std::string data(size, 'x');
+    for (size_t i = 0; i < size; i += 97) data[i] = (char)('a' + i % 26);
+    std::vector<std::string> paths(count);
+    for (size_t i = 0; i < count; ++i) paths[i] = path_of("/bench", i);
+    std::string tag = "/size=" + std::to_string(size) + "/files=" + std::to_string(count);
+
+    dir_create(fx.inst, fx.session, "/bench");
+    run_case("file_create" + tag, count, [&](size_t i) {
+        return file_create(fx.inst, fx.session, paths[i].c_str(), data.data(), data.size());
+    });
+    run_case("file_overwrite" + tag, count, [&](size_t i) {
+        return file_create(fx.inst, fx.session, paths[i].c_str(), data.data(), data.size());
+    });
+    run_case("file_read" + tag, count, [&](size_t i) {
+        char* buf = nullptr;
+        size_t sz = 0;
+        int r = file_read(fx.inst, fx.session, paths[i].c_str(), &buf, &sz);
+        delete [] buf;
+        return r;
+    });
+    run_case("file_delete" + tag, count, [&](size_t i) {
+        return file_delete(fx.inst, fx.session, paths[i].c_str());
+    });
+}
+
+static void bench_dir_list(size_t fanout, size_t iterations) {
+    Fixture fx;
+    dir_create(fx.inst, fx.session, "/wide");
+    for (size_t i = 0; i < fanout; ++i) file_create(fx.inst, fx.session, path_of("/wide", i).c_str(), "x", 1);
+    // Siblings outside the listed directory, as in a real tree.
+    dir_create(fx.inst, fx.session, "/other");
+    for (size_t i = 0; i < fanout; ++i) file_create(fx.inst, fx.session, path_of("/other", i).c_str(), "x", 1);
+    run_case("dir_list/fanout=" + std::to_string(fanout), iterations, [&](size_t) {
+        FileEntry* entries = nullptr;
+        int cnt = 0;
+        int r = dir_list(fx.inst, fx.session, "/wide", &entries, &cnt);
+        delete [] entries;
+        return r == 0 && (size_t)cnt == fanout ? 0 : -1;
+    });
+}
+
+// Single creates into a table that already holds `existing` entries, 1000
+// to a directory. Every write outside a batch publishes a new table, so this
+// shows whether a write's cost grows with the table. The geometry is the
+// default one with enough file slots; --config does not apply.
+static void bench_create_at_scale(size_t existing, size_t count) {
+    const char* conf_path = "fs_bench_scale.uconf";
+    {
+        std::ofstream conf(conf_path);
+        conf << "[filesystem]\ntotal_size = " << (512u << 20) << "\nmax_files = " << existing + count + 1024 << "\n";
+    }
+    {
+        Fixture fx(conf_path);
+        // Filled in batches: each stages into one table and persists once.
+        for (size_t d = 0; d * 1000 < existing; ++d) {
+            std::string dir = "/d" + std::to_string(d);
+            fs_batch_begin(fx.inst);
+            dir_create(fx.inst, fx.session, dir.c_str());
+            for (size_t i = d * 1000 + 1; i < std::min(existing, (d + 1) * 1000); ++i)
+                file_create(fx.inst, fx.session, path_of(dir.c_str(), i).c_str(), "x", 1);
+            fs_batch_end(fx.inst, 1);
+        }
+        dir_create(fx.inst, fx.session, "/new");
+        run_case("file_create/existing=" + std::to_string(existing), count, [&](size_t i) {
+            return file_create(fx.inst, fx.session, path_of("/new", i).c_str(), "x", 1);
+        });
+    }
+    std::remove(conf_path);
+}
+
+static void bench_sessions(size_t logins, size_t lookups) {
+    Fixture fx;
+    run_case("user_login", logins, [&](size_t) {
+        void* s = nullptr;
+        int r = user_login(fx.inst, &s, "admin", "admin123");
+        delete reinterpret_cast<SessionInfo*>(s);
+        return r;
+    });
+    std::string token = reinterpret_cast<SessionInfo*>(fx.session)->session_id;
+    run_case("get_session_by_token", lookups, [&](size_t) {
+        void* s = nullptr;
+        int r = get_session_by_token(fx.inst, token.c_str(), &s);
+        delete reinterpret_cast<SessionInfo*>(s);
+        return r;
+    });
+}
+
+static void bench_io_depth(size_t batch, size_t iterations) {
+    Fixture fx;
+    const OMNIHeader& h = reinterpret_cast<OFSInstance*>(fx.inst)->header;
+    size_t bs = (size_t)h.block_size;
+    BlockIO io;
+    if (!io.open(BENCH_OMNI, g_direct)) {
+        fprintf(stderr, "block_read: cannot open %s%s\n", BENCH_OMNI, g_direct ? " with O_DIRECT" : "");
+        return;
+    }
+    // Fill up to 64 MB of the content area so reads hit written extents, not holes.
+    size_t span = (size_t)std::min<uint64_t>(h.num_blocks, (64u << 20) / bs);
+    void* mem = nullptr;
+    if (posix_memalign(&mem, 4096, std::max(batch, (size_t)256) * bs) != 0) return;
+    char* buf = static_cast<char*>(mem);
+    std::memset(buf, 'x', 256 * bs);
+    for (size_t b = 0; b < span; b += 256) {
+        IoRequest w = {h.content_offset + (uint64_t)b * bs, buf, std::min<size_t>(256, span - b) * bs};
+        io.write(&w, 1);
+    }
+    std::vector<IoRequest> reqs(batch);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < batch; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        reqs[i] = {h.content_offset + (x % span) * bs, buf + i * bs, bs};
+    }
+    const BlockIO::Backend backends[] = {BlockIO::Backend::URING, BlockIO::Backend::THREADS};
+    for (BlockIO::Backend b : backends) {
+        if (!io.set_backend(b)) continue;
+        for (unsigned depth : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+            std::string name = "block_read/batch=" + std::to_string(batch) + "/depth=" + std::to_string(depth) + "/" + io.backend_name();
+            run_case(name, iterations, [&](size_t) { return io.read(reqs.data(), reqs.size(), depth) ? 0 : -1; });
+        }
+    }
+    free(mem);
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static bool write_results(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+    for (const Result& r : g_results) {
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"ops\":%zu,\"ops_per_sec\":%.1f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+                 json_escape(r.name).c_str(), r.ops, r.ops_per_sec, r.p50_us, r.p99_us, r.max_us);
+        out << line;
+    }
+    return true;
+}
+
+// Reads "name" and "ops_per_sec" back from a results file written above.
+static std::map<std::string, double> read_results(const std::string& path) {
+    std::map<std::string, double> out;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t n = line.find("\"name\":\"");
+        size_t q = line.find("\"ops_per_sec\":");
+        if (n == std::string::npos || q == std::string::npos) continue;
+        n += 8;
+        out[line.substr(n, line.find('"', n) - n)] = std::atof(line.c_str() + q + 14);
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    int repeat = 3;
+    std::string out_path = "fs_bench_results.json";
+    std::string compare_path;
+    double threshold = 0.10;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--quick") quick = true;
+        else if (a == "--repeat" && i + 1 < argc) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--config" && i + 1 < argc) g_config = argv[++i];
+        else if (a == "--out" && i + 1 < argc) out_path = argv[++i];
+        else if (a == "--compare" && i + 1 < argc) compare_path = argv[++i];
+        else if (a == "--threshold" && i + 1 < argc) threshold = std::atof(argv[++i]);
+        else if (a == "--direct") g_direct = true;
+        else {
+            std::cout << "Usage: fs_bench [--quick] [--repeat N] [--config geometry.uconf] [--direct] [--out results.json]"
+                         " [--compare baseline.json] [--threshold 0.10]" << std::endl;
+            return 2;
+        }
+    }
+
+    // The default image is 100MB with 4096 file slots: keep count * size and
+    // the file counts well under that (bench_create_at_scale formats its own).
+    size_t scale = quick ? 4 : 1;
+    for (int run = 0; run < repeat; ++run) {
+        bench_files(256, 2000 / scale);  // stored inline in the file slot
+        bench_files(1024, 2000 / scale);
+        bench_files(64 * 1024, 400 / scale);
+        bench_files(1024 * 1024, 32 / scale);
+        bench_dir_list(10, 2000 / scale);
+        bench_dir_list(100, 1000 / scale);
+        bench_dir_list(1000, 200 / scale);
+        bench_create_at_scale(100000, 2000 / scale);
+        bench_sessions(1000 / scale, 100000 / scale);
+        bench_io_depth(256, 40 / scale);
+    }
+    for (const Result& r : g_results)
+        printf("%-44s %8zu ops %12.0f ops/s  p50 %9.1f us  p99 %9.1f us  max %9.1f us\n", r.name.c_str(), r.ops,
+               r.ops_per_sec, r.p50_us, r.p99_us, r.max_us);
+
+    if (!write_results(out_path)) {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+    std::cout << "results written to " << out_path << std::endl;
+
+    if (compare_path.empty()) return 0;
+    std::map<std::string, double> base = read_results(compare_path);
+    if (base.empty()) {
+        std::cerr << "no results in " << compare_path << std::endl;
+        return 1;
+    }
+    int regressions = 0;
+    std::cout << "\ncompared with " << compare_path << " (threshold " << threshold * 100 << "%):" << std::endl;
+    for (const Result& r : g_results) {
+        auto it = base.find(r.name);
+        if (it == base.end() || it->second <= 0) continue;
+        double change = r.ops_per_sec / it->second - 1.0;
+        bool bad = change < -threshold;
+        if (bad) ++regressions;
+        printf("%-44s %12.0f -> %12.0f ops/s  %+7.1f%%%s\n", r.name.c_str(), it->second, r.ops_per_sec,
+               change * 100.0, bad ? "  REGRESSION" : "");
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include "omni_core.hpp"
+
+// Copies a container subtree out to a host directory: the mirror of
+// fs_import, also offline.
+//
+//   fs_export <container.omni> <src_dir> <host_dir> [--threads N] [--config c.uconf]
+//             [--user u --password p]
+//
+// The tree is listed and the host directories created first; then worker
+// threads take files off a shared index and copy each one through a pinned
+// download (file_download_open/read) in CHUNK pieces, so a file is written
+// as one consistent version.
+
+static const size_t CHUNK = 16u << 20;
+
+struct Target {
+    std::string path;  // in the container
+    std::string host;
+    uint64_t size;
+};
+
+static bool write_range(int fd, const char* data, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = pwrite(fd, data + done, len - done, (off_t)(offset + done));
+        if (w <= 0) return false;
+        done += (size_t)w;
+    }
+    return true;
+}
+
+static void usage() {
+    std::cerr << "Usage: fs_export <container.omni> <src_dir> <host_dir> [--threads N] [--config c.uconf]"
+                 " [--user u --password p]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) { usage(); return 1; }
+    const char* config = nullptr;
+    std::string user = "admin", password = "admin123";
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    for (int i = 4; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) threads = (unsigned)std::max(1, std::atoi(argv[++i]));
+        else if (a == "--config" && i + 1 < argc) config = argv[++i];
+        else if (a == "--user" && i + 1 < argc) user = argv[++i];
+        else if (a == "--password" && i + 1 < argc) password = argv[++i];
+        else { usage(); return 1; }
+    }
+    std::string src = argv[2];
+    while (src.size() > 1 && src.back() == '/') src.pop_back();
+    std::string out_root = argv[3];
+
+    void* instance = nullptr;
+    if (fs_init(&instance, argv[1], config) != 0) { std::cerr << "cannot open " << argv[1] << std::endl; return 1; }
+    void* session = nullptr;
+    if (user_login(instance, &session, user.c_str(), password.c_str()) != 0) {
+        std::cerr << "login failed for " << user << std::endl;
+        fs_shutdown(instance);
+        return 1;
+    }
+
+    // List the subtree breadth-first, creating each host directory as it is found.
+    std::vector<Target> files;
+    uint64_t total_bytes = 0;
+    size_t ndirs = 0;
+    int rc = 0;
+    std::error_code ec;
+    std::filesystem::create_directories(out_root, ec);
+    std::vector<std::pair<std::string, std::string>> pending = {{src, out_root}};
+    while (!pending.empty() && rc == 0) {
+        std::pair<std::string, std::string> dir = std::move(pending.back());
+        pending.pop_back();
+        FileEntry* entries = nullptr;
+        int count = 0;
+        rc = dir_list(instance, session, dir.first.c_str(), &entries, &count);
+        for (int i = 0; i < count && rc == 0; ++i) {
+            const FileEntry& e = entries[i];
+            const char* name = std::strrchr(e.name, '/');
+            std::string host = dir.second + "/" + (name ? name + 1 : e.name);
+            if (e.type == static_cast<uint8_t>(EntryType::DIRECTORY)) {
+                if (mkdir(host.c_str(), 0755) != 0 && errno != EEXIST) {
+                    std::cerr << "cannot create " << host << ": " << std::strerror(errno) << std::endl;
+                    rc = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+                }
+                pending.push_back({e.name, host});
+                ++ndirs;
+            } else {
+                files.push_back({e.name, host, e.size});
+                total_bytes += e.size;
+            }
+        }
+        delete [] entries;
+    }
+    // Largest first, so one big file does not end up alone at the tail.
+    std::sort(files.begin(), files.end(), [](const Target& a, const Target& b) { return a.size > b.size; });
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    std::atomic<int> failed{0};
+    std::atomic<uint64_t> exported{0};
+    auto worker = [&]() {
+        std::vector<char> buf(CHUNK);
+        for (size_t i; !failed.load() && (i = next.fetch_add(1)) < files.size();) {
+            const Target& t = files[i];
+            uint64_t handle = 0, size = 0;
+            int r = file_download_open(instance, session, t.path.c_str(), &handle, &size);
+            int fd = r == 0 ? open(t.host.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+            if (r == 0 && fd < 0) r = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            for (uint64_t off = 0; r == 0 && off < size;) {
+                size_t got = 0;
+                r = file_download_read(instance, session, handle, off, buf.data(), buf.size(), &got);
+                if (r == 0 && (got == 0 || !write_range(fd, buf.data(), got, off))) r = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+                off += got;
+            }
+            if (fd >= 0) close(fd);
+            if (handle) file_download_close(instance, session, handle);
+            if (r != 0) {
+                std::cerr << "export " << t.path << ": " << r << std::endl;
+                failed.store(r);
+            } else {
+                exported.fetch_add(size);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads && rc == 0; ++t) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+    if (rc == 0) rc = failed.load();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    delete reinterpret_cast<SessionInfo*>(session);
+    fs_shutdown(instance);
+    if (rc != 0) {
+        std::cerr << "export failed (" << rc << ")" << std::endl;
+        return 1;
+    }
+    std::cout << "exported " << files.size() << " files (" << ndirs << " directories, " << exported.load()
+              << " bytes) in " << secs << " s, " << (secs > 0 ? exported.load() / 1e6 / secs : 0) << " MB/s" << std::endl;
+    return 0;
+}
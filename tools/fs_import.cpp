@@ -0,0 +1,271 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include "omni_core.hpp"
+
+// Copies a host directory tree into a container, offline: the server must
+// not have the container open.
+//
+//   fs_import <container.omni> <host_dir> [dest_dir] [--threads N] [--config c.uconf]
+//             [--user u --password p]
+//
+// Reader threads load consecutive files into groups of up to GROUP_BYTES.
+// The main thread hands each group, in order, to file_create_many, which
+// allocates the whole group's blocks in one pass and writes them in one
+// submission. Everything runs in one batch: metadata is persisted once at
+// the end, and a failed import leaves the container as it was. Files bigger
+// than a group stream through the upload API in UPLOAD_CHUNK pieces instead.
+
+static const size_t GROUP_BYTES = 64u << 20;
+static const size_t GROUP_FILES = 1024;
+static const size_t UPLOAD_CHUNK = 16u << 20;
+
+struct Source {
+    std::string host;
+    std::string path;  // in the container
+    uint64_t size;
+};
+
+// A run of sources [first, last) and, once loaded, their bytes back to back.
+struct Group {
+    size_t first = 0, last = 0;
+    bool big = false;  // one file of more than GROUP_BYTES, streamed
+    std::vector<char> data;
+    bool ready = false;
+    bool failed = false;
+};
+
+static bool read_range(int fd, char* out, uint64_t size, uint64_t offset) {
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t r = pread(fd, out + done, (size_t)(size - done), (off_t)(offset + done));
+        if (r <= 0) return false;
+        done += (uint64_t)r;
+    }
+    return true;
+}
+
+static bool read_all(const std::string& path, char* out, uint64_t size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = read_range(fd, out, size, 0);
+    close(fd);
+    return ok;
+}
+
+static std::string join(const std::string& dir, const std::string& rel) {
+    if (rel.empty()) return dir;
+    return dir == "/" ? "/" + rel : dir + "/" + rel;
+}
+
+static void usage() {
+    std::cerr << "Usage: fs_import <container.omni> <host_dir> [dest_dir] [--threads N] [--config c.uconf]"
+                 " [--user u --password p]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) { usage(); return 1; }
+    std::string dest = "/";
+    const char* config = nullptr;
+    std::string user = "admin", password = "admin123";
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    for (int i = 3; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) threads = (unsigned)std::max(1, std::atoi(argv[++i]));
+        else if (a == "--config" && i + 1 < argc) config = argv[++i];
+        else if (a == "--user" && i + 1 < argc) user = argv[++i];
+        else if (a == "--password" && i + 1 < argc) password = argv[++i];
+        else if (i == 3 && a[0] == '/') dest = a;
+        else { usage(); return 1; }
+    }
+    while (dest.size() > 1 && dest.back() == '/') dest.pop_back();
+
+    // Walk the tree first: directories in the order met (parents first) and
+    // regular files with their sizes.
+    namespace fs = std::filesystem;
+    std::vector<std::string> dirs;
+    std::vector<Source> files;
+    uint64_t total_bytes = 0;
+    size_t skipped = 0;
+    std::error_code ec;
+    fs::path root(argv[2]);
+    for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string rel = it->path().lexically_relative(root).generic_string();
+        std::string path = join(dest, rel);
+        if (path.size() >= sizeof(FileEntry::name)) {
+            std::cerr << "skipping (path too long): " << it->path() << std::endl;
+            ++skipped;
+            if (it->is_directory()) it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_symlink()) { ++skipped; continue; }
+        if (it->is_directory()) {
+            dirs.push_back(path);
+        } else if (it->is_regular_file()) {
+            uint64_t size = it->file_size();
+            files.push_back({it->path().string(), path, size});
+            total_bytes += size;
+        } else {
+            ++skipped;
+        }
+    }
+    if (ec) { std::cerr << "cannot walk " << argv[2] << ": " << ec.message() << std::endl; return 1; }
+
+    std::vector<Group> groups;
+    for (size_t i = 0; i < files.size();) {
+        Group g;
+        g.first = i;
+        if (files[i].size > GROUP_BYTES) {
+            g.big = true;
+            ++i;
+        } else {
+            uint64_t bytes = 0;
+            while (i < files.size() && files[i].size <= GROUP_BYTES && i - g.first < GROUP_FILES &&
+                   bytes + files[i].size <= GROUP_BYTES) {
+                bytes += files[i].size;
+                ++i;
+            }
+        }
+        g.last = i;
+        groups.push_back(std::move(g));
+    }
+
+    void* instance = nullptr;
+    if (fs_init(&instance, argv[1], config) != 0) { std::cerr << "cannot open " << argv[1] << std::endl; return 1; }
+    void* session = nullptr;
+    if (user_login(instance, &session, user.c_str(), password.c_str()) != 0) {
+        std::cerr << "login failed for " << user << std::endl;
+        fs_shutdown(instance);
+        return 1;
+    }
+
+    // Readers fill groups ahead of the writer, at most `ahead` groups (and so
+    // about ahead * GROUP_BYTES of memory) past the one being written.
+    std::mutex m;
+    std::condition_variable cv;
+    size_t next_group = 0, writing = 0;
+    const size_t ahead = threads + 1;
+    bool stop = false;
+    auto reader = [&]() {
+        for (;;) {
+            size_t gi;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                cv.wait(lk, [&] { return stop || next_group < std::min(groups.size(), writing + ahead); });
+                if (stop || next_group >= groups.size()) return;
+                gi = next_group++;
+            }
+            Group& g = groups[gi];
+            bool ok = true;
+            if (!g.big) {
+                uint64_t bytes = 0;
+                for (size_t i = g.first; i < g.last; ++i) bytes += files[i].size;
+                g.data.resize((size_t)bytes);
+                uint64_t at = 0;
+                for (size_t i = g.first; i < g.last && ok; ++i) {
+                    ok = read_all(files[i].host, g.data.data() + at, files[i].size);
+                    if (!ok) std::cerr << "cannot read " << files[i].host << std::endl;
+                    at += files[i].size;
+                }
+            }
+            std::lock_guard<std::mutex> lk(m);
+            g.ready = true;
+            g.failed = !ok;
+            cv.notify_all();
+        }
+    };
+
+    auto t0 = std::chrono::steady_clock::now();
+    fs_batch_begin(instance);
+    int rc = 0;
+    if (dest != "/") {
+        int r = dir_create(instance, session, dest.c_str());
+        if (r != 0 && r != static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS)) rc = r;
+    }
+    for (size_t i = 0; i < dirs.size() && rc == 0; ++i) {
+        int r = dir_create(instance, session, dirs[i].c_str());
+        if (r != 0 && r != static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS)) {
+            std::cerr << "dir_create " << dirs[i] << ": " << r << std::endl;
+            rc = r;
+        }
+    }
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) pool.emplace_back(reader);
+    std::vector<ImportItem> items;
+    std::vector<char> chunk;
+    for (size_t gi = 0; gi < groups.size() && rc == 0; ++gi) {
+        Group& g = groups[gi];
+        {
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&] { return g.ready; });
+        }
+        if (g.failed) { rc = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR); break; }
+        if (g.big) {
+            // Streamed: upload blocks are written as each chunk arrives.
+            const Source& src = files[g.first];
+            uint64_t handle = 0, size = 0;
+            rc = file_upload_open(instance, session, src.path.c_str(), &handle);
+            int fd = rc == 0 ? open(src.host.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+            if (rc == 0 && fd < 0) rc = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            chunk.resize(UPLOAD_CHUNK);
+            for (uint64_t off = 0; rc == 0 && off < src.size;) {
+                size_t n = (size_t)std::min<uint64_t>(UPLOAD_CHUNK, src.size - off);
+                if (!read_range(fd, chunk.data(), n, off)) {
+                    rc = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+                    break;
+                }
+                rc = file_upload_write(instance, session, handle, off, chunk.data(), n, &size);
+                off += n;
+            }
+            if (fd >= 0) close(fd);
+            if (rc == 0) rc = file_upload_commit(instance, session, handle);
+            else if (handle) file_upload_abort(instance, session, handle);
+            if (rc != 0) std::cerr << "import " << src.host << ": " << rc << std::endl;
+        } else {
+            items.clear();
+            uint64_t at = 0;
+            for (size_t i = g.first; i < g.last; ++i) {
+                items.push_back({files[i].path.c_str(), g.data.data() + at, files[i].size, 0});
+                at += files[i].size;
+            }
+            rc = file_create_many(instance, session, items.data(), (int)items.size());
+            for (size_t i = 0; i < items.size(); ++i)
+                if (items[i].result != 0) std::cerr << "import " << files[g.first + i].host << ": " << items[i].result << std::endl;
+        }
+        std::lock_guard<std::mutex> lk(m);
+        std::vector<char>().swap(g.data);
+        writing = gi + 1;
+        cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stop = true;
+        cv.notify_all();
+    }
+    for (auto& t : pool) t.join();
+    fs_batch_end(instance, rc == 0 ? 1 : 0);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    delete reinterpret_cast<SessionInfo*>(session);
+    fs_shutdown(instance);
+    if (rc != 0) {
+        std::cerr << "import failed (" << rc << "); the container is unchanged" << std::endl;
+        return 1;
+    }
+    std::cout << "imported " << files.size() << " files (" << dirs.size() << " directories, " << total_bytes
+              << " bytes) in " << secs << " s, " << (secs > 0 ? total_bytes / 1e6 / secs : 0) << " MB/s";
+    if (skipped) std::cout << "; skipped " << skipped;
+    std::cout << std::endl;
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "../source/server/json_view.hpp"
+
+// Load generator for a running fifo_server. Opens N connections speaking
+// JSON lines or HTTP/1.1, pipelines requests drawn from an operation mix and
+// a file-size distribution, and reports throughput and latency percentiles.
+//
+//   fs_load <host> <port> <user> <password> [--proto json|http] [--conns 4]
+//           [--rate 0] [--duration 10] [--pipeline 8] [--files 100]
+//           [--mix read=60,create=30,list=5,exists=5] [--sizes 1024:70,65536:25,1048576:5]
+//
+// --rate is the total target in requests/s, spread evenly over the
+// connections. With a rate the load is open-loop: each request has a
+// scheduled send time and its latency is measured from that time, so a
+// server that falls behind shows up in the percentiles instead of silently
+// slowing the generator down. --rate 0 runs closed-loop, keeping --pipeline
+// requests in flight per connection.
+
+enum Op { OP_READ, OP_CREATE, OP_LIST, OP_EXISTS, OP_KINDS };
+static const char* const OP_LABELS[OP_KINDS] = {"read", "create", "list", "exists"};
+
+struct Config {
+    std::string host;
+    int port = 0;
+    std::string token;
+    bool http = false;
+    int conns = 4;
+    double rate = 0;
+    double duration = 10;
+    int pipeline = 8;
+    int files = 100;
+    std::vector<std::pair<int, double>> mix;        // op, weight
+    std::vector<std::pair<size_t, double>> sizes;   // bytes, weight
+};
+
+struct Outcome {
+    uint64_t sent = 0;
+    uint64_t ok = 0, errors = 0, busy = 0, timeouts = 0;
+    uint64_t late = 0;  // open-loop sends that went out after their slot
+    std::vector<uint64_t> lat_ns[OP_KINDS];
+};
+
+static uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int connect_to(const std::string& host, int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) { perror("socket"); return -1; }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &sa.sin_addr);
+    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); close(s); return -1; }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+// Blocking JSON-lines call, used for login and setup only.
+static bool json_call(int s, const std::string& req, std::string& line) {
+    size_t off = 0;
+    while (off < req.size()) {
+        ssize_t w = send(s, req.data() + off, req.size() - off, MSG_NOSIGNAL);
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    line.clear();
+    char buf[65536];
+    while (line.empty() || line.back() != '\n') {
+        ssize_t r = recv(s, buf, sizeof(buf), 0);
+        if (r <= 0) return false;
+        line.append(buf, (size_t)r);
+    }
+    return true;
+}
+
+// Parses "a=1,b=2" (or "a:1,b:2") into name/weight pairs.
+static bool parse_weights(const std::string& spec, std::vector<std::pair<std::string, double>>& out) {
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        if (comma == std::string::npos) comma = spec.size();
+        std::string item = spec.substr(pos, comma - pos);
+        size_t eq = item.find_first_of("=:");
+        if (eq == std::string::npos) return false;
+        double w = std::atof(item.c_str() + eq + 1);
+        if (w < 0) return false;
+        out.emplace_back(item.substr(0, eq), w);
+        pos = comma + 1;
+    }
+    return !out.empty();
+}
+
+template <typename T>
+static T pick(const std::vector<std::pair<T, double>>& choices, std::mt19937_64& rng) {
+    double total = 0;
+    for (auto& c : choices) total += c.second;
+    double x = std::uniform_real_distribution<double>(0, total)(rng);
+    for (auto& c : choices) {
+        if (x < c.second) return c.first;
+        x -= c.second;
+    }
+    return choices.back().first;
+}
+
+static std::string file_path(int i) { return "/load/f" + std::to_string(i); }
+
+// File contents of every size class, built once and shared by the workers.
+// Plain letters, so no JSON escaping is needed.
+static std::vector<std::string> g_payloads;
+
+static const std::string& payload_for(const Config& cfg, size_t size) {
+    for (size_t i = 0; i < cfg.sizes.size(); ++i)
+        if (cfg.sizes[i].first == size) return g_payloads[i];
+    return g_payloads[0];
+}
+
+static std::string make_body(const Config& cfg, int op, std::mt19937_64& rng, uint64_t id) {
+    std::string path = file_path((int)(rng() % (uint64_t)cfg.files));
+    std::string b = "{\"operation\":\"";
+    switch (op) {
+    case OP_READ: b += "file_read"; break;
+    case OP_CREATE: b += "file_create"; break;
+    case OP_LIST: b += "dir_list"; path = "/load"; break;
+    default: b += "file_exists"; break;
+    }
+    b += "\",\"request_id\":\"" + std::to_string(id) + "\",\"token\":\"" + cfg.token + "\",\"path\":\"" + path + "\"";
+    if (op == OP_CREATE) {
+        b += ",\"data\":\"";
+        b += payload_for(cfg, pick(cfg.sizes, rng));
+        b += "\"";
+    }
+    b += "}";
+    return b;
+}
+
+static void frame_request(const Config& cfg, const std::string& body, std::string& out) {
+    if (!cfg.http) {
+        out += body;
+        out += '\n';
+        return;
+    }
+    out += "POST / HTTP/1.1\r\nHost: ";
+    out += cfg.host;
+    out += "\r\nContent-Type: application/json\r\nContent-Length: ";
+    out += std::to_string(body.size());
+    out += "\r\n\r\n";
+    out += body;
+}
+
+// Length of the first complete response in `in`, or 0 if it is still partial.
+// `body` is set to the JSON part.
+static size_t next_response(const Config& cfg, const std::string& in, size_t start, std::string_view& body) {
+    if (!cfg.http) {
+        size_t nl = in.find('\n', start);
+        if (nl == std::string::npos) return 0;
+        body = std::string_view(in).substr(start, nl - start);
+        return nl + 1 - start;
+    }
+    size_t end = in.find("\r\n\r\n", start);
+    if (end == std::string::npos) return 0;
+    size_t cl = in.find("Content-Length: ", start);
+    size_t len = cl != std::string::npos && cl < end ? (size_t)std::atoll(in.c_str() + cl + 16) : 0;
+    if (in.size() - (end + 4) < len) return 0;
+    body = std::string_view(in).substr(end + 4, len);
+    return end + 4 + len - start;
+}
+
+static void classify(std::string_view body, Outcome& out) {
+    if (body.find("\"status\":\"success\"") != std::string_view::npos) ++out.ok;
+    else if (body.find("\"busy\"") != std::string_view::npos) ++out.busy;
+    else if (body.find("\"timeout\"") != std::string_view::npos) ++out.timeouts;
+    else ++out.errors;
+}
+
+// One connection: sends on schedule (or whenever a pipeline slot is free),
+// reads responses in order and records each latency under its operation.
+static void run_connection(const Config& cfg, int index, uint64_t start_ns, Outcome& out) {
+    int s = connect_to(cfg.host, cfg.port);
+    if (s < 0) return;
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    std::mt19937_64 rng(0x9e3779b97f4a7c15ull * (uint64_t)(index + 1));
+    uint64_t end_ns = start_ns + (uint64_t)(cfg.duration * 1e9);
+    uint64_t drain_ns = end_ns + 5000000000ull;
+    uint64_t interval = cfg.rate > 0 ? (uint64_t)(1e9 * cfg.conns / cfg.rate) : 0;
+    // Stagger connections across one interval so they do not send in lockstep.
+    uint64_t next_send = start_ns + (cfg.conns ? interval * (uint64_t)index / (uint64_t)cfg.conns : 0);
+    struct Pending { uint64_t scheduled_ns; int op; };
+    std::deque<Pending> inflight;
+    std::string outbuf, inbuf;
+    size_t out_off = 0;
+    uint64_t id = (uint64_t)index << 40;
+    char buf[256 * 1024];
+
+    while (true) {
+        uint64_t now = now_ns();
+        if (now >= drain_ns || (now >= end_ns && inflight.empty())) break;
+        while (now < end_ns && (int)inflight.size() < cfg.pipeline && (interval == 0 || next_send <= now)) {
+            int op = pick(cfg.mix, rng);
+            frame_request(cfg, make_body(cfg, op, rng, ++id), outbuf);
+            uint64_t scheduled = interval ? next_send : now;
+            if (interval && now - next_send > 1000000) ++out.late;
+            inflight.push_back({scheduled, op});
+            ++out.sent;
+            if (interval) next_send += interval;
+        }
+        while (out_off < outbuf.size()) {
+            ssize_t w = send(s, outbuf.data() + out_off, outbuf.size() - out_off, MSG_NOSIGNAL);
+            if (w <= 0) break;
+            out_off += (size_t)w;
+        }
+        if (out_off == outbuf.size()) { outbuf.clear(); out_off = 0; }
+
+        int timeout_ms = 100;
+        if (interval && now < end_ns && (int)inflight.size() < cfg.pipeline)
+            timeout_ms = next_send > now ? (int)std::min<uint64_t>(100, (next_send - now) / 1000000) : 0;
+        struct pollfd pfd = {s, (short)(POLLIN | (outbuf.empty() ? 0 : POLLOUT)), 0};
+        if (poll(&pfd, 1, timeout_ms) < 0) break;
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        ssize_t r = recv(s, buf, sizeof(buf), 0);
+        if (r == 0) break;
+        if (r < 0) continue;
+        inbuf.append(buf, (size_t)r);
+        size_t pos = 0;
+        std::string_view body;
+        uint64_t done = now_ns();
+        while (!inflight.empty()) {
+            size_t n = next_response(cfg, inbuf, pos, body);
+            if (n == 0) break;
+            classify(body, out);
+            Pending p = inflight.front();
+            inflight.pop_front();
+            out.lat_ns[p.op].push_back(done - p.scheduled_ns);
+            pos += n;
+        }
+        inbuf.erase(0, pos);
+    }
+    // Whatever is still in flight after the drain window never completed.
+    out.errors += inflight.size();
+    close(s);
+}
+
+static double pct_us(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(q * (double)sorted.size()));
+    return (double)sorted[i] / 1000.0;
+}
+
+static void print_row(const char* name, std::vector<uint64_t>& lat, double secs) {
+    std::sort(lat.begin(), lat.end());
+    printf("%-8s %10zu %10.0f %10.1f %10.1f %10.1f %10.1f\n", name, lat.size(), (double)lat.size() / secs,
+           pct_us(lat, 0.50), pct_us(lat, 0.99), pct_us(lat, 0.999), lat.empty() ? 0.0 : (double)lat.back() / 1000.0);
+}
+
+static void usage() {
+    std::cout << "Usage: fs_load <host> <port> <user> <password> [--proto json|http] [--conns N] [--rate req/s]\n"
+                 "               [--duration s] [--pipeline N] [--files N] [--mix read=60,create=30,list=5,exists=5]\n"
+                 "               [--sizes 1024:70,65536:25,1048576:5]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 5) { usage(); return 1; }
+    Config cfg;
+    cfg.host = argv[1];
+    cfg.port = std::atoi(argv[2]);
+    std::string mix_spec = "read=60,create=30,list=5,exists=5";
+    std::string size_spec = "1024:70,65536:25,1048576:5";
+    for (int i = 5; i < argc; ++i) {
+        std::string a = argv[i];
+        if (i + 1 >= argc) { usage(); return 1; }
+        std::string v = argv[++i];
+        if (a == "--proto") cfg.http = v == "http";
+        else if (a == "--conns") cfg.conns = std::max(1, std::atoi(v.c_str()));
+        else if (a == "--rate") cfg.rate = std::atof(v.c_str());
+        else if (a == "--duration") cfg.duration = std::atof(v.c_str());
+        else if (a == "--pipeline") cfg.pipeline = std::max(1, std::atoi(v.c_str()));
+        else if (a == "--files") cfg.files = std::max(1, std::atoi(v.c_str()));
+        else if (a == "--mix") mix_spec = v;
+        else if (a == "--sizes") size_spec = v;
+        else { usage(); return 1; }
+    }
+
+    std::vector<std::pair<std::string, double>> w;
+    if (!parse_weights(mix_spec, w)) { std::cerr << "bad --mix\n"; return 1; }
+    for (auto& kv : w) {
+        int op = -1;
+        for (int k = 0; k < OP_KINDS; ++k)
+            if (kv.first == OP_LABELS[k]) op = k;
+        if (op < 0) { std::cerr << "unknown operation in --mix: " << kv.first << "\n"; return 1; }
+        cfg.mix.emplace_back(op, kv.second);
+    }
+    w.clear();
+    if (!parse_weights(size_spec, w)) { std::cerr << "bad --sizes\n"; return 1; }
+    for (auto& kv : w) {
+        cfg.sizes.emplace_back((size_t)std::atoll(kv.first.c_str()), kv.second);
+        g_payloads.emplace_back(cfg.sizes.back().first, 'a');
+        std::string& p = g_payloads.back();
+        for (size_t i = 0; i < p.size(); i += 61) p[i] = (char)('a' + i % 26);
+    }
+
+    // Log in and populate /load/f0..f<files-1> with sizes from the distribution.
+    int s = connect_to(cfg.host, cfg.port);
+    if (s < 0) return 1;
+    std::string line;
+    std::string login = std::string("{\"operation\":\"user_login\",\"username\":\"") + argv[3] +
+                        "\",\"password\":\"" + argv[4] + "\"}\n";
+    if (!json_call(s, login, line)) { std::cerr << "login failed\n"; return 1; }
+    JsonView jv;
+    jv.parse(line);
+    cfg.token = jv.get("token");
+    if (cfg.token.empty()) { std::cerr << "login failed: " << line; return 1; }
+    json_call(s, "{\"operation\":\"dir_create\",\"token\":\"" + cfg.token + "\",\"path\":\"/load\"}\n", line);
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < cfg.files; ++i) {
+        std::string req = "{\"operation\":\"file_create\",\"token\":\"" + cfg.token + "\",\"path\":\"" + file_path(i) +
+                          "\",\"data\":\"" + payload_for(cfg, pick(cfg.sizes, rng)) + "\"}\n";
+        if (!json_call(s, req, line) || line.find("\"success\"") == std::string::npos) {
+            std::cerr << "setup failed at " << file_path(i) << ": " << line;
+            return 1;
+        }
+    }
+    close(s);
+
+    std::cout << "fs_load: " << cfg.conns << " " << (cfg.http ? "http" : "json") << " connections, pipeline "
+              << cfg.pipeline << ", " << (cfg.rate > 0 ? std::to_string((long long)cfg.rate) + " req/s open-loop" : "closed-loop")
+              << ", " << cfg.duration << " s, mix " << mix_spec << ", sizes " << size_spec << std::endl;
+
+    std::vector<Outcome> outcomes((size_t)cfg.conns);
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns() + 10000000;  // let every thread connect first
+    for (int i = 0; i < cfg.conns; ++i)
+        threads.emplace_back(run_connection, std::cref(cfg), i, start, std::ref(outcomes[(size_t)i]));
+    for (auto& t : threads) t.join();
+    double secs = (double)(now_ns() - start) / 1e9;
+
+    Outcome total;
+    for (Outcome& o : outcomes) {
+        total.sent += o.sent;
+        total.ok += o.ok;
+        total.errors += o.errors;
+        total.busy += o.busy;
+        total.timeouts += o.timeouts;
+        total.late += o.late;
+        for (int k = 0; k < OP_KINDS; ++k)
+            total.lat_ns[k].insert(total.lat_ns[k].end(), o.lat_ns[k].begin(), o.lat_ns[k].end());
+    }
+    std::vector<uint64_t> all;
+    printf("\n%-8s %10s %10s %10s %10s %10s %10s\n", "op", "count", "req/s", "p50 us", "p99 us", "p999 us", "max us");
+    for (int k = 0; k < OP_KINDS; ++k) {
+        if (total.lat_ns[k].empty()) continue;
+        all.insert(all.end(), total.lat_ns[k].begin(), total.lat_ns[k].end());
+        print_row(OP_LABELS[k], total.lat_ns[k], secs);
+    }
+    print_row("all", all, secs);
+    printf("\nsent %llu, ok %llu, errors %llu, busy %llu, timeout %llu",
+           (unsigned long long)total.sent, (unsigned long long)total.ok, (unsigned long long)total.errors,
+           (unsigned long long)total.busy, (unsigned long long)total.timeouts);
+    if (cfg.rate > 0)
+        printf(", sent late %llu (target %.0f req/s, achieved %.0f)", (unsigned long long)total.late, cfg.rate,
+               (double)all.size() / secs);
+    printf("\n");
+    return total.errors || total.timeouts ? 1 : 0;
+}
@@ -0,0 +1,350 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include "../source/server/bin_protocol.hpp"
+#include "../source/server/capture.hpp"
+#include "../source/server/json_view.hpp"
+
+// Re-drives a request capture (FILEVERSE_CAPTURE on the server) against a
+// running fifo_server and reports latency per operation.
+//
+//   fs_replay <capture> <host> <port> [--fast] [--speed 1.0] [--user u --password p]
+//
+// Each captured connection gets its own connection, speaking its original
+// protocol, with its requests in their original order. By default requests
+// go out at their captured offsets (divided by --speed) whether or not
+// earlier ones were answered, and latency counts from that scheduled time.
+// --fast ignores the timestamps: every connection sends its next request as
+// soon as the previous one is answered.
+//
+// Session tokens in the capture belong to the recording server. With --user
+// the tool logs in once and substitutes its token into every request. Replay
+// against a copy of the .omni taken when the capture started, so paths and
+// users match. Stateful handles (uploads, downloads) do not carry over and
+// show up as errors.
+
+static uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int connect_to(const char* host, int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) { perror("socket"); return -1; }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, host, &sa.sin_addr);
+    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); close(s); return -1; }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+// Replaces the value of "token" in a JSON object, if it has one.
+static void rewrite_token(std::string& json, const std::string& token) {
+    size_t k = json.find("\"token\"");
+    if (k == std::string::npos) return;
+    size_t q = json.find('"', json.find(':', k + 7) + 1);
+    if (q == std::string::npos) return;
+    size_t e = json.find('"', q + 1);
+    if (e == std::string::npos) return;
+    json.replace(q + 1, e - q - 1, token);
+}
+
+// The bytes to send for a captured request, with the token substituted.
+static std::string frame_request(const CapturedRequest& cr, const std::string& token, const std::string& host) {
+    CaptureProto proto = static_cast<CaptureProto>(cr.rec.proto);
+    if (proto == CaptureProto::BINARY) {
+        if (token.empty() || cr.body.size() < sizeof(BinHeader)) return cr.body;
+        BinHeader h;
+        memcpy(&h, cr.body.data(), sizeof(h));
+        size_t payload_at = sizeof(h) + h.meta_len;
+        std::string meta = cr.body.substr(sizeof(h), h.meta_len);
+        rewrite_token(meta, token);
+        h.meta_len = (uint32_t)meta.size();
+        std::string out;
+        append_bin_header(out, h);
+        out += meta;
+        if (payload_at < cr.body.size()) out.append(cr.body, payload_at, std::string::npos);
+        return out;
+    }
+    std::string body = cr.body;
+    if (!token.empty()) rewrite_token(body, token);
+    if (proto == CaptureProto::JSON_LINES) return body + "\n";
+    std::string out = "POST / HTTP/1.1\r\nHost: " + host + "\r\nContent-Type: application/json\r\nContent-Length: ";
+    out += std::to_string(body.size());
+    out += "\r\n\r\n";
+    out += body;
+    return out;
+}
+
+static std::string op_name(const CapturedRequest& cr) {
+    static const char* const BIN_NAMES[] = {"bin_?", "bin_ping", "bin_file_write", "bin_file_read", "bin_json",
+                                            "bin_upload_chunk", "bin_download_chunk"};
+    std::string_view json = cr.body;
+    if (static_cast<CaptureProto>(cr.rec.proto) == CaptureProto::BINARY) {
+        if (cr.body.size() < sizeof(BinHeader)) return "bin_?";
+        BinHeader h;
+        memcpy(&h, cr.body.data(), sizeof(h));
+        if (h.opcode != static_cast<uint8_t>(BinOpcode::JSON)) return BIN_NAMES[h.opcode < 7 ? h.opcode : 0];
+        json = std::string_view(cr.body).substr(sizeof(h), h.meta_len);
+    }
+    JsonView jv;
+    if (!jv.parse(json)) return "invalid";
+    std::string op = jv.get("operation");
+    return op.empty() ? "invalid" : op;
+}
+
+enum Reply { REPLY_OK, REPLY_ERROR, REPLY_BUSY, REPLY_TIMEOUT };
+
+// Length of the first complete response at `start` (0 if partial) and its outcome.
+static size_t next_response(CaptureProto proto, const std::string& in, size_t start, Reply& res) {
+    std::string_view body;
+    size_t len = 0;
+    if (proto == CaptureProto::BINARY) {
+        if (in.size() - start < sizeof(BinHeader)) return 0;
+        BinHeader h;
+        memcpy(&h, in.data() + start, sizeof(h));
+        len = sizeof(h) + h.meta_len + (size_t)h.payload_len;
+        if (in.size() - start < len) return 0;
+        res = h.status == 0 ? REPLY_OK : h.status == BIN_STATUS_BUSY ? REPLY_BUSY : h.status == BIN_STATUS_TIMEOUT ? REPLY_TIMEOUT : REPLY_ERROR;
+        return len;
+    }
+    if (proto == CaptureProto::JSON_LINES) {
+        size_t nl = in.find('\n', start);
+        if (nl == std::string::npos) return 0;
+        body = std::string_view(in).substr(start, nl - start);
+        len = nl + 1 - start;
+    } else {
+        size_t end = in.find("\r\n\r\n", start);
+        if (end == std::string::npos) return 0;
+        size_t cl = in.find("Content-Length: ", start);
+        size_t n = cl != std::string::npos && cl < end ? (size_t)std::atoll(in.c_str() + cl + 16) : 0;
+        if (in.size() - (end + 4) < n) return 0;
+        body = std::string_view(in).substr(end + 4, n);
+        len = end + 4 + n - start;
+    }
+    if (body.find("\"status\":\"success\"") != std::string_view::npos) res = REPLY_OK;
+    else if (body.find("\"busy\"") != std::string_view::npos) res = REPLY_BUSY;
+    else if (body.find("\"timeout\"") != std::string_view::npos) res = REPLY_TIMEOUT;
+    else res = REPLY_ERROR;
+    return len;
+}
+
+struct Stream {
+    CaptureProto proto = CaptureProto::JSON_LINES;
+    std::vector<size_t> reqs;  // indices into the capture, in order
+    size_t next = 0;
+    int fd = -1;
+    bool done = false;
+    struct Pending { uint64_t scheduled_ns; size_t req; };
+    std::deque<Pending> inflight;
+    std::string out, in;
+    size_t out_off = 0;
+};
+
+struct OpLatency {
+    std::vector<uint64_t> ns;
+    uint64_t errors = 0;
+};
+
+static double pct_us(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(q * (double)sorted.size()));
+    return (double)sorted[i] / 1000.0;
+}
+
+static void print_row(const std::string& name, std::vector<uint64_t>& lat, uint64_t errors) {
+    std::sort(lat.begin(), lat.end());
+    printf("%-20s %9zu %7llu %10.1f %10.1f %10.1f %10.1f\n", name.c_str(), lat.size(), (unsigned long long)errors,
+           pct_us(lat, 0.50), pct_us(lat, 0.99), pct_us(lat, 0.999), lat.empty() ? 0.0 : (double)lat.back() / 1000.0);
+}
+
+static void usage() {
+    std::cout << "Usage: fs_replay <capture> <host> <port> [--fast] [--speed 1.0] [--user u --password p]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) { usage(); return 1; }
+    const char* host = argv[2];
+    int port = std::atoi(argv[3]);
+    bool fast = false;
+    double speed = 1.0;
+    std::string user, password;
+    for (int i = 4; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--fast") fast = true;
+        else if (a == "--speed" && i + 1 < argc) speed = std::max(0.001, std::atof(argv[++i]));
+        else if (a == "--user" && i + 1 < argc) user = argv[++i];
+        else if (a == "--password" && i + 1 < argc) password = argv[++i];
+        else { usage(); return 1; }
+    }
+
+    std::vector<CapturedRequest> cap;
+    if (!read_capture(argv[1], cap)) { std::cerr << "cannot read capture " << argv[1] << std::endl; return 1; }
+    if (cap.empty()) { std::cerr << "capture is empty" << std::endl; return 1; }
+
+    std::string token;
+    if (!user.empty()) {
+        int s = connect_to(host, port);
+        if (s < 0) return 1;
+        std::string req = "{\"operation\":\"user_login\",\"username\":\"" + user + "\",\"password\":\"" + password + "\"}\n";
+        ssize_t w = send(s, req.data(), req.size(), MSG_NOSIGNAL);
+        (void)w;
+        std::string line;
+        char buf[4096];
+        while (line.empty() || line.back() != '\n') {
+            ssize_t r = recv(s, buf, sizeof(buf), 0);
+            if (r <= 0) break;
+            line.append(buf, (size_t)r);
+        }
+        close(s);
+        JsonView jv;
+        jv.parse(line);
+        token = jv.get("token");
+        if (token.empty()) { std::cerr << "login failed: " << line; return 1; }
+    }
+
+    std::map<uint32_t, Stream> streams;
+    for (size_t i = 0; i < cap.size(); ++i) {
+        Stream& st = streams[cap[i].rec.conn_id];
+        st.proto = static_cast<CaptureProto>(cap[i].rec.proto);
+        st.reqs.push_back(i);
+    }
+    std::vector<std::string> names(cap.size());
+    for (size_t i = 0; i < cap.size(); ++i) names[i] = op_name(cap[i]);
+    uint64_t first_ns = cap.front().rec.offset_ns;
+    uint64_t captured_ns = cap.back().rec.offset_ns - first_ns;
+
+    printf("fs_replay: %zu requests on %zu connections, captured over %.2f s, ", cap.size(), streams.size(),
+           (double)captured_ns / 1e9);
+    if (fast) printf("fast\n");
+    else printf("timed at %gx\n", speed);
+
+    std::map<std::string, OpLatency> ops;
+    uint64_t ok = 0, errors = 0, busy = 0, timeouts = 0;
+    size_t open_streams = streams.size();
+    std::vector<struct pollfd> pfds;
+    std::vector<Stream*> pstreams;
+    char buf[256 * 1024];
+    uint64_t start = now_ns();
+    uint64_t last_progress = start;
+
+    auto finish = [&](Stream& st) {
+        for (auto& p : st.inflight) ops[names[p.req]].errors++;
+        errors += st.inflight.size();
+        st.inflight.clear();
+        if (st.fd >= 0) close(st.fd);
+        st.fd = -1;
+        st.done = true;
+        --open_streams;
+    };
+
+    while (open_streams > 0) {
+        uint64_t now = now_ns();
+        if (now - last_progress > 30000000000ull) {
+            std::cerr << "no progress for 30 s, giving up" << std::endl;
+            for (auto& kv : streams)
+                if (!kv.second.done) finish(kv.second);
+            break;
+        }
+        uint64_t next_due = UINT64_MAX;
+        pfds.clear();
+        pstreams.clear();
+        for (auto& kv : streams) {
+            Stream& st = kv.second;
+            if (st.done) continue;
+            while (st.next < st.reqs.size()) {
+                const CapturedRequest& cr = cap[st.reqs[st.next]];
+                uint64_t due = fast ? (st.inflight.empty() ? now : UINT64_MAX)
+                                    : start + (uint64_t)((double)(cr.rec.offset_ns - first_ns) / speed);
+                if (due > now) {
+                    next_due = std::min(next_due, due);
+                    break;
+                }
+                if (st.fd < 0) {
+                    st.fd = connect_to(host, port);
+                    if (st.fd < 0) {
+                        errors += st.reqs.size() - st.next;
+                        finish(st);
+                        break;
+                    }
+                    fcntl(st.fd, F_SETFL, fcntl(st.fd, F_GETFL, 0) | O_NONBLOCK);
+                }
+                st.out += frame_request(cr, token, host);
+                st.inflight.push_back({due, st.reqs[st.next]});
+                ++st.next;
+            }
+            if (st.done || st.fd < 0) continue;  // connect failed, or first request still ahead
+            while (st.out_off < st.out.size()) {
+                ssize_t w = send(st.fd, st.out.data() + st.out_off, st.out.size() - st.out_off, MSG_NOSIGNAL);
+                if (w <= 0) break;
+                st.out_off += (size_t)w;
+            }
+            if (st.out_off == st.out.size()) { st.out.clear(); st.out_off = 0; }
+            if (st.next == st.reqs.size() && st.inflight.empty()) { finish(st); continue; }
+            pfds.push_back({st.fd, (short)(POLLIN | (st.out.empty() ? 0 : POLLOUT)), 0});
+            pstreams.push_back(&st);
+        }
+        if (open_streams == 0) break;
+        int timeout_ms = next_due == UINT64_MAX ? 100 : (int)std::min<uint64_t>(100, next_due > now ? (next_due - now) / 1000000 : 0);
+        if (poll(pfds.data(), pfds.size(), timeout_ms) < 0) break;
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Stream& st = *pstreams[i];
+            ssize_t r = recv(st.fd, buf, sizeof(buf), 0);
+            if (r == 0) { finish(st); continue; }
+            if (r < 0) continue;
+            st.in.append(buf, (size_t)r);
+            uint64_t done = now_ns();
+            size_t pos = 0;
+            Reply res;
+            while (!st.inflight.empty()) {
+                size_t n = next_response(st.proto, st.in, pos, res);
+                if (n == 0) break;
+                Stream::Pending p = st.inflight.front();
+                st.inflight.pop_front();
+                OpLatency& ol = ops[names[p.req]];
+                ol.ns.push_back(done - p.scheduled_ns);
+                if (res == REPLY_OK) ++ok;
+                else if (res == REPLY_BUSY) ++busy;
+                else if (res == REPLY_TIMEOUT) ++timeouts;
+                else { ++errors; ++ol.errors; }
+                pos += n;
+                last_progress = done;
+            }
+            st.in.erase(0, pos);
+        }
+    }
+    double secs = (double)(now_ns() - start) / 1e9;
+
+    printf("\n%-20s %9s %7s %10s %10s %10s %10s\n", "operation", "count", "errors", "p50 us", "p99 us", "p999 us", "max us");
+    std::vector<uint64_t> all;
+    uint64_t all_errors = 0;
+    for (auto& kv : ops) {
+        all.insert(all.end(), kv.second.ns.begin(), kv.second.ns.end());
+        all_errors += kv.second.errors;
+        print_row(kv.first, kv.second.ns, kv.second.errors);
+    }
+    print_row("all", all, all_errors);
+    printf("\nreplayed %zu requests in %.2f s (%.0f req/s; captured %.2f s): ok %llu, errors %llu, busy %llu, timeout %llu\n",
+           cap.size(), secs, (double)all.size() / secs, (double)captured_ns / 1e9, (unsigned long long)ok,
+           (unsigned long long)errors, (unsigned long long)busy, (unsigned long long)timeouts);
+    return 0;
+}
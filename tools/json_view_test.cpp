@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include "../source/server/json_view.hpp"
+
+// Checks JsonView's handling of string escapes: well-formed ones decode,
+// malformed \u escapes fail the parse instead of yielding a cut-short value.
+// Prints PASS and exits 0 when every case holds.
+
+struct Case {
+    const char* name;
+    std::string json;
+    bool parses;
+    std::string data;  // decoded "data" when it parses
+};
+
+int main() {
+    Case cases[] = {
+        {"plain", "{\"data\":\"abc\"}", true, "abc"},
+        {"simple escapes", "{\"data\":\"a\\\"b\\\\c\\nd\\/e\"}", true, "a\"b\\c\nd/e"},
+        {"bmp", "{\"data\":\"x\\u00e9y\\u20acz\"}", true, "x\xc3\xa9y\xe2\x82\xacz"},
+        {"surrogate pair", "{\"data\":\"\\ud83d\\ude00!\"}", true, "\xf0\x9f\x98\x80!"},
+        {"bad hex", "{\"data\":\"ab\\u12g4cd\"}", false, ""},
+        {"short hex at end", "{\"data\":\"ab\\u12\"}", false, ""},
+        {"lone high surrogate", "{\"data\":\"ab\\ud83dcd\"}", false, ""},
+        {"high then non-low", "{\"data\":\"\\ud83d\\u0041\"}", false, ""},
+        {"lone low surrogate", "{\"data\":\"ab\\ude00\"}", false, ""},
+        {"bad escape in other field", "{\"path\":\"/a\",\"token\":\"\\uzzzz\",\"data\":\"ok\"}", false, ""},
+    };
+    bool ok = true;
+    for (const Case& c : cases) {
+        JsonView jv;
+        bool parsed = jv.parse(c.json);
+        std::string scratch;
+        std::string data = parsed ? std::string(jv.str("data", scratch)) : std::string();
+        bool pass = parsed == c.parses && (!parsed || data == c.data);
+        std::cout << (pass ? "  ok   " : "  FAIL ") << c.name << std::endl;
+        ok = ok && pass;
+    }
+
+    // decode() on its own reports failure too.
+    std::string out;
+    bool decode_ok = JsonView::decode("ab\\ud800", out) == false && JsonView::decode("ab\\u0041", out) && out == "abA";
+    std::cout << (decode_ok ? "  ok   " : "  FAIL ") << "decode result" << std::endl;
+    ok = ok && decode_ok;
+
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+#include "../source/server/json_view.hpp"
+#include "../source/server/response_writer.hpp"
+
+// Compares the old per-field extract_json_string scan with a single
+// JsonView::parse for a small control request and a multi-megabyte
+// file_create payload, and the old string-concatenation response path with
+// ResponseWriter (allocations, bytes allocated and bytes copied per response).
+
+static size_t g_allocs = 0;
+static size_t g_alloc_bytes = 0;
+
+void* operator new(size_t n) {
+    ++g_allocs;
+    g_alloc_bytes += n;
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// The pre-JsonView extractor, kept here as the baseline.
+static std::string extract_json_string(const std::string& json, const std::string& key) {
+    std::string pat = "\"" + key + "\"";
+    auto pos = json.find(pat);
+    if (pos == std::string::npos) return std::string();
+    pos = json.find(':', pos);
+    if (pos == std::string::npos) return std::string();
+    pos++;
+
+    while (pos < json.size() && isspace((unsigned char)json[pos])) pos++;
+    if (pos < json.size() && json[pos] == '"') {
+        pos++;
+        size_t end = pos;
+        while (end < json.size() && json[end] != '"') end++;
+        return json.substr(pos, end - pos);
+    }
+    return std::string();
+}
+
+static volatile size_t g_sink = 0;
+
+template <typename Fn>
+static double time_ns(int iters, Fn fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+}
+
+static void run_case(const char* name, const std::string& req, int iters) {
+    static const char* keys[] = {"operation", "request_id", "token", "path", "data"};
+    double old_ns = time_ns(iters, [&]() {
+        size_t n = 0;
+        for (const char* k : keys) n += extract_json_string(req, k).size();
+        g_sink += n;
+    });
+    double new_ns = time_ns(iters, [&]() {
+        JsonView jv;
+        jv.parse(req);
+        std::string scratch;
+        size_t n = 0;
+        for (const char* k : keys) n += jv.str(k, scratch).size();
+        g_sink += n;
+    });
+    std::cout << name << " (" << req.size() << " bytes): extract_json_string " << old_ns
+              << " ns/req, JsonView " << new_ns << " ns/req, speedup " << (old_ns / new_ns) << "x\n";
+}
+
+// The pre-ResponseWriter file_read response over HTTP, step for step.
+// Returns the bytes written into intermediate strings.
+static size_t old_file_read_response(const std::string& id, const char* buf, size_t sz, std::string& out) {
+    std::string s(buf, sz);
+    std::string esc;
+    for (char c : s) {
+        if (c == '\\') esc += "\\\\";
+        else if (c == '"') esc += "\\\"";
+        else if (c == '\n') esc += "\\n";
+        else esc += c;
+    }
+    std::string resp = "{\"status\":\"success\",\"request_id\":\"" + id + "\",\"data\":\"" + esc + "\"}";
+    std::ostringstream oss;
+    oss << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: " << resp.size() << "\r\n\r\n";
+    oss << resp;
+    out = oss.str();
+    return s.size() + esc.size() + resp.size() + out.size() * 2;  // oss buffer + str() copy
+}
+
+// ResponseWriter into buffers that persist across responses (as the
+// per-connection pool does); headers, JSON head, escaped data and tail are
+// handed to writev separately.
+static size_t new_file_read_response(std::string_view id, const char* buf, size_t sz, std::string segs[4]) {
+    ResponseWriter w(&segs[1], &segs[2], &segs[3]);
+    w.begin("success", id);
+    w.bulk_string("data", std::string_view(buf, sz));
+    w.end(false);
+    segs[0].clear();
+    segs[0].append("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: ");
+    segs[0].append(std::to_string(w.size()));
+    segs[0].append("\r\n\r\n");
+    return segs[0].size() + w.size();
+}
+
+static void run_response_case(const char* name, size_t sz, int iters) {
+    std::string content(sz, 'a');
+    for (size_t i = 0; i < sz; i += 97) content[i] = '"';
+    std::string id = "1700000000000";
+
+    std::string out;
+    size_t a0 = g_allocs, b0 = g_alloc_bytes, copied_old = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) copied_old += old_file_read_response(id, content.data(), sz, out);
+    auto t1 = std::chrono::steady_clock::now();
+    size_t allocs_old = g_allocs - a0, bytes_old = g_alloc_bytes - b0;
+
+    std::string segs[4];
+    new_file_read_response(id, content.data(), sz, segs);  // warm the reusable buffers
+    size_t a1 = g_allocs, b1 = g_alloc_bytes, copied_new = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) copied_new += new_file_read_response(id, content.data(), sz, segs);
+    auto t3 = std::chrono::steady_clock::now();
+    size_t allocs_new = g_allocs - a1, bytes_new = g_alloc_bytes - b1;
+
+    double old_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / iters;
+    double new_us = std::chrono::duration<double, std::micro>(t3 - t2).count() / iters;
+    std::cout << name << " file_read response (" << sz << " bytes):\n"
+              << "  old:    " << old_us << " us, " << (double)allocs_old / iters << " allocs, "
+              << bytes_old / iters << " bytes allocated, " << copied_old / iters << " bytes copied\n"
+              << "  writer: " << new_us << " us, " << (double)allocs_new / iters << " allocs, "
+              << bytes_new / iters << " bytes allocated, " << copied_new / iters << " bytes copied\n";
+}
+
+int main(int argc, char** argv) {
+    size_t big = 4u << 20;
+    if (argc > 1) big = (size_t)std::stoull(argv[1]);
+
+    std::string small = "{\"operation\":\"file_exists\",\"request_id\":\"1700000000000\","
+                        "\"token\":\"tok-6553f1a2-0\",\"path\":\"/docs/report.txt\"}";
+    run_case("control", small, 200000);
+
+    std::string payload(big, 'x');
+    for (size_t i = 0; i < payload.size(); i += 64) payload[i] = ' ';
+    std::string large = "{\"operation\":\"file_create\",\"request_id\":\"42\",\"token\":\"tok-6553f1a2-0\","
+                        "\"path\":\"/media/blob.bin\",\"data\":\"" + payload + "\"}";
+    run_case("file_create", large, 50);
+
+    // With escapes the old scanner truncates at the first \" while JsonView decodes it.
+    std::string quoted = "{\"operation\":\"file_create\",\"path\":\"/q.txt\",\"data\":\"say \\\"hi\\\"\\n\"}";
+    JsonView jv;
+    jv.parse(quoted);
+    std::string scratch;
+    std::cout << "escaped data: old='" << extract_json_string(quoted, "data") << "' new='"
+              << jv.str("data", scratch) << "'\n";
+
+    run_response_case("small", 64, 100000);
+    run_response_case("large", big, 20);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <vector>
+#include "../source/server/bin_protocol.hpp"
+#include "../source/server/json_view.hpp"
+#include "../source/server/response_writer.hpp"
+
+// Upload/download throughput against a running fifo_server: binary frames vs
+// JSON lines, with a local write/read of the same bytes as the disk baseline.
+// Usage: transfer_bench <host> <port> <user> <password> [size_mb] [iterations]
+
+static int connect_to(const char* host, int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) { perror("socket"); return -1; }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, host, &sa.sin_addr);
+    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); close(s); return -1; }
+    return s;
+}
+
+static bool send_all(int s, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(s, p, n, MSG_NOSIGNAL);
+        if (w <= 0) return false;
+        p += w; n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool recv_all(int s, char* p, size_t n) {
+    while (n > 0) {
+        ssize_t r = recv(s, p, n, 0);
+        if (r <= 0) return false;
+        p += r; n -= (size_t)r;
+    }
+    return true;
+}
+
+// Sends one binary frame and reads the response frame.
+static bool bin_call(int s, BinOpcode op, uint32_t id, const std::string& meta, const char* payload, size_t payload_len,
+                     BinHeader& rh, std::string& rmeta, std::string& rpayload) {
+    BinHeader h = make_bin_header(op, id, (uint32_t)meta.size(), payload_len);
+    if (!send_all(s, reinterpret_cast<const char*>(&h), sizeof(h)) || !send_all(s, meta.data(), meta.size()) ||
+        !send_all(s, payload, payload_len)) return false;
+    if (!recv_all(s, reinterpret_cast<char*>(&rh), sizeof(rh))) return false;
+    rmeta.resize(rh.meta_len);
+    rpayload.resize((size_t)rh.payload_len);
+    return recv_all(s, &rmeta[0], rmeta.size()) && recv_all(s, &rpayload[0], rpayload.size());
+}
+
+static bool json_call(int s, const std::string& req, std::string& line) {
+    if (!send_all(s, req.data(), req.size())) return false;
+    line.clear();
+    char buf[65536];
+    while (true) {
+        ssize_t r = recv(s, buf, sizeof(buf), 0);
+        if (r <= 0) return false;
+        line.append(buf, (size_t)r);
+        if (line.back() == '\n') return true;
+    }
+}
+
+static double mbps(size_t bytes, std::chrono::steady_clock::duration d) {
+    return (double)bytes / (1024.0 * 1024.0) / std::chrono::duration<double>(d).count();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        std::cout << "Usage: transfer_bench <host> <port> <user> <password> [size_mb] [iterations]" << std::endl;
+        return 1;
+    }
+    const char* host = argv[1];
+    int port = std::atoi(argv[2]);
+    size_t size = (argc > 5 ? (size_t)std::atol(argv[5]) : 16) << 20;
+    int iters = argc > 6 ? std::atoi(argv[6]) : 3;
+
+    int bs = connect_to(host, port);
+    if (bs < 0) return 1;
+    BinHeader rh;
+    std::string rmeta, rpayload;
+    std::string login = std::string("{\"operation\":\"user_login\",\"username\":\"") + argv[3] +
+                        "\",\"password\":\"" + argv[4] + "\"}";
+    if (!bin_call(bs, BinOpcode::JSON, 1, login, nullptr, 0, rh, rmeta, rpayload)) { std::cerr << "login failed\n"; return 1; }
+    JsonView jv;
+    jv.parse(rmeta);
+    std::string token = jv.get("token");
+    if (token.empty()) { std::cerr << "login failed: " << rmeta << "\n"; return 1; }
+    std::string meta = "{\"token\":\"" + token + "\",\"path\":\"/transfer_bench.bin\"}";
+
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = (char)((i * 2654435761u) >> 13);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+        if (!bin_call(bs, BinOpcode::FILE_WRITE, 2, meta, data.data(), size, rh, rmeta, rpayload) || rh.status != 0) {
+            std::cerr << "binary upload failed: " << rh.status << " " << rmeta << "\n";
+            return 1;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+        if (!bin_call(bs, BinOpcode::FILE_READ, 3, meta, nullptr, 0, rh, rmeta, rpayload) || rh.status != 0 ||
+            rpayload.size() != size || memcmp(rpayload.data(), data.data(), size) != 0) {
+            std::cerr << "binary download failed: " << rh.status << " " << rmeta << "\n";
+            return 1;
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "binary: upload " << mbps(size * iters, t1 - t0) << " MB/s, download "
+              << mbps(size * iters, t2 - t1) << " MB/s\n";
+    close(bs);
+
+    // JSON lines cannot carry arbitrary bytes, so send the same size as text.
+    std::string text(size, 'a');
+    for (size_t i = 0; i < size; i += 61) text[i] = '"';
+    int js = connect_to(host, port);
+    if (js < 0) return 1;
+    std::string req = "{\"operation\":\"file_create\",\"token\":\"" + token + "\",\"path\":\"/transfer_bench.txt\",\"data\":\"";
+    append_json_escaped(req, text);
+    req += "\"}\n";
+    std::string line;
+    auto t3 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) json_call(js, req, line);
+    auto t4 = std::chrono::steady_clock::now();
+    std::string rd = "{\"operation\":\"file_read\",\"token\":\"" + token + "\",\"path\":\"/transfer_bench.txt\"}\n";
+    std::string scratch;
+    size_t got = 0;
+    for (int i = 0; i < iters; ++i) {
+        json_call(js, rd, line);
+        JsonView rv;
+        rv.parse(line);
+        got = rv.str("data", scratch).size();
+    }
+    auto t5 = std::chrono::steady_clock::now();
+    if (got != size) std::cerr << "json download returned " << got << " bytes\n";
+    std::cout << "json:   upload " << mbps(size * iters, t4 - t3) << " MB/s, download "
+              << mbps(size * iters, t5 - t4) << " MB/s\n";
+    close(js);
+
+    // Baseline: the same bytes written to and read back from a local file.
+    const char* tmp = "transfer_bench.tmp";
+    auto t6 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ssize_t w = write(fd, data.data(), size);
+        (void)w;
+        close(fd);
+    }
+    auto t7 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+        int fd = open(tmp, O_RDONLY);
+        ssize_t r = read(fd, &rpayload[0], size);
+        (void)r;
+        close(fd);
+    }
+    auto t8 = std::chrono::steady_clock::now();
+    unlink(tmp);
+    std::cout << "disk:   write " << mbps(size * iters, t7 - t6) << " MB/s, read "
+              << mbps(size * iters, t8 - t7) << " MB/s\n";
+    return 0;
+}
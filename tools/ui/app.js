@@ -220,6 +220,11 @@ function initDashboard() {
     currentFile = null;
   });
   document.getElementById('close-dir').addEventListener('click', () => showPanel('welcome-screen'));
+
+  document.getElementById('search-btn').addEventListener('click', searchFiles);
+  document.getElementById('search-input').addEventListener('keypress', (e) => {
+    if (e.key === 'Enter') searchFiles();
+  });
 }
 
 async function loadFiles() {
@@ -320,6 +325,47 @@ async function openDirectory(dirname) {
   }
 }
 
+// Searches entry names across the whole tree; a pattern with * or ? is a
+// glob over the full name, anything else matches part of it.
+async function searchFiles() {
+  const pattern = document.getElementById('search-input').value.trim();
+  if (!pattern) return;
+  const result = await apiCall('file_search', { pattern, glob: /[*?]/.test(pattern), limit: 200 });
+
+  if (result.status === 'success') {
+    document.getElementById('dir-name').textContent = `Search: ${pattern}`;
+    const grid = document.getElementById('dir-contents');
+    grid.innerHTML = '';
+
+    const entries = result.entries || [];
+    if (entries.length === 0) {
+      grid.innerHTML = '<div style="padding:20px;color:var(--text-muted)">No matches</div>';
+    }
+    entries.forEach(entry => {
+      const item = document.createElement('div');
+      item.className = 'dir-item';
+      // Results carry full paths
+      item.innerHTML = `
+        <div class="dir-item-icon">${entry.type == 1 ? '📁' : '📄'}</div>
+        <div class="dir-item-name"></div>
+      `;
+      item.querySelector('.dir-item-name').textContent = entry.name;
+      item.onclick = () => {
+        if (entry.type == 1) {
+          openDirectory(entry.name);
+        } else {
+          openFile(entry.name);
+        }
+      };
+      grid.appendChild(item);
+    });
+
+    showPanel('directory-view');
+  } else {
+    alert('Search failed: ' + (result.error || 'Unknown error'));
+  }
+}
+
 async function createFile() {
   const name = document.getElementById('modal-input').value.trim();
   if (!name) return;